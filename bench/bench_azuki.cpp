@@ -0,0 +1,497 @@
+// Benchmark Azuki against std::regex on the same patterns and inputs, and
+// compare Azuki engines with each other. Results are written as JSON to
+// stdout, or to the file given as the first argument:
+//    bench_azuki results.json
+// Build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <thread>
+#include "azuki.h"
+#include "serialize.h"
+#include "utility.h"
+
+namespace {
+
+using Azuki::Machine;
+using Azuki::MatchResult;
+using Azuki::string;
+using Azuki::vector;
+
+// Minimum time spent on each measurement.
+const double kMinSeconds = 0.2;
+
+// The Measurement struct holds the result of running one engine on one case.
+struct Measurement {
+  string engine;
+  double seconds_per_run;  // average time of a single run
+  long matches;            // matches found by a single run, or -1
+  string error;            // set if the engine failed
+};
+
+// Run f repeatedly for at least kMinSeconds, and return the average time of
+// a single run. The return value of the last run is saved in matches.
+double TimeRuns(const std::function<long()> &f, long &matches) {
+  auto start = std::chrono::steady_clock::now();
+  long runs = 0;
+  std::chrono::duration<double> elapsed(0);
+  do {
+    matches = f();
+    ++runs;
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while (elapsed.count() < kMinSeconds);
+  return elapsed.count() / runs;
+}
+
+Measurement Measure(const string &engine, const std::function<long()> &f) {
+  Measurement result{engine, 0, -1, ""};
+  try {
+    result.seconds_per_run = TimeRuns(f, result.matches);
+  } catch (const std::exception &e) {
+    result.error = e.what();
+  }
+  return result;
+}
+
+// Create a machine running only the interpreter, with the same positional
+// flags as CreateMachine.
+Machine CreateInterpreter(const string &e) {
+  bool match_begin = Azuki::StartsWith(e, '^');
+  bool match_end = Azuki::EndsWith(e, '$') && !Azuki::EndsWith(e, "\\$");
+  int begin = match_begin ? 1 : 0;
+  int end = match_end ? e.size() - 1 : e.size();
+  Machine m(Azuki::CompileRegexp(
+      Azuki::ParseRegexp(e.substr(begin, end - begin))));
+  m.SetMatchBegin(match_begin);
+  m.SetMatchEnd(match_end);
+  return m;
+}
+
+// Count matches in every line of lines.
+long CountMatches(const Machine &m, const vector<string> &lines,
+                  bool save_capture) {
+  long count = 0;
+  for (auto &s : lines) {
+    MatchResult ms;
+    while (Azuki::RegexSearch(m, s, ms, save_capture)) ++count;
+  }
+  return count;
+}
+
+long CountMatches(const std::regex &re, const vector<string> &lines) {
+  long count = 0;
+  for (auto &s : lines) {
+    std::sregex_iterator it(s.begin(), s.end(), re), end;
+    for (; it != end; ++it) ++count;
+  }
+  return count;
+}
+
+string JsonString(const string &s) {
+  std::ostringstream ss;
+  ss << '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      ss << '\\' << c;
+    else if (c == '\n')
+      ss << "\\n";
+    else
+      ss << c;
+  }
+  ss << '"';
+  return ss.str();
+}
+
+// The Report class collects measurements and writes them as JSON.
+class Report {
+ public:
+  void Add(const string &kind, const string &name, const string &pattern,
+           unsigned long bytes, const vector<Measurement> &measurements) {
+    std::ostringstream ss;
+    ss << "    {\"kind\": " << JsonString(kind)
+       << ", \"name\": " << JsonString(name)
+       << ", \"pattern\": " << JsonString(pattern)
+       << ", \"bytes\": " << bytes << ", \"results\": [";
+    for (unsigned int i = 0; i < measurements.size(); ++i) {
+      auto &m = measurements[i];
+      ss << (i ? ", " : "") << "\n      {\"engine\": " << JsonString(m.engine);
+      if (!m.error.empty()) {
+        ss << ", \"error\": " << JsonString(m.error) << "}";
+        continue;
+      }
+      ss << ", \"ns_per_run\": " << m.seconds_per_run * 1e9;
+      if (bytes) ss << ", \"bytes_per_sec\": " << bytes / m.seconds_per_run;
+      if (m.matches >= 0) ss << ", \"matches\": " << m.matches;
+      ss << "}";
+    }
+    ss << "]}";
+    entries.push_back(ss.str());
+    std::cerr << kind << "\t" << name << std::endl;
+  }
+
+  void Write(std::ostream &os) const {
+    // Parallel cases can't be faster than Run with fewer hardware threads
+    // than search threads.
+    os << "{\n  \"hardware_threads\": " << std::thread::hardware_concurrency()
+       << ",\n  \"benchmarks\": [\n";
+    for (unsigned int i = 0; i < entries.size(); ++i)
+      os << entries[i] << (i + 1 < entries.size() ? ",\n" : "\n");
+    os << "  ]\n}\n";
+  }
+
+ private:
+  vector<string> entries;
+};
+
+// Measure building a machine and a std::regex from pattern.
+void BenchCompile(Report &report, const string &name, const string &pattern) {
+  vector<Measurement> measurements;
+  measurements.push_back(Measure("azuki", [&] {
+    Machine m = Azuki::CreateMachine(pattern);
+    return -1L;
+  }));
+  measurements.push_back(Measure("azuki_interpreter", [&] {
+    Machine m = CreateInterpreter(pattern);
+    return -1L;
+  }));
+  measurements.push_back(Measure("std_regex", [&] {
+    std::regex re(pattern);
+    return -1L;
+  }));
+  report.Add("compile", name, pattern, 0, measurements);
+}
+
+// Measure creating a machine from pattern saved in a program file, against
+// compiling it. Without the engines saved in the file (like files of version
+// 4 and older), the machine creates them again.
+void BenchLoad(Report &report, const string &name, const string &pattern) {
+  string path =
+      (std::filesystem::temp_directory_path() / "bench_azuki_programs.bin")
+          .string();
+  {
+    std::ofstream os(path, std::ios::binary);
+    Azuki::SavePrograms({Azuki::CreateCompiledRegexp(pattern)}, os);
+  }
+  Azuki::ProgramFile file(path);
+  std::remove(path.c_str());  // the mapping stays valid
+
+  vector<Measurement> measurements;
+  measurements.push_back(Measure("azuki_compile", [&] {
+    Machine m = Azuki::CreateMachine(pattern);
+    return -1L;
+  }));
+  measurements.push_back(Measure("azuki_load", [&] {
+    Machine m(file.Get(0));
+    return -1L;
+  }));
+  measurements.push_back(Measure("azuki_load_without_engines", [&] {
+    Azuki::CompiledRegexp cr = file.Get(0);
+    cr.engines.reset();
+    Machine m(cr);
+    return -1L;
+  }));
+  report.Add("load", name, pattern, 0, measurements);
+}
+
+// Measure finding all matches of pattern in every line of lines.
+// The interpreter alone is orders of magnitude slower on long inputs and
+// backtracking patterns, so it only runs if with_interpreter is true.
+void BenchSearch(Report &report, const string &kind, const string &name,
+                 const string &pattern, const vector<string> &lines,
+                 bool save_capture, bool with_interpreter = false) {
+  unsigned long bytes = 0;
+  for (auto &s : lines) bytes += s.size();
+
+  vector<Measurement> measurements;
+  Machine m = Azuki::CreateMachine(pattern);
+  measurements.push_back(Measure(
+      "azuki", [&] { return CountMatches(m, lines, save_capture); }));
+  Machine interpreter = CreateInterpreter(pattern);
+  if (with_interpreter) {
+    measurements.push_back(Measure("azuki_interpreter", [&] {
+      return CountMatches(interpreter, lines, save_capture);
+    }));
+  }
+  if (!save_capture) {
+    measurements.push_back(Measure("azuki_count", [&] {
+      long count = 0;
+      for (auto &s : lines) count += Azuki::RegexCount(m, s);
+      return count;
+    }));
+  }
+  // Native code doesn't track capture groups.
+  Machine jit = CreateInterpreter(pattern);
+  if (!save_capture && jit.EnableJit()) {
+    measurements.push_back(Measure(
+        "azuki_jit", [&] { return CountMatches(jit, lines, save_capture); }));
+  }
+  std::regex re(pattern);
+  measurements.push_back(
+      Measure("std_regex", [&] { return CountMatches(re, lines); }));
+  report.Add(kind, name, pattern, bytes, measurements);
+}
+
+// Measure counting lines with a match of pattern, like a filter running a
+// rule on each line. Azuki runs small patterns with BitParallel here, and the
+// interpreter shows the cost of the thread VM.
+void BenchFilter(Report &report, const string &name, const string &pattern,
+                 const vector<string> &lines) {
+  unsigned long bytes = 0;
+  for (auto &s : lines) bytes += s.size();
+
+  vector<Measurement> measurements;
+  auto count_lines = [&](const Machine &m) {
+    long count = 0;
+    for (auto &s : lines) count += Azuki::RegexSearch(m, s);
+    return count;
+  };
+  Machine m = Azuki::CreateMachine(pattern);
+  measurements.push_back(Measure("azuki", [&] { return count_lines(m); }));
+  Machine interpreter = CreateInterpreter(pattern);
+  measurements.push_back(Measure("azuki_interpreter",
+                                 [&] { return count_lines(interpreter); }));
+  Machine jit = CreateInterpreter(pattern);
+  if (jit.EnableJit()) {
+    measurements.push_back(
+        Measure("azuki_jit", [&] { return count_lines(jit); }));
+  }
+  std::regex re(pattern);
+  measurements.push_back(Measure("std_regex", [&] {
+    long count = 0;
+    for (auto &s : lines) count += std::regex_search(s, re);
+    return count;
+  }));
+  report.Add("filter", name, pattern, bytes, measurements);
+}
+
+// Measure finding all matches of pattern in UTF-8 mode. If byte_pattern is
+// not empty, it's measured in the default mode for comparison, e.g. "." in
+// UTF-8 mode against "." matching bytes.
+void BenchUtf8(Report &report, const string &name, const string &pattern,
+               const string &byte_pattern, const vector<string> &lines) {
+  unsigned long bytes = 0;
+  for (auto &s : lines) bytes += s.size();
+
+  vector<Measurement> measurements;
+  Azuki::RegexOptions options;
+  options.flags = Azuki::UTF8;
+  Machine m = Azuki::CreateMachine(pattern, options);
+  measurements.push_back(
+      Measure("azuki_utf8", [&] { return CountMatches(m, lines, false); }));
+  if (!byte_pattern.empty()) {
+    Machine bytes_machine = Azuki::CreateMachine(byte_pattern);
+    measurements.push_back(Measure("azuki", [&] {
+      return CountMatches(bytes_machine, lines, false);
+    }));
+  }
+  report.Add("utf8", name, pattern, bytes, measurements);
+}
+
+// Measure a single search in one large input with Machine::RunParallel, for
+// each number of threads in num_threads.
+void BenchParallel(Report &report, const string &name, const string &pattern,
+                   const string &input,
+                   const vector<unsigned int> &num_threads) {
+  vector<Measurement> measurements;
+  Machine m = Azuki::CreateMachine(pattern);
+  measurements.push_back(
+      Measure("azuki", [&] { return static_cast<long>(m.Run(input).end); }));
+  for (unsigned int n : num_threads) {
+    measurements.push_back(Measure("azuki_parallel_" + std::to_string(n), [&] {
+      return static_cast<long>(m.RunParallel(input, n).end);
+    }));
+  }
+  report.Add("parallel", name, pattern, input.size(), measurements);
+}
+
+// Measure global replacement. Azuki numbers capture groups from "$0" and
+// std::regex from "$1", so each takes its own format string.
+void BenchReplace(Report &report, const string &name, const string &pattern,
+                  const string &input, const string &fmt,
+                  const string &std_fmt) {
+  vector<Measurement> measurements;
+  Machine m = Azuki::CreateMachine(pattern);
+  measurements.push_back(Measure("azuki", [&] {
+    return static_cast<long>(Azuki::RegexReplace(m, input, fmt, true).size());
+  }));
+  std::regex re(pattern);
+  measurements.push_back(Measure("std_regex", [&] {
+    return static_cast<long>(std::regex_replace(input, re, std_fmt).size());
+  }));
+  report.Add("replace", name, pattern, input.size(), measurements);
+}
+
+// Corpora are generated with a fixed seed, so runs are comparable.
+
+vector<string> CreateLogLines(unsigned int n) {
+  std::mt19937 rng(1);
+  const char *levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+  const char *actions[] = {"GET /index.html", "POST /api/login",
+                           "GET /static/app.js", "DELETE /api/item"};
+  vector<string> lines;
+  for (unsigned int i = 0; i < n; ++i) {
+    std::ostringstream ss;
+    ss << "2024-03-" << 10 + rng() % 20 << " " << rng() % 24 << ":"
+       << 10 + rng() % 50 << ":" << 10 + rng() % 50 << " "
+       << levels[rng() % 6] << " [worker-" << rng() % 8 << "] "
+       << actions[rng() % 4] << " from 10." << rng() % 256 << "."
+       << rng() % 256 << "." << rng() % 256 << " took " << rng() % 1000
+       << "ms";
+    lines.push_back(ss.str());
+  }
+  return lines;
+}
+
+vector<string> CreateEmailLines(unsigned int n) {
+  std::mt19937 rng(2);
+  const char *words[] = {"hello", "please", "contact", "the", "team",
+                         "about", "your", "order", "at",  "or"};
+  const char *names[] = {"alice", "bob", "carol", "dave", "eve"};
+  const char *domains[] = {"example", "mail", "azuki"};
+  vector<string> lines;
+  for (unsigned int i = 0; i < n; ++i) {
+    string line;
+    for (int w = 0; w < 12; ++w) {
+      if (rng() % 6 == 0) {
+        line += string(names[rng() % 5]) + "@" + domains[rng() % 3] + ".com ";
+      } else {
+        line += string(words[rng() % 10]) + " ";
+      }
+    }
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+vector<string> CreatePhoneLines(unsigned int n) {
+  std::mt19937 rng(3);
+  const char *formats[] = {"%03d-%03d-%04d", "(%03d) %03d-%04d",
+                           "%03d %03d %04d", "%03d.%03d.%04d"};
+  vector<string> lines;
+  for (unsigned int i = 0; i < n; ++i) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), formats[rng() % 4], rng() % 1000,
+             rng() % 1000, rng() % 10000);
+    lines.push_back(buffer);
+  }
+  return lines;
+}
+
+// Lines mixing Latin, Greek, Cyrillic, CJK and emoji.
+vector<string> CreateMixedScriptLines(unsigned int n) {
+  std::mt19937 rng(4);
+  const char *words[] = {"hello", "world", "καλημέρα", "κόσμε", "привет",
+                         "мир",   "你好",  "世界",     "こんにちは", "😀",
+                         "42",    "café"};
+  vector<string> lines;
+  for (unsigned int i = 0; i < n; ++i) {
+    string line;
+    for (int w = 0; w < 12; ++w) line += string(words[rng() % 12]) + " ";
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+string Join(const vector<string> &lines) {
+  string s;
+  for (auto &line : lines) s += line + "\n";
+  return s;
+}
+
+};  // namespace
+
+int main(int argc, char *argv[]) {
+  Report report;
+  vector<string> logs = CreateLogLines(500);
+  vector<string> emails = CreateEmailLines(500);
+  vector<string> phones = CreatePhoneLines(500);
+  const string phone_pattern =
+      "^(\\+\\d{1,2}\\s)?\\(?\\d{3}\\)?(\\s|-|.)\\d{3}(\\s|-|.)\\d{4}$";
+
+  BenchCompile(report, "literal", "ERROR");
+  BenchCompile(report, "email", "(\\w+)@(\\w+)\\.com");
+  BenchCompile(report, "phone", phone_pattern);
+  BenchCompile(report, "counters", "\\w{8}-\\w{4}-\\w{12}");
+
+  BenchLoad(report, "literal", "ERROR");
+  BenchLoad(report, "email", "(\\w+)@(\\w+)\\.com");
+  BenchLoad(report, "phone", phone_pattern);
+  BenchLoad(report, "counters", "\\w{8}-\\w{4}-\\w{12}");
+
+  BenchSearch(report, "search", "log_literal", "ERROR", {Join(logs)}, false);
+  BenchSearch(report, "search", "log_ip", "\\d+\\.\\d+\\.\\d+\\.\\d+",
+              {Join(logs)}, false);
+  BenchSearch(report, "search", "email", "[a-z]+@[a-z]+\\.com",
+              {Join(emails)}, false);
+  // No byte of the input may begin a match, so it's only scanned for them.
+  BenchSearch(report, "search", "rare_first_byte", "(?:#|%)\\d+",
+              {Join(logs)}, false);
+  BenchSearch(report, "search", "phone_lines", phone_pattern, phones, false,
+              true);
+
+  BenchFilter(report, "log_level", "ERROR|WARN", logs);
+  BenchFilter(report, "log_api", "(POST|DELETE)\\s.api.\\w+\\sfrom\\s10\\.1",
+              logs);
+  BenchFilter(report, "log_slow", "took\\s\\d{3}ms$", logs);
+
+  BenchSearch(report, "capture", "log_fields",
+              "(\\d+):(\\d+):(\\d+) ([A-Z]+) \\[(\\w+)-(\\d)\\]", {Join(logs)},
+              true);
+  BenchSearch(report, "capture", "email", "(\\w+)@(\\w+)\\.(\\w+)",
+              {Join(emails)}, true);
+  BenchSearch(report, "capture", "phone_lines", phone_pattern, phones, true,
+              true);
+
+  string mixed = Join(CreateMixedScriptLines(500));
+  BenchUtf8(report, "greek_words", "[α-ω]+", "", {mixed});
+  BenchUtf8(report, "cyrillic_words", "[а-я]+", "", {mixed});
+  BenchUtf8(report, "cjk", "[一-龥]+", "", {mixed});
+  BenchUtf8(report, "dot_pairs", "..", "..", {mixed});
+  BenchUtf8(report, "ascii_words", "[a-z]+", "[a-z]+", {mixed});
+
+  BenchReplace(report, "log_duration", "took (\\d+)ms", Join(logs),
+               "took $0 ms", "took $1 ms");
+  BenchReplace(report, "email_mask", "(\\w+)@(\\w+)\\.com", Join(emails),
+               "$0 at $1", "$1 at $2");
+
+  // The only match is at the end of about 40 MB. With the literal prefix,
+  // Run and RunParallel both skip to the last line, so threads don't help.
+  string huge = Join(CreateLogLines(500000)) + "FATAL disk full\n";
+  BenchParallel(report, "log_last_line", "FATAL (\\w+)", huge,
+                {2, 4, 8, 16});
+  // Upper case letters are everywhere, so each segment is scanned by the
+  // Dfa, which is where threads help.
+  BenchParallel(report, "log_last_line_class", "[A-Z]+AL (\\w+)", huge,
+                {2, 4, 8, 16});
+  // There is no match, but threads of "a.*" live through every segment, so
+  // the search goes on with a single thread after the segments, and is
+  // slower than Run.
+  BenchParallel(report, "log_dot_star", "a.*PANIC", huge, {4});
+
+  // Patterns with exponential backtracking in std::regex.
+  string x(18, 'x');
+  BenchSearch(report, "pathological", "nested_plus", "(x+x+)+y", {x}, false);
+  string optional, required;
+  for (int i = 0; i < 18; ++i) {
+    optional += "a?";
+    required += "a";
+  }
+  BenchSearch(report, "pathological", "optional_prefix", optional + required,
+              {string(18, 'a')}, false);
+  BenchSearch(report, "pathological", "many_dots", ".*.*.*=", {string(256, 'x')},
+              false);
+
+  if (argc > 1) {
+    std::ofstream file(argv[1]);
+    report.Write(file);
+  } else {
+    report.Write(std::cout);
+  }
+  return 0;
+}
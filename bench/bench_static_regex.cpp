@@ -0,0 +1,57 @@
+// Compare StaticRegex with the runtime Machine on the same patterns.
+// Build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+#include <chrono>
+#include <iostream>
+#include "azuki.h"
+#include "static_regex.h"
+
+namespace {
+
+using Azuki::MatchResult;
+using Azuki::string;
+
+// Return bytes per second of running search on input for iterations times.
+template <typename Search>
+double Throughput(const string &input, int iterations, Search search) {
+  auto start = std::chrono::steady_clock::now();
+  int found = 0;
+  for (int i = 0; i < iterations; ++i) found += search(input);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  if (found < 0) std::cout << found;  // keep the searches alive
+  return input.size() * iterations / elapsed.count();
+}
+
+template <Azuki::FixedString Pattern>
+void Compare(const string &input, int iterations) {
+  Azuki::Machine m = Azuki::CreateMachine(Pattern.data);
+  Azuki::StaticRegex<Pattern> sm;
+
+  double dynamic_bps = Throughput(input, iterations, [&](const string &s) {
+    MatchResult ms = m.Run(s);
+    return ms.success ? 1 : 0;
+  });
+  double static_bps = Throughput(input, iterations, [&](const string &s) {
+    MatchResult ms = sm.Run(s);
+    return ms.success ? 1 : 0;
+  });
+  std::cout << Pattern.data << "\tMachine " << dynamic_bps / 1e6
+            << " MB/s\tStaticRegex " << static_bps / 1e6 << " MB/s\t"
+            << static_bps / dynamic_bps << "x" << std::endl;
+}
+
+};  // namespace
+
+int main() {
+  string laugh(4096, '6');
+  laugh += "2333QAQ";
+  string url;
+  for (int i = 0; i < 64; ++i) url += "https://example.org/search?q=Hello ";
+  url += "https://www.google.com/search?q=Hello";
+  string phone = "123-456-7890";
+
+  Compare<"(233+)">(laugh, 20);
+  Compare<"www\\.(\\w+)\\.com">(url, 20);
+  Compare<"^\\(?\\d{3}\\)?(\\s|-|.)\\d{3}(\\s|-|.)\\d{4}$">(phone, 2000);
+  return 0;
+}
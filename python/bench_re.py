@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+"""Compare finditer, findall and sub of pyazuki with the re module.
+
+Usage: python3 bench_re.py [repeat]
+"""
+
+import re
+import sys
+import timeit
+
+import pyazuki
+
+PATTERNS = [
+    ("literal", "ERROR", "ERROR"),
+    ("word", "\\w+@\\w+", r"\w+@\w+"),
+    ("groups", "(\\d+)-(\\d+)", r"(\d+)-(\d+)"),
+]
+
+
+def corpus(lines=500):
+    rows = []
+    for i in range(lines):
+        level = "ERROR" if i % 17 == 0 else "INFO"
+        rows.append("%s user%d@host%d request %d-%d done\n"
+                    % (level, i, i % 7, i, i * 31))
+    return "".join(rows).encode()
+
+
+def bench(name, stmt, repeat):
+    best = min(timeit.repeat(stmt, number=1, repeat=repeat))
+    print("%-10s %-12s %10.3f ms" % (name[0], name[1], best * 1000))
+    return best
+
+
+def main():
+    repeat = int(sys.argv[1]) if len(sys.argv) > 1 else 5
+    data = corpus()
+    for name, azuki_pattern, re_pattern in PATTERNS:
+        machine = pyazuki.CreateMachine(azuki_pattern)
+        regex = re.compile(re_pattern.encode())
+        expected = [m.span() for m in regex.finditer(data)]
+        actual = [m.span() for m in pyazuki.finditer(machine, data)]
+        if expected != actual:
+            print("%s: matches differ from re" % name)
+
+        print("%s (%d matches)" % (name, len(expected)))
+        for engine, stmt in [
+                ("finditer", lambda: [m.span()
+                                      for m in pyazuki.finditer(machine, data)]),
+                ("findall", lambda: pyazuki.findall(machine, data)),
+                ("sub", lambda: pyazuki.sub(machine, "-", data)),
+        ]:
+            bench(("azuki", engine), stmt, repeat)
+        for engine, stmt in [
+                ("finditer", lambda: [m.span() for m in regex.finditer(data)]),
+                ("findall", lambda: regex.findall(data)),
+                ("sub", lambda: regex.sub(b"-", data)),
+        ]:
+            bench(("re", engine), stmt, repeat)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,41 +1,508 @@
 #include <boost/python.hpp>
 #include <boost/python/suite/indexing/vector_indexing_suite.hpp>
+#include <mutex>
+#include <shared_mutex>
+#include <type_traits>
 #include "azuki.h"
 #include "common.h"
 #include "machine.h"
+#include "utility.h"
 
-BOOST_PYTHON_MODULE(pyazuki) {
-  using namespace Azuki;
-  using namespace boost::python;
+namespace {
+
+using namespace Azuki;
+using namespace boost::python;
+
+// The Buffer class views the bytes of a Python object without copying them.
+// Objects supporting the buffer protocol (bytes, bytearray, memoryview, ...)
+// are viewed directly, and str is viewed as UTF-8. The buffer is locked, so
+// it can't be resized while the GIL is released.
+class Buffer {
+ public:
+  explicit Buffer(object obj) : obj(obj), has_view(false) {
+    PyObject *p = obj.ptr();
+    if (PyObject_CheckBuffer(p)) {
+      if (PyObject_GetBuffer(p, &view, PyBUF_SIMPLE) != 0)
+        throw_error_already_set();
+      has_view = true;
+      data = string_view(static_cast<const char *>(view.buf), view.len);
+    } else if (PyUnicode_Check(p)) {
+      Py_ssize_t size = 0;
+      const char *s = PyUnicode_AsUTF8AndSize(p, &size);
+      if (!s) throw_error_already_set();
+      data = string_view(s, size);
+    } else {
+      PyErr_SetString(PyExc_TypeError, "expected str or bytes-like object");
+      throw_error_already_set();
+    }
+  }
+
+  ~Buffer() {
+    if (has_view) PyBuffer_Release(&view);
+  }
+
+  Buffer(const Buffer &) = delete;
+  Buffer &operator=(const Buffer &) = delete;
+
+  string_view str() const { return data; }
+
+  // Return true if the object is str, which is viewed as UTF-8.
+  bool IsText() const { return PyUnicode_Check(obj.ptr()); }
+
+ private:
+  object obj;  // keep the object alive
+  Py_buffer view;
+  bool has_view;
+  string_view data;
+};
+
+// The ReleaseGil class lets other Python threads run in its scope.
+class ReleaseGil {
+ public:
+  ReleaseGil() : state(PyEval_SaveThread()) {}
+  ~ReleaseGil() { PyEval_RestoreThread(state); }
+
+ private:
+  PyThreadState *state;
+};
+
+// The PyMachine struct is the Machine of Python. Runs release the GIL, so
+// another Python thread may change settings of the machine while it runs:
+// runs hold the lock of the machine shared, and setters hold it exclusively.
+struct PyMachine {
+  explicit PyMachine(const Program &program) : machine(program) {}
+  explicit PyMachine(Machine &&machine) : machine(std::move(machine)) {}
+  // Only new machines are copied, into Python objects, so other is not locked.
+  PyMachine(const PyMachine &other) : machine(other.machine) {}
+
+  Machine machine;
+  mutable std::shared_mutex mutex;
+};
+
+// The Running class lets other Python threads run in its scope, and keeps
+// settings of m in place. The GIL is released before locking and taken back
+// after unlocking, so a run never waits for the GIL with the lock held.
+class Running {
+ public:
+  explicit Running(const PyMachine &m) : lock(m.mutex) {}
+
+ private:
+  ReleaseGil unlocked;
+  std::shared_lock<std::shared_mutex> lock;
+};
+
+// The Changing class lets settings of m change in its scope. Like Running,
+// it waits for the lock without the GIL.
+class Changing {
+ public:
+  explicit Changing(PyMachine &m) : lock(m.mutex) {}
+
+ private:
+  ReleaseGil unlocked;
+  std::unique_lock<std::shared_mutex> lock;
+};
+
+// Call setter Set of Machine on m with value.
+template <typename T, void (Machine::*Set)(T)>
+void Setter(PyMachine &m, T value) {
+  std::decay_t<T> copy = value;  // value may be owned by Python
+  Changing changing(m);
+  (m.machine.*Set)(copy);
+}
+
+MatchPlan GetPlan(const PyMachine &m) {
+  Running running(m);
+  return m.machine.GetPlan();
+}
+
+PyMachine CreateFromPattern(const string &e) {
+  return PyMachine(CreateMachine(e));
+}
+
+PyMachine CreateWithOptions(const string &e, const RegexOptions &options) {
+  return PyMachine(CreateMachine(e, options));
+}
+
+// MatchResult for Python. Capture groups of MatchResult are read from the
+// searched buffer, which may be gone when they are read in Python, so they
+// are copied once a search finishes.
+struct PyMatchResult {
+  unsigned int begin, end;
+  vector<string> capture;
+
+  PyMatchResult() : begin(0), end(0) {}
+  explicit PyMatchResult(const MatchResult &ms)
+      : begin(ms.begin), end(ms.end), capture(ms.capture) {}
+};
+
+PyMatchResult Run(const PyMachine &m, object data, bool save_capture) {
+  Buffer buffer(data);
+  Running running(m);
+  return PyMatchResult(m.machine.Run(buffer.str(), save_capture));
+}
+
+// Print the program of m annotated with its profile (see MatchProfile).
+void PrintProfile(const PyMachine &m) {
+  Running running(m);
+  PrintProgram(m.machine.GetProgram(), m.machine.GetProfile());
+}
+
+bool Search(const PyMachine &m, object data) {
+  Buffer buffer(data);
+  Running running(m);
+  return RegexSearch(m.machine, buffer.str());
+}
+
+bool FullMatch(const PyMachine &m, object data) {
+  Buffer buffer(data);
+  Running running(m);
+  return RegexMatch(m.machine, buffer.str());
+}
+
+bool PrefixMatch(const PyMachine &m, object data) {
+  Buffer buffer(data);
+  Running running(m);
+  return RegexMatchPrefix(m.machine, buffer.str());
+}
+
+bool SearchWithResult(const PyMachine &m, object data, PyMatchResult &result,
+                      bool save_capture) {
+  Buffer buffer(data);
+  MatchResult temp;  // result is owned by Python
+  temp.end = result.end;
+  bool found = false;
+  {
+    Running running(m);
+    found = RegexSearch(m.machine, buffer.str(), temp, save_capture);
+  }
+  if (found) result = PyMatchResult(temp);
+  return found;
+}
 
+// Search data from index pos, and return None if there is no match, or the
+// span (begin, end) of the match as integers. If captures is true, capture
+// groups are returned as bytes too: (begin, end, (group0, group1, ...)).
+object SearchSpan(const PyMachine &m, object data, unsigned int pos,
+                  bool captures) {
+  Buffer buffer(data);
+  MatchResult ms;
+  ms.end = pos;
+  bool found = false;
+  {
+    Running running(m);
+    found = RegexSearch(m.machine, buffer.str(), ms, captures);
+  }
+  if (!found) return object();
+  if (!captures) return make_tuple(ms.begin, ms.end);
+
+  list groups;
+  for (size_t i = 0; i < ms.capture.size(); ++i) {
+    string_view s = ms.capture.View(i);
+    groups.append(handle<>(PyBytes_FromStringAndSize(s.data(), s.size())));
+  }
+  return make_tuple(ms.begin, ms.end, tuple(groups));
+}
+
+// Return the index to search from after an empty match at pos: the next
+// character, or the next code point if s is the UTF-8 of a str, so that
+// searches never begin inside a character.
+unsigned int NextIndex(string_view s, unsigned int pos, bool text) {
+  ++pos;
+  while (text && pos < s.size() &&
+         (static_cast<unsigned char>(s[pos]) & 0xC0) == 0x80)
+    ++pos;
+  return pos;
+}
+
+// Return substring [begin, end) of data as an object of the same kind: str
+// if data is str, otherwise bytes. A substring of str which splits a UTF-8
+// character raises UnicodeDecodeError, so patterns which may match part of
+// a character (like "." without the UTF8 flag) should be built with UTF8.
+object Slice(object data, string_view s, unsigned int begin,
+             unsigned int end) {
+  if (begin > end || end > s.size()) {
+    PyErr_SetString(PyExc_IndexError, "match is out of the input");
+    throw_error_already_set();
+  }
+  PyObject *p = PyUnicode_Check(data.ptr())
+                    ? PyUnicode_DecodeUTF8(s.data() + begin, end - begin,
+                                           "strict")
+                    : PyBytes_FromStringAndSize(s.data() + begin, end - begin);
+  if (!p) throw_error_already_set();
+  return object(handle<>(p));
+}
+
+// The Match class holds offsets of a match found by finditer. Substrings are
+// only created when a group is accessed. Like the re module, group 0 is the
+// whole match and group i is capture group i - 1 of Azuki. Offsets in str
+// are offsets of its UTF-8 bytes.
+class Match {
+ public:
+  Match(object data, const MatchResult &ms, unsigned int num_groups)
+      : data(data),
+        begin(ms.begin),
+        end(ms.end),
+        spans(ms.spans),
+        num_groups(num_groups) {}
+
+  // Return the span of group i, or (UINT_MAX, UINT_MAX) if it's not matched.
+  // Raise IndexError if there is no group i, like the re module.
+  pair<unsigned int, unsigned int> Span(unsigned int i) const {
+    if (i == 0) return std::make_pair(begin, end);
+    if (i > num_groups) {
+      PyErr_SetString(PyExc_IndexError, "no such group");
+      throw_error_already_set();
+    }
+    if (i <= spans.size()) return spans[i - 1];
+    return std::make_pair(UINT_MAX, UINT_MAX);
+  }
+
+  object Group(unsigned int i) const {
+    auto span = Span(i);
+    if (span.first == UINT_MAX) return object();
+    Buffer buffer(data);
+    return Slice(data, buffer.str(), span.first, span.second);
+  }
+
+  object Start(unsigned int i) const {
+    auto span = Span(i);
+    return span.first == UINT_MAX ? object(-1) : object(span.first);
+  }
+
+  object End(unsigned int i) const {
+    auto span = Span(i);
+    return span.second == UINT_MAX ? object(-1) : object(span.second);
+  }
+
+  tuple SpanTuple(unsigned int i) const { return make_tuple(Start(i), End(i)); }
+
+  tuple Groups() const {
+    list groups;
+    for (unsigned int i = 1; i <= num_groups; ++i) groups.append(Group(i));
+    return tuple(groups);
+  }
+
+ private:
+  object data;  // searched object
+  unsigned int begin, end;
+  vector<pair<unsigned int, unsigned int>> spans;
+  unsigned int num_groups;  // groups of the machine
+};
+
+// The FindIter class iterates over non-overlapping matches in data. Each step
+// continues from the end of the last match, so data is scanned once.
+class FindIter {
+ public:
+  FindIter(object machine, object data)
+      : machine(machine), data(data), pos(0), done(false) {}
+
+  Match Next() {
+    const PyMachine &m = extract<const PyMachine &>(machine);
+    Buffer buffer(data);
+    MatchResult ms;
+    ms.end = pos;
+    bool found = false;
+    if (!done) {
+      Running running(m);
+      found = RegexSearch(m.machine, buffer.str(), ms, true);
+    }
+    if (!found) {
+      done = true;
+      PyErr_SetNone(PyExc_StopIteration);
+      throw_error_already_set();
+    }
+    // skip a character after an empty match
+    pos = ms.end == ms.begin ? NextIndex(buffer.str(), ms.end, buffer.IsText())
+                             : ms.end;
+    return Match(data, ms, m.machine.NumGroups());
+  }
+
+ private:
+  object machine;  // keep the machine alive
+  object data;
+  unsigned int pos;
+  bool done;
+};
+
+// Find all non-overlapping matches in s in a single pass. Keep the spans of
+// each match, or of its capture groups if it has any. If text is true, s is
+// the UTF-8 of a str (see NextIndex).
+vector<vector<pair<unsigned int, unsigned int>>> FindSpans(
+    const PyMachine &m, string_view s, bool save_capture, bool text) {
+  vector<vector<pair<unsigned int, unsigned int>>> found;
+  Running running(m);
+  MatchResult ms;
+  while (RegexSearch(m.machine, s, ms, save_capture)) {
+    if (save_capture)
+      found.push_back(ms.spans);
+    else
+      found.push_back({std::make_pair(ms.begin, ms.end)});
+    if (ms.end == ms.begin) ms.end = NextIndex(s, ms.end, text);
+  }
+  return found;
+}
+
+unsigned long Count(const PyMachine &m, object data) {
+  Buffer buffer(data);
+  // RegexCount steps over one byte after an empty match, which may be inside
+  // a character of str.
+  if (buffer.IsText()) return FindSpans(m, buffer.str(), false, true).size();
+  Running running(m);
+  return RegexCount(m.machine, buffer.str());
+}
+
+FindIter FindIterator(object machine, object data) {
+  return FindIter(machine, data);
+}
+
+// Return a list of all matches like re.findall: substrings of the matches if
+// there are no capture groups, substrings of the group if there is one, and
+// tuples of groups otherwise. Unmatched groups are empty.
+list FindAll(const PyMachine &m, object data) {
+  Buffer buffer(data);
+  unsigned int num_groups = m.machine.NumGroups();
+  auto found = FindSpans(m, buffer.str(), num_groups > 0, buffer.IsText());
+
+  auto slice = [&](const pair<unsigned int, unsigned int> &span) {
+    if (span.first == UINT_MAX) return Slice(data, buffer.str(), 0, 0);
+    return Slice(data, buffer.str(), span.first, span.second);
+  };
+  list result;
+  for (auto &spans : found) {
+    if (num_groups <= 1) {
+      result.append(spans.empty() ? slice({UINT_MAX, UINT_MAX})
+                                  : slice(spans[0]));
+      continue;
+    }
+    list groups;
+    for (unsigned int i = 0; i < num_groups; ++i)
+      groups.append(i < spans.size() ? slice(spans[i])
+                                     : slice({UINT_MAX, UINT_MAX}));
+    result.append(tuple(groups));
+  }
+  return result;
+}
+
+// Replace the first count matches in data (all if count is 0) with fmt, in
+// the format of CreateNewSubs ("$0" is the first capture group). Return str
+// if data is str, otherwise bytes.
+object Sub(const PyMachine &m, const string &fmt, object data,
+           unsigned int count) {
+  Buffer buffer(data);
+  string_view s = buffer.str();
+  bool text = buffer.IsText();
+  string replaced;
+  {
+    Running running(m);
+    MatchResult ms;
+    unsigned int pos = 0, n = 0;
+    while ((count == 0 || n < count) && RegexSearch(m.machine, s, ms, true)) {
+      replaced.append(s.substr(pos, ms.begin - pos));
+      replaced.append(CreateNewSubs(fmt, ms.capture));
+      pos = ms.end;
+      ++n;
+      if (ms.end == ms.begin) ms.end = NextIndex(s, ms.end, text);
+    }
+    replaced.append(s.substr(pos));
+  }
+  return Slice(data, replaced, 0, replaced.size());
+}
+
+string Replace(const PyMachine &m, const string &s, const string &fmt,
+               bool replace_global) {
+  Running running(m);
+  return RegexReplace(m.machine, s, fmt, replace_global);
+}
+
+};  // namespace
+
+BOOST_PYTHON_FUNCTION_OVERLOADS(ParseRegexpOverloads, Azuki::ParseRegexp, 1,
+                                2)
+BOOST_PYTHON_FUNCTION_OVERLOADS(CompileRegexpOverloads, Azuki::CompileRegexp,
+                                1, 2)
+
+BOOST_PYTHON_MODULE(pyazuki) {
   class_<Regexp>("Regexp");
   class_<RegexpPtr>("RegexpPtr");
-  def("ParseRegexp", ParseRegexp);
+  def("ParseRegexp", ParseRegexp, ParseRegexpOverloads());
+  scope().attr("UTF8") = static_cast<int>(UTF8);
+  scope().attr("CASE_INSENSITIVE") = static_cast<int>(CASE_INSENSITIVE);
+  scope().attr("NO_CAPTURE") = static_cast<int>(NO_CAPTURE);
   def("PrintRegexp", PrintRegexp);
 
   class_<Instruction>("instruction");
   class_<Program>("Program");
-  def("CompileRegexp", CompileRegexp);
-  def("PrintProgram", PrintProgram);
+  def("CompileRegexp", CompileRegexp, CompileRegexpOverloads());
+  def("PrintProgram", static_cast<void (*)(const Program &)>(PrintProgram));
+
+  class_<PyMatchResult>("MatchResult")
+      .def_readonly("begin", &PyMatchResult::begin)
+      .def_readonly("end", &PyMatchResult::end)
+      .def_readonly("capture", &PyMatchResult::capture);
 
-  class_<MatchResult>("MatchResult")
-      .def_readonly("begin", &MatchResult::begin)
-      .def_readonly("end", &MatchResult::end)
-      .def_readonly("capture", &MatchResult::capture);
+  enum_<Engine>("Engine")
+      .value("INTERPRETER", INTERPRETER)
+      .value("JIT", JIT)
+      .value("TWO_PHASE", TWO_PHASE)
+      .value("ONE_PASS", ONE_PASS)
+      .value("BIT_PARALLEL", BIT_PARALLEL)
+      .export_values();
+  class_<MatchPlan>("MatchPlan")
+      .def_readwrite("prefix", &MatchPlan::prefix)
+      .def_readwrite("existence", &MatchPlan::existence)
+      .def_readwrite("anchored", &MatchPlan::anchored)
+      .def_readwrite("search", &MatchPlan::search)
+      .def_readwrite("capture", &MatchPlan::capture)
+      .def("__str__", &MatchPlan::str);
 
-  class_<Machine>("Machine", init<const Program &>())
-      .def("SetMatchBegin", &Machine::SetMatchBegin)
-      .def("SetMatchEnd", &Machine::SetMatchEnd)
-      .def("Run", &Machine::Run);
+  class_<PyMachine>("Machine", init<const Program &>())
+      .def("SetMatchBegin", Setter<bool, &Machine::SetMatchBegin>)
+      .def("SetMatchEnd", Setter<bool, &Machine::SetMatchEnd>)
+      .def("SetMatchKind", Setter<MatchKind, &Machine::SetMatchKind>)
+      .def("GetPlan", GetPlan)
+      .def("SetPlan", Setter<const MatchPlan &, &Machine::SetPlan>)
+      .def("EnableProfiling", Setter<bool, &Machine::EnableProfiling>,
+           (arg("self"), arg("b") = true))
+      .def("PrintProfile", PrintProfile)
+      .def("Run", Run);
 
   class_<vector<string>>("vector<string>")
       .def(vector_indexing_suite<vector<string>>())
       .def("size", &vector<string>::size);
 
-  def("CreateMachine", CreateMachine);
-  def("RegexSearch",
-      static_cast<bool (*)(const Machine &, const string &)>(RegexSearch));
-  def("RegexSearch", static_cast<bool (*)(const Machine &, const string &,
-                                          MatchResult &, bool)>(RegexSearch));
-  def("RegexReplace", RegexReplace);
+  class_<RegexOptions>("RegexOptions")
+      .def_readwrite("flags", &RegexOptions::flags)
+      .def_readwrite("max_program_size", &RegexOptions::max_program_size)
+      .def_readwrite("match_kind", &RegexOptions::match_kind)
+      .def_readwrite("keep_sources", &RegexOptions::keep_sources);
+  enum_<MatchKind>("MatchKind")
+      .value("LEFTMOST_LONGEST", LEFTMOST_LONGEST)
+      .value("LEFTMOST_FIRST", LEFTMOST_FIRST)
+      .export_values();
+
+  def("CreateMachine", CreateFromPattern);
+  def("CreateMachine", CreateWithOptions);
+  def("RegexSearch", Search);
+  def("RegexSearch", SearchWithResult);
+  def("RegexMatch", FullMatch);
+  def("RegexMatchPrefix", PrefixMatch);
+  def("SearchSpan", SearchSpan,
+      (arg("machine"), arg("data"), arg("pos") = 0, arg("captures") = false));
+
+  class_<Match>("Match", no_init)
+      .def("group", &Match::Group, (arg("self"), arg("i") = 0))
+      .def("groups", &Match::Groups)
+      .def("start", &Match::Start, (arg("self"), arg("i") = 0))
+      .def("end", &Match::End, (arg("self"), arg("i") = 0))
+      .def("span", &Match::SpanTuple, (arg("self"), arg("i") = 0));
+  class_<FindIter>("FindIter", no_init)
+      .def("__iter__", objects::identity_function())
+      .def("__next__", &FindIter::Next)
+      .def("next", &FindIter::Next);
+  def("finditer", FindIterator, (arg("machine"), arg("data")));
+  def("findall", FindAll, (arg("machine"), arg("data")));
+  def("count", Count, (arg("machine"), arg("data")));
+  def("sub", Sub,
+      (arg("machine"), arg("repl"), arg("data"), arg("count") = 0));
+  def("RegexReplace", Replace);
 }
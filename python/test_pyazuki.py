@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+"""Compare finditer, findall, count and sub of pyazuki with the re module."""
+
+import re
+import threading
+import unittest
+
+import pyazuki
+
+# Patterns whose leftmost-longest matches are the same as in re.
+PATTERNS = ["x*", "a*", "x*$", "a*$", "^a*", "(bc)?$", "([a-b])?$", "x?.*",
+            "(ab)*", "a|b", "a+b"]
+STRINGS = ["", "ab", "ac", "baa", "bcc", "abab", "xaab"]
+# Non-ASCII str, which is searched as UTF-8.
+TEXTS = ["\u00e9", "\u00e9a", "a\u00e9b", "\u65e5\u672ca", "ab\u20ac",
+         "\U0001f600b"]
+
+
+def utf8_machine(e):
+    options = pyazuki.RegexOptions()
+    options.flags = pyazuki.UTF8
+    return pyazuki.CreateMachine(e, options)
+
+
+class EmptyMatchTest(unittest.TestCase):
+
+    def test_same_as_re(self):
+        for e in PATTERNS:
+            m = pyazuki.CreateMachine(e)
+            for s in STRINGS:
+                data = s.encode()
+                msg = "%s on %r" % (e, s)
+                self.assertEqual(len(pyazuki.findall(m, data)),
+                                 len(re.findall(e, s)), msg)
+                self.assertEqual([x.span() for x in pyazuki.finditer(m, data)],
+                                 [x.span() for x in re.finditer(e, s)], msg)
+                self.assertEqual(pyazuki.count(m, data),
+                                 len(re.findall(e, s)), msg)
+                self.assertEqual(pyazuki.sub(m, b"-", data),
+                                 re.sub(e, "-", s).encode(), msg)
+
+    def test_text_same_as_re(self):
+        # Searches after an empty match begin at the next code point.
+        for e in PATTERNS:
+            for m in [pyazuki.CreateMachine(e), utf8_machine(e)]:
+                for s in TEXTS:
+                    msg = "%s on %r" % (e, s)
+                    self.assertEqual(pyazuki.findall(m, s), re.findall(e, s),
+                                     msg)
+                    self.assertEqual(
+                        [x.group() for x in pyazuki.finditer(m, s)],
+                        [x.group() for x in re.finditer(e, s)], msg)
+                    self.assertEqual(pyazuki.count(m, s),
+                                     len(re.findall(e, s)), msg)
+                    self.assertEqual(pyazuki.sub(m, "-", s),
+                                     re.sub(e, "-", s), msg)
+
+    def test_text_by_code_point(self):
+        # Without UTF8, "." matches a byte, which can't be sliced from str.
+        m = utf8_machine(".")
+        for s in TEXTS:
+            self.assertEqual(pyazuki.findall(m, s), re.findall(".", s))
+            self.assertEqual(pyazuki.sub(m, "-", s), re.sub(".", "-", s))
+        with self.assertRaises(UnicodeDecodeError):
+            pyazuki.findall(pyazuki.CreateMachine("."), "\u00e9a")
+
+    def test_search_at_end(self):
+        m = pyazuki.CreateMachine("x*")
+        self.assertEqual(pyazuki.SearchSpan(m, b"ab", 2), (2, 2))
+        self.assertIsNone(pyazuki.SearchSpan(m, b"ab", 3))
+
+
+
+class ThreadTest(unittest.TestCase):
+
+    def test_settings_change_while_running(self):
+        # Runs release the GIL; setters wait for them to finish.
+        m = pyazuki.CreateMachine("(a+)b")
+        data = b"xaab" * 1000
+        counts = []
+
+        def run():
+            for _ in range(50):
+                counts.append(pyazuki.count(m, data))
+
+        threads = [threading.Thread(target=run) for _ in range(4)]
+        for t in threads:
+            t.start()
+        plan = m.GetPlan()
+        for i in range(100):
+            m.SetMatchKind(pyazuki.LEFTMOST_FIRST if i % 2 else
+                           pyazuki.LEFTMOST_LONGEST)
+            m.EnableProfiling(i % 3 == 0)
+            m.SetPlan(plan)
+        for t in threads:
+            t.join()
+        self.assertEqual(counts, [1000] * 200)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -4,37 +4,35 @@
 
 namespace Azuki {
 
-namespace {
+RegexOptions::RegexOptions()
+    : flags(0),
+      max_program_size(UINT_MAX),
+      match_kind(LEFTMOST_LONGEST),
+      keep_sources(false) {}
 
-string CreateNewSubs(const string &fmt, const vector<string> &capture) {
-  std::stringstream ss;
-  unsigned idx = 0;
-  while (idx < fmt.size()) {
-    if (fmt[idx] != '$') {
-      ss << fmt[idx++];
-    } else {
-      ++idx;
-      if (idx >= fmt.size())
-        throw std::runtime_error("Unexpected format string.");
-      if (fmt[idx] == '$') {
-        ss << '$';
-        ++idx;
-      } else if (isdigit(fmt[idx])) {
-        int ref_id = 0;
-        for (; idx < fmt.size() && isdigit(fmt[idx]); ++idx)
-          ref_id = ref_id * 10 + (fmt[idx] - '0');
-        ss << capture[ref_id];
-      } else {
-        throw std::runtime_error("Unexpected format string.");
-      }
-    }
-  }
-  return ss.str();
+Machine CreateMachine(const string &e) {
+  return CreateMachine(e, RegexOptions());
 }
 
-};  // namespace
+Machine CreateMachine(const string &e, unsigned int max_program_size) {
+  RegexOptions options;
+  options.max_program_size = max_program_size;
+  return CreateMachine(e, options);
+}
 
-Machine CreateMachine(const string &e) {
+Machine CreateMachine(const string &e, const RegexOptions &options) {
+  return Machine(CreateCompiledRegexp(e, options));
+}
+
+CompiledRegexp CreateCompiledRegexp(const string &e,
+                                    unsigned int max_program_size) {
+  RegexOptions options;
+  options.max_program_size = max_program_size;
+  return CreateCompiledRegexp(e, options);
+}
+
+CompiledRegexp CreateCompiledRegexp(const string &e,
+                                    const RegexOptions &options) {
   bool match_begin = StartsWith(e, '^');
   bool match_end = EndsWith(e, '$') && !EndsWith(e, "\\$");
 
@@ -43,34 +41,60 @@ Machine CreateMachine(const string &e) {
   int end = match_end ? e.size() - 1 : e.size();
   std::string input = e.substr(begin, end);
 
-  // Create machine with program and positonal match flags.
-  RegexpPtr rp = ParseRegexp(input);
-  Program program = CompileRegexp(rp);
+  // Compile programs and set positonal match flags.
+  RegexpPtr rp = ParseRegexp(input, options.flags);
 
-  Machine m(program);
-  m.SetMatchBegin(match_begin);
-  m.SetMatchEnd(match_end);
-  return m;
+  CompiledRegexp cr =
+      CreateCompiledRegexp(rp, options.max_program_size, options.match_kind,
+                           options.keep_sources);
+  cr.match_begin = match_begin;
+  cr.match_end = match_end;
+  return cr;
 }
 
-bool RegexSearch(const Machine &m, const string &s) {
-  auto result = m.Run(s, false);
-  return result.success;
-}
+bool RegexSearch(const Machine &m, string_view s) { return m.HasMatch(s); }
 
-bool RegexSearch(const Machine &m, const string &s, MatchResult &result,
+bool RegexSearch(const Machine &m, string_view s, MatchResult &result,
                  bool save_capture) {
+  // An empty match may end s, so the search may begin at s.size(). A pattern
+  // beginning with '^' only matches at the begin of s.
   unsigned int offset = result.end;
-  if (offset >= s.size()) return false;
+  if (offset > s.size() || (offset > 0 && m.MatchBegin())) return false;
 
   auto temp = m.Run(s.substr(offset), save_capture);
-  if (!temp.success) return false;
-  temp.begin += offset;
-  temp.end += offset;
+  if (!temp.success) {
+    result.budget_exceeded = temp.budget_exceeded;
+    return false;
+  }
+  ShiftMatchResult(temp, offset);
   result = std::move(temp);
   return result.success;
 }
 
+bool RegexMatch(const Machine &m, string_view s) {
+  return m.RunAnchored(s, true, false).success;
+}
+
+bool RegexMatch(const Machine &m, string_view s, MatchResult &result,
+                bool save_capture) {
+  result = m.RunAnchored(s, true, save_capture);
+  return result.success;
+}
+
+bool RegexMatchPrefix(const Machine &m, string_view s) {
+  return m.RunAnchored(s, false, false).success;
+}
+
+bool RegexMatchPrefix(const Machine &m, string_view s, MatchResult &result,
+                      bool save_capture) {
+  result = m.RunAnchored(s, false, save_capture);
+  return result.success;
+}
+
+unsigned long RegexCount(const Machine &m, string_view s) {
+  return m.Count(s);
+}
+
 string RegexReplace(const Machine &m, const string &s, const string &fmt,
                     bool global) {
   vector<pair<int, int>> replaced;
@@ -81,10 +105,13 @@ string RegexReplace(const Machine &m, const string &s, const string &fmt,
     replaced.push_back(std::make_pair(ms.begin, ms.end));
     new_subs.push_back(CreateNewSubs(fmt, ms.capture));
   }
-  if (global) {
+  if (global && ms.success) {
+    // After an empty match, search again from the next character.
+    if (ms.begin == ms.end) ++ms.end;
     while (RegexSearch(m, s, ms, true)) {
       replaced.push_back(std::make_pair(ms.begin, ms.end));
       new_subs.push_back(CreateNewSubs(fmt, ms.capture));
+      if (ms.begin == ms.end) ++ms.end;
     }
   }
   std::stringstream ss;
@@ -98,4 +125,34 @@ string RegexReplace(const Machine &m, const string &s, const string &fmt,
   return ss.str();
 }
 
+void RegexSplit(const Machine &m, string_view s, vector<string_view> &pieces,
+                unsigned int max_splits, bool keep_captures) {
+  unsigned int pos = 0, splits = 0;
+  m.ForEachMatch(s, keep_captures, [&](const MatchResult &ms) {
+    if (ms.begin == ms.end) return true;
+    pieces.push_back(s.substr(pos, ms.begin - pos));
+    if (keep_captures) {
+      // Exactly one piece per group, so pieces can be read by position.
+      for (unsigned int i = 0; i < m.NumGroups(); ++i) {
+        if (i >= ms.spans.size() || ms.spans[i].first == UINT_MAX)
+          pieces.push_back(string_view());
+        else
+          pieces.push_back(s.substr(
+              ms.spans[i].first, ms.spans[i].second - ms.spans[i].first));
+      }
+    }
+    pos = ms.end;
+    ++splits;
+    return max_splits == 0 || splits < max_splits;
+  });
+  pieces.push_back(s.substr(pos));
+}
+
+vector<string_view> RegexSplit(const Machine &m, string_view s,
+                               unsigned int max_splits, bool keep_captures) {
+  vector<string_view> pieces;
+  RegexSplit(m, s, pieces, max_splits, keep_captures);
+  return pieces;
+}
+
 };  // namespace Azuki
@@ -12,18 +12,63 @@ namespace Azuki {
 //    Machine m = CreateMachine("^a+b$");
 Machine CreateMachine(const string &e);
 
+// Same as above, but throw std::runtime_error if the program has more than
+// max_program_size instructions. Use it for patterns from untrusted sources,
+// together with Machine::SetBudget.
+// Example:
+//    Machine m = CreateMachine("a{2,3}", 1024);
+Machine CreateMachine(const string &e, unsigned int max_program_size);
+
+// The RegexOptions struct holds options of CreateMachine.
+struct RegexOptions {
+  int flags;                      // RegexpFlags of ParseRegexp
+  unsigned int max_program_size;  // see CreateMachine above
+  // See Machine::SetMatchKind. Patterns with lazy quantifiers ("a*?") always
+  // use LEFTMOST_FIRST, as they only choose among matches by priority.
+  MatchKind match_kind;
+  // Keep the pattern node of each instruction, so that profiles of the
+  // machine show them (see Machine::EnableProfiling).
+  bool keep_sources;
+
+  RegexOptions();
+};
+
+// Same as above, with options.
+// Example:
+//    RegexOptions options;
+//    options.flags = UTF8;
+//    Machine m = CreateMachine("^[α-ω]+$", options);
+Machine CreateMachine(const string &e, const RegexOptions &options);
+
+// Compile raw regular expression like CreateMachine, but return the compiled
+// programs and flags, which can be saved with SavePrograms (see serialize.h).
+// Example:
+//    CompiledRegexp cr = CreateCompiledRegexp("^a+b$");
+//    Machine m(cr);
+CompiledRegexp CreateCompiledRegexp(const string &e,
+                                    unsigned int max_program_size = UINT_MAX);
+CompiledRegexp CreateCompiledRegexp(const string &e,
+                                    const RegexOptions &options);
+
 // Determines if there is a match between the regular expression represented by
 // machine m and some substring in string s.
 // Example:
 //    Machine m = CreateMachine("^a+b$");
 //    RegexSearch(m, "aaab");  // true
 //    RegexSearch(m, "ac");    // false
-bool RegexSearch(const Machine &m, const string &s);
+bool RegexSearch(const Machine &m, string_view s);
 
 // Determines if there is a match between the regular expression represented by
 // machine m and some substring in string s.
-// Search works on the substring of s, begining from ms.end.
+// Search works on the substring of s, begining from ms.end, which may be
+// s.size() to find an empty match at the end of s. Past s.size(), nothing is
+// found. A pattern beginning with '^' only matches at the begin of s, so it
+// is not found once ms.end is past 0. To find all matches, go on from the
+// next index after an empty match, like RegexReplace.
 // If save_capture is true, capture groups will be saved in result.capture.
+// They are read from s, so s must be kept alive while they are used.
+// If the search fails, result is kept except result.budget_exceeded, which
+// tells if the budget of m is exceeded (see Machine::SetBudget).
 // Example:
 //    Machine m = CreateMachine("(a+b)");
 //    MatchResult result;
@@ -31,20 +76,78 @@ bool RegexSearch(const Machine &m, const string &s);
 //    RegexSearch(m, "abcaabd", result, true); // true
 // Then we have:
 //    result.begin = 3, result.end = 6, result.capture = {"aab"}
-bool RegexSearch(const Machine &m, const string &s, MatchResult &result,
+bool RegexSearch(const Machine &m, string_view s, MatchResult &result,
                  bool save_capture = true);
 
+// Determines if the whole string s matches the regular expression represented
+// by machine m, as if it began with '^' and ended with '$'. The same machine
+// can be used for RegexSearch.
+// If save_capture is true, capture groups will be saved in result.capture.
+// Example:
+//    Machine m = CreateMachine("(a+)b");
+//    RegexMatch(m, "aab");   // true
+//    RegexMatch(m, "aabc");  // false
+bool RegexMatch(const Machine &m, string_view s);
+bool RegexMatch(const Machine &m, string_view s, MatchResult &result,
+                bool save_capture = true);
+
+// Determines if a prefix of string s matches the regular expression
+// represented by machine m, as if it began with '^'. The prefix is chosen by
+// the match kind of m: the longest one with LEFTMOST_LONGEST, and the first
+// one in priority order with LEFTMOST_FIRST, which patterns with lazy
+// repetitions use, so "a+?" matches only "a" of "aab".
+// Example:
+//    Machine m = CreateMachine("(a+)b");
+//    MatchResult result;
+//    RegexMatchPrefix(m, "aabc", result);  // true, result.end = 3
+//    RegexMatchPrefix(m, "caab");          // false
+bool RegexMatchPrefix(const Machine &m, string_view s);
+bool RegexMatchPrefix(const Machine &m, string_view s, MatchResult &result,
+                      bool save_capture = true);
+
+// Count non-overlapping matches of the regular expression represented by
+// machine m in string s, in a single pass without saving any match. After an
+// empty match, the search goes on from the character after it, an empty match
+// at the end of s is counted too, and patterns beginning with '^' match at
+// most once.
+// Example:
+//    Machine m = CreateMachine("a+b");
+//    RegexCount(m, "aab ab b");  // 2
+unsigned long RegexCount(const Machine &m, string_view s);
+
 // Replace matched substring in s with new substring specified by format string
 // fmt. Backreference is supported with "$0", "$1", etc. Use "$$" for a single
 // '$' character.
-// If replace_global is true, it will replace all match substrings. Otherwise,
-// it will replace only the first match.
+// If replace_global is true, it will replace all match substrings, searching
+// from the next character after an empty match. Otherwise, it will replace
+// only the first match.
 // Example:
 //    Machine m = CreateMachine("(a+)b");
 //    RegexReplace(m, "aab", "$0c");  // "aac"
 string RegexReplace(const Machine &m, const string &s, const string &fmt,
                     bool replace_global = false);
 
+// Split s into pieces separated by matches of machine m, and append them to
+// pieces. Matches are found in a single forward scan of s (see
+// Machine::ForEachMatch). Pieces are views into s, so s must outlive them.
+// Empty matches don't split s.
+// If max_splits is not 0, s is split at most max_splits times and the last
+// piece holds the rest of s. If keep_captures is true, capture groups of each
+// delimiter are appended after the piece before it (empty if not matched).
+// Example:
+//    Machine m = CreateMachine("\\s*(,|;)\\s*");
+//    vector<string_view> pieces;
+//    RegexSplit(m, "a, b;c", pieces);           // {"a", "b", "c"}
+//    pieces.clear();
+//    RegexSplit(m, "a, b;c", pieces, 1, true);  // {"a", ",", "b;c"}
+void RegexSplit(const Machine &m, string_view s, vector<string_view> &pieces,
+                unsigned int max_splits = 0, bool keep_captures = false);
+
+// Same as above, but return the pieces.
+vector<string_view> RegexSplit(const Machine &m, string_view s,
+                               unsigned int max_splits = 0,
+                               bool keep_captures = false);
+
 };  // namespace Azuki
 
 #endif  // __AZUKI_AZUKI__
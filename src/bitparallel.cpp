@@ -0,0 +1,139 @@
+#include "bitparallel.h"
+
+namespace Azuki {
+
+namespace {
+
+const unsigned int kMaxPositions = 64;
+
+// Add positions reachable from pc without consuming a character to follow,
+// and set matched if MATCH is reachable. position maps consuming
+// instructions to positions.
+void Closure(const Program &program, const vector<int> &position,
+             unsigned int pc, vector<bool> &visited, uint64_t &follow,
+             bool &matched) {
+  if (visited[pc]) return;
+  visited[pc] = true;
+
+  auto &instr = program[pc];
+  if (instr->opcode == JMP) {
+    Closure(program, position, instr->dst, visited, follow, matched);
+  } else if (instr->opcode == SPLIT) {
+    Closure(program, position, pc + 1, visited, follow, matched);
+    Closure(program, position, instr->dst, visited, follow, matched);
+  } else if (instr->opcode == SAVE) {
+    Closure(program, position, pc + 1, visited, follow, matched);
+  } else if (instr->opcode == MATCH) {
+    matched = true;
+  } else {
+    follow |= uint64_t(1) << position[pc];
+  }
+}
+
+};  // namespace
+
+BitParallel::BitParallel(const Program &program) {
+  automaton.start = automaton.shifted = automaton.finals = 0;
+  automaton.nullable = false;
+  vector<int> position(program.size(), -1);
+  vector<unsigned int> pcs;  // consuming instruction of each position
+  for (unsigned int pc = 0; pc < program.size(); ++pc) {
+    if (!program[pc]->ConsumeCharacter()) continue;
+    position[pc] = pcs.size();
+    pcs.push_back(pc);
+  }
+
+  automaton.accept.fill(0);
+  for (unsigned int i = 0; i < pcs.size(); ++i) {
+    for (int ch = 0; ch < 256; ++ch) {
+      if (program[pcs[i]]->Accepts(ch))
+        automaton.accept[ch] |= uint64_t(1) << i;
+    }
+  }
+
+  vector<bool> visited(program.size(), false);
+  Closure(program, position, 0, visited, automaton.start, automaton.nullable);
+
+  vector<uint64_t> others(pcs.size(), 0);  // follow except the next position
+  for (unsigned int i = 0; i < pcs.size(); ++i) {
+    uint64_t follow = 0;
+    bool matched = false;
+    visited.assign(program.size(), false);
+    Closure(program, position, pcs[i] + 1, visited, follow, matched);
+    if (matched) automaton.finals |= uint64_t(1) << i;
+    uint64_t next = i + 1 < pcs.size() ? uint64_t(1) << (i + 1) : 0;
+    if (follow & next) automaton.shifted |= uint64_t(1) << i;
+    others[i] = follow & ~next;
+  }
+
+  for (unsigned int offset = 0; offset < pcs.size(); offset += 8) {
+    bool used = false;
+    for (unsigned int i = offset; i < offset + 8 && i < pcs.size(); ++i)
+      used |= others[i] != 0;
+    if (!used) continue;
+    std::array<uint64_t, 256> table;
+    table.fill(0);
+    for (unsigned int bits = 0; bits < 256; ++bits) {
+      for (unsigned int k = 0; k < 8 && offset + k < pcs.size(); ++k) {
+        if (bits >> k & 1) table[bits] |= others[offset + k];
+      }
+    }
+    automaton.tables.push_back({offset, table});
+  }
+}
+
+BitParallel::BitParallel(Automaton automaton)
+    : automaton(std::move(automaton)) {}
+
+bool BitParallel::Search(string_view s, bool match_end,
+                         unsigned long *scanned) const {
+  // An empty match at the end.
+  if (automaton.nullable) return true;
+
+  uint64_t state = 0;
+  unsigned long k = 0;
+  for (; k < s.size(); ++k) {
+    unsigned char ch = s[k];
+    state = (Follow(state) | automaton.start) & automaton.accept[ch];
+    if (!match_end && (state & automaton.finals)) {
+      ++k;
+      break;
+    }
+  }
+  if (scanned) *scanned += k;
+  return state & automaton.finals;
+}
+
+bool BitParallel::SearchAnchored(string_view s, bool match_end,
+                                 unsigned int &end,
+                                 unsigned long *scanned) const {
+  bool found = automaton.nullable && (!match_end || s.empty());
+  if (found) end = 0;
+
+  uint64_t state = automaton.start;
+  unsigned long k = 0;
+  for (; k < s.size() && state; ++k) {
+    unsigned char ch = s[k];
+    if (k > 0) state = Follow(state);
+    state &= automaton.accept[ch];
+    if ((state & automaton.finals) && (!match_end || k + 1 == s.size())) {
+      found = true;
+      end = k + 1;
+    }
+  }
+  if (scanned) *scanned += k;
+  return found;
+}
+
+BitParallelPtr CreateBitParallel(const Program &program) {
+  unsigned int positions = 0;
+  for (auto &instr : program) {
+    Opcode opcode = instr->opcode;
+    if (opcode == CHECK || opcode == INCR || opcode == SET) return nullptr;
+    if (instr->ConsumeCharacter()) ++positions;
+  }
+  if (positions > kMaxPositions) return nullptr;
+  return BitParallelPtr(new BitParallel(program));
+}
+
+};  // namespace Azuki
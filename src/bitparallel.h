@@ -0,0 +1,79 @@
+#ifndef __AZUKI_BITPARALLEL__
+#define __AZUKI_BITPARALLEL__
+
+#include <array>
+#include <cstdint>
+#include "common.h"
+#include "instruction.h"
+
+namespace Azuki {
+
+// The BitParallel class runs small programs without capture groups as a
+// Glushkov automaton in a single machine word. Consuming instructions of the
+// program are the positions of the automaton, and bit i of a state is set if
+// the i-th of them has just consumed a character. Each character advances all
+// positions at once:
+//    state = (Follow(state) | start) & accept[ch]
+// Positions are numbered in program order, so Follow is mostly a shift (like
+// Shift-And), and only positions followed by others than the next one are
+// looked up in tables, 8 positions per table.
+// It only tells where matches end, so it can decide if there is a match, or
+// find the longest match anchored at the begin.
+// Use CreateBitParallel below instead of the constructor.
+class BitParallel {
+ public:
+  // The Automaton struct holds the tables BitParallel runs on, so that they
+  // can be saved and loaded (see serialize.h).
+  struct Automaton {
+    std::array<uint64_t, 256> accept;  // positions consuming each character
+    uint64_t start;    // positions consuming the first character of a match
+    uint64_t shifted;  // positions followed by the next position
+    uint64_t finals;   // positions followed by MATCH
+    bool nullable;     // the program matches an empty string
+    // Follow of positions which are not only followed by the next position,
+    // by the bit offset (a multiple of 8 below 64) of each 8 positions.
+    vector<pair<unsigned int, std::array<uint64_t, 256>>> tables;
+  };
+
+  explicit BitParallel(const Program &program);
+  explicit BitParallel(Automaton automaton);
+
+  const Automaton &GetAutomaton() const { return automaton; }
+
+  // Return true if s has a match. If match_end is true, only matches ending
+  // at s.size() are considered. The scan stops at the first match end.
+  // If scanned is not nullptr, consumed characters are counted in it.
+  bool Search(string_view s, bool match_end,
+              unsigned long *scanned = nullptr) const;
+
+  // Scan s from index 0 and set end to the end index of the longest match
+  // beginning at index 0. match_end and scanned are the same as above.
+  // Return false if there is no match.
+  bool SearchAnchored(string_view s, bool match_end, unsigned int &end,
+                      unsigned long *scanned = nullptr) const;
+
+ private:
+  // Return positions which may consume the next character after positions in
+  // state.
+  uint64_t Follow(uint64_t state) const {
+    uint64_t next = (state & automaton.shifted) << 1;
+    for (auto &table : automaton.tables)
+      next |= table.second[(state >> table.first) & 0xff];
+    return next;
+  }
+
+  Automaton automaton;
+};
+
+typedef shared_ptr<BitParallel> BitParallelPtr;
+
+// Create BitParallel from program. Return nullptr if the program has more
+// than 64 consuming instructions, or has counters (CHECK, INCR and SET).
+// Example:
+//    BitParallelPtr bp =
+//        CreateBitParallel(CompileRegexp(ExpandRegexp(ParseRegexp("a+b"))));
+BitParallelPtr CreateBitParallel(const Program &program);
+
+};  // namespace Azuki
+
+#endif  // __AZUKI_BITPARALLEL__
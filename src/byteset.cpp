@@ -0,0 +1,157 @@
+#include <cstdio>
+#include "byteset.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace Azuki {
+
+namespace {
+
+// Maximum number of ranges scanned with SIMD. Each range costs a few
+// instructions per block.
+const unsigned int kMaxSimdRanges = 4;
+
+// Blocks of bytes compared at once, and the operations on them.
+#if defined(__AVX2__)
+typedef __m256i Block;
+const size_t kBlockSize = 32;
+
+Block Load(const unsigned char *p) {
+  return _mm256_loadu_si256(reinterpret_cast<const Block *>(p));
+}
+
+Block Splat(unsigned char ch) { return _mm256_set1_epi8(ch); }
+
+// Return a block with all bits set in bytes of x in [low, low + span], as
+// x - low <= span is min(x - low, span) == x - low for unsigned bytes.
+Block InRange(Block x, Block low, Block span) {
+  Block d = _mm256_sub_epi8(x, low);
+  return _mm256_cmpeq_epi8(_mm256_min_epu8(d, span), d);
+}
+
+Block Or(Block a, Block b) { return _mm256_or_si256(a, b); }
+
+unsigned int MoveMask(Block x) { return _mm256_movemask_epi8(x); }
+#elif defined(__SSE2__)
+typedef __m128i Block;
+const size_t kBlockSize = 16;
+
+Block Load(const unsigned char *p) {
+  return _mm_loadu_si128(reinterpret_cast<const Block *>(p));
+}
+
+Block Splat(unsigned char ch) { return _mm_set1_epi8(ch); }
+
+// Same as above.
+Block InRange(Block x, Block low, Block span) {
+  Block d = _mm_sub_epi8(x, low);
+  return _mm_cmpeq_epi8(_mm_min_epu8(d, span), d);
+}
+
+Block Or(Block a, Block b) { return _mm_or_si128(a, b); }
+
+unsigned int MoveMask(Block x) { return _mm_movemask_epi8(x); }
+#endif
+
+// Add bytes consumed by instructions reachable from pc without consuming a
+// character to bytes. Counters are assumed to pass, and MATCH adds every
+// byte, as a match may begin anywhere.
+void AddFirstBytes(const Program &program, unsigned int pc,
+                   vector<bool> &visited, std::bitset<256> &bytes) {
+  if (visited[pc]) return;
+  visited[pc] = true;
+
+  auto &instr = program[pc];
+  switch (instr->opcode) {
+    case JMP:
+      AddFirstBytes(program, instr->dst, visited, bytes);
+      break;
+    case SPLIT:
+      AddFirstBytes(program, pc + 1, visited, bytes);
+      AddFirstBytes(program, instr->dst, visited, bytes);
+      break;
+    case CHECK:
+    case INCR:
+    case SAVE:
+    case SET:
+      AddFirstBytes(program, pc + 1, visited, bytes);
+      break;
+    case MATCH:
+      bytes.set();
+      break;
+    default:
+      for (int ch = 0; ch < 256; ++ch) {
+        if (instr->Accepts(ch)) bytes.set(ch);
+      }
+  }
+}
+
+};  // namespace
+
+ByteSet::ByteSet(const std::bitset<256> &bytes) : bytes(bytes) {
+  for (int ch = 0; ch < 256; ++ch) {
+    if (!bytes[ch]) continue;
+    if (ranges.empty() || ranges.back().second + 1 != ch)
+      ranges.push_back(std::make_pair(ch, ch));
+    else
+      ranges.back().second = ch;
+  }
+}
+
+size_t ByteSet::Find(string_view s, size_t pos) const {
+  if (ranges.empty()) return string_view::npos;
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(s.data());
+  size_t n = s.size();
+
+#if defined(__AVX2__) || defined(__SSE2__)
+  if (ranges.size() <= kMaxSimdRanges) {
+    Block lows[kMaxSimdRanges], spans[kMaxSimdRanges];
+    unsigned int count = ranges.size();
+    for (unsigned int i = 0; i < count; ++i) {
+      lows[i] = Splat(ranges[i].first);
+      spans[i] = Splat(ranges[i].second - ranges[i].first);
+    }
+    for (; pos + kBlockSize <= n; pos += kBlockSize) {
+      Block x = Load(p + pos);
+      Block found = InRange(x, lows[0], spans[0]);
+      for (unsigned int i = 1; i < count; ++i)
+        found = Or(found, InRange(x, lows[i], spans[i]));
+      unsigned int mask = MoveMask(found);
+      if (mask) return pos + __builtin_ctz(mask);
+    }
+  }
+#endif
+
+  for (; pos < n; ++pos) {
+    if (bytes[p[pos]]) return pos;
+  }
+  return string_view::npos;
+}
+
+string ByteSet::str() const {
+  auto print = [](unsigned char ch) {
+    if (isgraph(ch) && ch != '\\' && ch != '-' && ch != ']')
+      return string(1, ch);
+    char escaped[5];
+    snprintf(escaped, sizeof(escaped), "\\x%02X", ch);
+    return string(escaped);
+  };
+  string s = "[";
+  for (auto &range : ranges) {
+    s += print(range.first);
+    if (range.second != range.first) s += "-" + print(range.second);
+  }
+  return s + "]";
+}
+
+ByteSet FirstBytes(const Program &program) {
+  std::bitset<256> bytes;
+  vector<bool> visited(program.size(), false);
+  AddFirstBytes(program, 0, visited, bytes);
+  return ByteSet(bytes);
+}
+
+};  // namespace Azuki
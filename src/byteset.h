@@ -0,0 +1,53 @@
+#ifndef __AZUKI_BYTESET__
+#define __AZUKI_BYTESET__
+
+#include <bitset>
+#include "common.h"
+#include "instruction.h"
+
+namespace Azuki {
+
+// The ByteSet class holds a set of bytes, and finds the next byte of the set
+// in a string. Sets of a few byte ranges (like \d, \s or \w) are scanned 32
+// bytes at a time with AVX2 (built with -DAZUKI_ENABLE_AVX2=ON), or 16 bytes
+// at a time with SSE2 on x86-64. Other sets, and builds without SIMD, are
+// scanned a byte at a time.
+// Example:
+//    std::bitset<256> bytes;
+//    for (int ch = '0'; ch <= '9'; ++ch) bytes.set(ch);
+//    ByteSet digits(bytes);
+//    digits.Find("abc1", 0);  // 3
+class ByteSet {
+ public:
+  explicit ByteSet(const std::bitset<256> &bytes);
+
+  bool Contains(unsigned char ch) const { return bytes[ch]; }
+
+  // Return true if the set has every byte.
+  bool Full() const { return bytes.all(); }
+
+  const std::bitset<256> &Bytes() const { return bytes; }
+
+  // Return the index of the first byte of s in the set from index pos, or
+  // string_view::npos if there is none.
+  size_t Find(string_view s, size_t pos) const;
+
+  // Return the set as ranges for debugging, like "[0-9A-Z_a-z]".
+  string str() const;
+
+ private:
+  std::bitset<256> bytes;
+  // Maximal runs of bytes in the set, as the first and the last byte.
+  vector<pair<unsigned char, unsigned char>> ranges;
+};
+
+// Return the set of bytes which a match of program can begin with. It has
+// every byte if the program matches an empty string.
+// Example:
+//    ByteSet first = FirstBytes(CompileRegexp(ParseRegexp("\\d+|x")));
+//    first.str();  // "[0-9x]"
+ByteSet FirstBytes(const Program &program);
+
+};  // namespace Azuki
+
+#endif  // __AZUKI_BYTESET__
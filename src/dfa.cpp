@@ -0,0 +1,379 @@
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include "dfa.h"
+
+namespace Azuki {
+
+namespace {
+
+// Maximum number of cached states per search mode. The cache is flushed when
+// it's full, so memory stays bounded even for patterns with many states.
+const unsigned int kMaxStates = 4096;
+
+const unsigned int kGroupSeparator = ~0u;
+
+// Minimum number of characters per segment of SearchParallel, so that short
+// inputs aren't split among threads.
+const unsigned long kMinSegmentSize = 1 << 16;
+
+// Characters between keys saved by scans of SearchParallel. Scans also check
+// if they're stopped there.
+const long kCheckpointInterval = 1 << 10;
+
+// Characters scanned again from the state a segment of SearchParallel really
+// begins in, to meet the scan from its guess, before all segments from it on
+// are scanned again.
+const long kMaxRescan = 1 << 13;
+
+// Return true if the state of key has matched and has no thread left, so that
+// nothing can follow.
+bool IsFinished(const string &key) { return key == "1"; }
+
+};  // namespace
+
+Dfa::Dfa(const Program &program) : program(program) {}
+
+Dfa::CachesPtr Dfa::Acquire() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (pool.empty()) return CachesPtr(new Caches());
+  CachesPtr caches = std::move(pool.back());
+  pool.pop_back();
+  return caches;
+}
+
+void Dfa::Release(CachesPtr caches) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  pool.push_back(std::move(caches));
+}
+
+void Dfa::AddThread(unsigned int pc, vector<unsigned int> &group,
+                    vector<bool> &seen) const {
+  if (seen[pc]) return;
+  seen[pc] = true;
+
+  auto &instr = program[pc];
+  if (instr->opcode == JMP) {
+    AddThread(instr->dst, group, seen);
+  } else if (instr->opcode == SPLIT) {
+    if (instr->greedy) {
+      AddThread(instr->dst, group, seen);
+      AddThread(pc + 1, group, seen);
+    } else {
+      AddThread(pc + 1, group, seen);
+      AddThread(instr->dst, group, seen);
+    }
+  } else if (instr->opcode == SAVE) {
+    AddThread(pc + 1, group, seen);
+  } else {
+    group.push_back(pc);
+  }
+}
+
+int Dfa::AddState(Cache &cache, vector<vector<unsigned int>> &groups,
+                  bool matched, bool match_end, MatchKind kind) const {
+  vector<vector<unsigned int>> temp;
+  bool has_match = false;
+  for (auto &group : groups) {
+    if (group.empty()) continue;
+    // Threads after MATCH can't beat it.
+    if (kind == LEFTMOST_FIRST && !match_end) {
+      auto it = std::find_if(group.begin(), group.end(), [&](unsigned int pc) {
+        return program[pc]->opcode == MATCH;
+      });
+      if (it != group.end()) group.erase(it + 1, group.end());
+    }
+    temp.push_back(std::move(group));
+    for (auto pc : temp.back()) has_match |= program[pc]->opcode == MATCH;
+    // Groups started later can't beat a match of this group.
+    if (has_match && !match_end) {
+      matched = true;
+      break;
+    }
+  }
+
+  string key(1, matched ? '1' : '0');
+  for (auto &group : temp) {
+    for (auto pc : group)
+      key.append(reinterpret_cast<const char *>(&pc), sizeof(pc));
+    key.append(reinterpret_cast<const char *>(&kGroupSeparator),
+               sizeof(kGroupSeparator));
+  }
+  auto it = cache.index.find(key);
+  if (it != cache.index.end()) return it->second;
+
+  if (cache.states.size() >= kMaxStates) {
+    cache.states.clear();
+    cache.index.clear();
+    cache.start = -1;
+    ++cache.flushes;
+  }
+  State state;
+  state.groups = std::move(temp);
+  state.matched = matched;
+  state.has_match = has_match;
+  state.next.fill(-1);
+  state.key = key;
+  cache.states.push_back(std::move(state));
+  cache.index[key] = cache.states.size() - 1;
+  return cache.states.size() - 1;
+}
+
+int Dfa::Start(Cache &cache, bool match_end, MatchKind kind) const {
+  if (cache.start >= 0) return cache.start;
+  vector<vector<unsigned int>> groups(1);
+  vector<bool> seen(program.size(), false);
+  AddThread(0, groups[0], seen);
+  cache.start = AddState(cache, groups, false, match_end, kind);
+  return cache.start;
+}
+
+int Dfa::Load(Cache &cache, const string &key, bool match_end,
+              MatchKind kind) const {
+  auto it = cache.index.find(key);
+  if (it != cache.index.end()) return it->second;
+  // The key lists the threads of each group, and ends each with a separator.
+  vector<vector<unsigned int>> groups(1);
+  for (size_t i = 1; i + sizeof(unsigned int) <= key.size();
+       i += sizeof(unsigned int)) {
+    unsigned int pc = 0;
+    key.copy(reinterpret_cast<char *>(&pc), sizeof(pc), i);
+    if (pc == kGroupSeparator)
+      groups.push_back(vector<unsigned int>());
+    else
+      groups.back().push_back(pc);
+  }
+  groups.pop_back();
+  return AddState(cache, groups, key[0] == '1', match_end, kind);
+}
+
+int Dfa::Next(Cache &cache, int state, unsigned char ch, bool anchored,
+              bool match_end, MatchKind kind) const {
+  int next = cache.states[state].next[ch];
+  if (next >= 0) return next;
+
+  const State &current = cache.states[state];
+  bool matched = current.matched;
+  vector<vector<unsigned int>> groups;
+  vector<bool> seen(program.size(), false);
+  for (auto &group : current.groups) {
+    groups.push_back(vector<unsigned int>());
+    for (auto pc : group) {
+      if (program[pc]->Accepts(ch)) AddThread(pc + 1, groups.back(), seen);
+    }
+  }
+  // Start a new group at the next index.
+  if (!anchored && !matched) {
+    groups.push_back(vector<unsigned int>());
+    AddThread(0, groups.back(), seen);
+  }
+
+  unsigned long flushes = cache.flushes;
+  next = AddState(cache, groups, matched, match_end, kind);
+  // If the cache has been flushed, state is no longer valid.
+  if (cache.flushes == flushes) cache.states[state].next[ch] = next;
+  return next;
+}
+
+long Dfa::Scan(Caches &caches, const char *p, long n, long step,
+               bool anchored, bool match_end, MatchKind kind,
+               long &scanned) const {
+  Cache &cache = caches[(kind == LEFTMOST_FIRST ? 4 : 0) + (anchored ? 2 : 0) +
+                        (match_end ? 1 : 0)];
+  int state = Start(cache, match_end, kind);
+  long last = -1;
+  if (cache.states[state].has_match && (!match_end || n == 0)) last = 0;
+
+  long k = 0;
+  for (; k < n; ++k) {
+    const State &current = cache.states[state];
+    // No thread left, and no group will be started.
+    if (current.groups.empty() && (anchored || current.matched)) break;
+    state = Next(cache, state, p[k * step], anchored, match_end, kind);
+    if (cache.states[state].has_match && (!match_end || k + 1 == n))
+      last = k + 1;
+  }
+  scanned = k;
+  return last;
+}
+
+long Dfa::ScanSegment(Caches &caches, string_view s, bool match_end,
+                      MatchKind kind, Segment &segment, const Segment *guess,
+                      long max, const std::atomic<bool> *stop) const {
+  Cache &cache = caches[(kind == LEFTMOST_FIRST ? 4 : 0) + (match_end ? 1 : 0)];
+  long n = s.size();
+  auto matches = [&](int state, long k) {
+    return cache.states[state].has_match && (!match_end || k == n);
+  };
+  int state = Load(cache, segment.start, match_end, kind);
+  long k = segment.from;
+  long limit = guess ? std::min(segment.end, k + max) : segment.end;
+  long met = -1;
+  size_t g = 0;  // next checkpoint of guess
+  segment.last = matches(state, k) ? k : -1;
+  segment.checkpoints.clear();
+  for (;; ++k) {
+    if (k > segment.from && k % kCheckpointInterval == 0) {
+      if (stop && stop->load(std::memory_order_relaxed)) break;
+      segment.checkpoints.emplace_back(k, cache.states[state].key);
+    }
+    if (guess) {
+      auto &saved = guess->checkpoints;
+      while (g < saved.size() && saved[g].first < k) ++g;
+      // Both scans go on the same from the same state.
+      if (g < saved.size() && saved[g].first == k &&
+          saved[g].second == cache.states[state].key) {
+        met = k;
+        break;
+      }
+    }
+    if (k >= limit) break;
+    const State &current = cache.states[state];
+    // No thread left, and no group will be started.
+    if (current.groups.empty() && current.matched) break;
+    state = Next(cache, state, s[k], false, match_end, kind);
+    if (matches(state, k + 1)) segment.last = k + 1;
+  }
+  segment.stop = k;
+  segment.consumed = k - segment.from;
+  if (segment.checkpoints.empty() || segment.checkpoints.back().first != k)
+    segment.checkpoints.emplace_back(k, cache.states[state].key);
+  return met;
+}
+
+bool Dfa::SearchForward(string_view s, bool match_begin, bool match_end,
+                        MatchKind kind, unsigned int &end,
+                        unsigned long *scanned) const {
+  long k = 0;
+  CachesPtr caches = Acquire();
+  long last = Scan(*caches, s.data(), s.size(), 1, match_begin, match_end,
+                   kind, k);
+  Release(std::move(caches));
+  if (scanned) *scanned += k;
+  if (last < 0) return false;
+  end = last;
+  return true;
+}
+
+bool Dfa::SearchParallel(string_view s, unsigned int num_threads,
+                         bool match_end, MatchKind kind, unsigned int &end,
+                         unsigned long *scanned,
+                         const std::function<size_t(size_t)> &skip) const {
+  unsigned long n = std::min<unsigned long>(num_threads,
+                                            s.size() / kMinSegmentSize);
+  if (n <= 1) return SearchForward(s, false, match_end, kind, end, scanned);
+
+  string start;
+  {
+    CachesPtr caches = Acquire();
+    Cache &cache =
+        (*caches)[(kind == LEFTMOST_FIRST ? 4 : 0) + (match_end ? 1 : 0)];
+    start = cache.states[Start(cache, match_end, kind)].key;
+    Release(std::move(caches));
+  }
+
+  // Segment i begins at i * size, and the last one takes the rest.
+  unsigned long size = s.size() / n;
+  vector<Segment> segments(n);
+  for (unsigned long i = 0; i < n; ++i) {
+    segments[i].begin = i * size;
+    segments[i].end = i + 1 < n ? (i + 1) * size : s.size();
+  }
+  unsigned long consumed = 0;
+  // Scan segment first from state in at index pos, and the segments after it
+  // from state guess, in parallel.
+  auto launch = [&](unsigned long first, long pos, const string &in,
+                    const string &guess) {
+    std::unique_ptr<std::atomic<bool>[]> stop(new std::atomic<bool>[n]);
+    for (unsigned long i = 0; i < n; ++i) stop[i] = false;
+    auto scan = [&](unsigned long i) {
+      Segment &segment = segments[i];
+      segment.start = i == first ? in : guess;
+      segment.from = i == first ? pos : segment.begin;
+      // Characters where no match begins lead back to the start state.
+      if (skip && segment.start == start)
+        segment.from =
+            std::min<size_t>(skip(segment.from), segment.end);
+      CachesPtr caches = Acquire();
+      ScanSegment(*caches, s, match_end, kind, segment, nullptr, 0, &stop[i]);
+      Release(std::move(caches));
+      // Later segments don't matter if the guess was right.
+      if (IsFinished(segment.checkpoints.back().second)) {
+        for (unsigned long j = i + 1; j < n; ++j) stop[j] = true;
+      }
+    };
+    vector<std::thread> threads;
+    for (unsigned long i = first + 1; i < n; ++i) {
+      threads.emplace_back([&, i] { scan(i); });
+    }
+    scan(first);
+    for (auto &t : threads) t.join();
+    for (unsigned long i = first; i < n; ++i) consumed += segments[i].consumed;
+  };
+
+  // Join the segments from left to right. in is the state at index pos, where
+  // segment i begins or goes on.
+  long pos = 0, last = -1;
+  string in = start;
+  launch(0, pos, in, in);
+  for (unsigned long i = 0; i < n;) {
+    Segment &segment = segments[i];
+    // Characters skipped from the start state don't change it.
+    long met = segment.start == in && (segment.from == pos || in == start)
+                   ? segment.from
+                   : -1;
+    Segment rescan;
+    if (met < 0) {
+      rescan.begin = pos;
+      rescan.end = segment.end;
+      rescan.start = in;
+      rescan.from = pos;
+      CachesPtr caches = Acquire();
+      met = ScanSegment(*caches, s, match_end, kind, rescan, &segment,
+                        kMaxRescan);
+      Release(std::move(caches));
+      consumed += rescan.consumed;
+      if (rescan.last >= 0) last = rescan.last;
+    }
+    // From met on, the scan of the segment holds.
+    const Segment &scan = met >= 0 ? segment : rescan;
+    if (met >= 0 && segment.last >= met) last = segment.last;
+    pos = scan.stop;
+    in = scan.checkpoints.back().second;
+    if (IsFinished(in)) break;
+    if (pos == segment.end) {
+      ++i;
+      continue;
+    }
+    // The scans didn't meet, or the scan of the segment was stopped, so go on
+    // from here in parallel again.
+    launch(i, pos, in, in);
+  }
+  if (scanned) *scanned += consumed;
+  if (last < 0) return false;
+  end = last;
+  return true;
+}
+
+bool Dfa::SearchBackward(string_view s, unsigned int end, unsigned int &begin,
+                         unsigned long *scanned) const {
+  long k = 0;
+  CachesPtr caches = Acquire();
+  long last = Scan(*caches, s.data() + end - 1, end, -1, true, false,
+                   LEFTMOST_LONGEST, k);
+  Release(std::move(caches));
+  if (scanned) *scanned += k;
+  if (last < 0) return false;
+  begin = end - last;
+  return true;
+}
+
+DfaPtr CreateDfa(const Program &program) {
+  for (auto &instr : program) {
+    Opcode opcode = instr->opcode;
+    if (opcode == CHECK || opcode == INCR || opcode == SET) return nullptr;
+  }
+  return DfaPtr(new Dfa(program));
+}
+
+};  // namespace Azuki
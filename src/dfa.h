@@ -0,0 +1,156 @@
+#ifndef __AZUKI_DFA__
+#define __AZUKI_DFA__
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "common.h"
+#include "instruction.h"
+
+namespace Azuki {
+
+// The Dfa class runs a program without capture groups as a deterministic
+// finite automaton built lazily: states are created and cached the first time
+// a character leads to them.
+// A state is an ordered list of thread groups. Threads in a group started at
+// the same index, and groups started earlier come first, so the leftmost
+// longest match can be found without tracking begin indices (like marks in
+// RE2). Once a group matches, groups started later are dropped and no new
+// group is started. Threads in a group are in priority order, so for the
+// leftmost first match, threads after MATCH are dropped too.
+// Searches may run in several threads at once: each search takes a set of
+// caches from a pool of the Dfa and puts it back when it's done, so states
+// built by one search are reused by the following ones.
+// Use CreateDfa below instead of the constructor.
+class Dfa {
+ public:
+  explicit Dfa(const Program &program);
+
+  Dfa(const Dfa &) = delete;
+  Dfa &operator=(const Dfa &) = delete;
+
+  // Scan s forward and set end to the end index of the leftmost match chosen
+  // by kind.
+  // If match_begin is true, only matches beginning at index 0 are considered.
+  // If match_end is true, only matches ending at s.size() are considered.
+  // Return false if there is no match.
+  // If scanned is not nullptr, consumed characters are counted in it.
+  bool SearchForward(string_view s, bool match_begin, bool match_end,
+                     MatchKind kind, unsigned int &end,
+                     unsigned long *scanned = nullptr) const;
+
+  // Same as SearchForward without match_begin, but s is split into segments
+  // scanned by up to num_threads threads at the same time. The state a
+  // segment begins in is only known once the segments before it are done, so
+  // each is scanned from a guess, the start state at first, and keys of its
+  // states are saved every few characters. From the start state, a scan skips
+  // to skip(index) if skip is set (the first index >= its argument where a
+  // match may begin, or npos).
+  // Segments are then joined from left to right. If a segment began in the
+  // state the one before it ended in, its scan holds. Otherwise it's scanned
+  // again from that state until both scans are in the same state at the same
+  // index, and agree from there on, which is soon for most patterns (like
+  // "a.*b" once an 'a' is read). If they don't meet soon, that segment and the
+  // ones after it are scanned again in parallel, guessing the state they
+  // begin in is the one found so far.
+  bool SearchParallel(string_view s, unsigned int num_threads, bool match_end,
+                      MatchKind kind, unsigned int &end,
+                      unsigned long *scanned = nullptr,
+                      const std::function<size_t(size_t)> &skip =
+                          nullptr) const;
+
+  // Scan s backward from index end with a program compiled by
+  // CompileReversedRegexp, and set begin to the smallest index such that
+  // s[begin, end) matches. Return false if there is no match.
+  // scanned is the same as above.
+  bool SearchBackward(string_view s, unsigned int end, unsigned int &begin,
+                      unsigned long *scanned = nullptr) const;
+
+ private:
+  // The State struct is a cached DFA state.
+  struct State {
+    vector<vector<unsigned int>> groups;  // instruction indices of threads
+    bool matched;                         // some group has matched
+    bool has_match;                       // a group reaches MATCH now
+    std::array<int, 256> next;            // cached transitions
+    string key;                           // key of the state in its cache
+  };
+
+  // The Cache struct holds states built for one search mode.
+  struct Cache {
+    vector<State> states;
+    std::unordered_map<string, int> index;  // key of a state to its index
+    unsigned long flushes = 0;              // times the cache was flushed
+    int start = -1;  // index of the start state, or -1 until it's built
+  };
+
+  // Caches for each (kind, anchored, match_end), used by one search at a time.
+  typedef std::array<Cache, 8> Caches;
+  typedef std::unique_ptr<Caches> CachesPtr;
+
+  // Take caches from the pool, or new ones if it's empty, and put them back.
+  CachesPtr Acquire() const;
+  void Release(CachesPtr caches) const;
+
+  // The Segment struct records a scan of s[begin, end) by SearchParallel.
+  struct Segment {
+    long begin, end;  // indices of the segment in s
+    string start;     // key of the state the scan began in
+    long from;        // index the scan began at
+    long stop;        // index the scan stopped at
+    long last;        // end index of the last match found, or -1
+    vector<std::pair<long, string>> checkpoints;  // keys of states by index
+    unsigned long consumed;                       // characters consumed
+  };
+
+  // Return the start state, which is built once per cache (and flush), so
+  // that repeated searches like Machine::Count don't build it again.
+  int Start(Cache &cache, bool match_end, MatchKind kind) const;
+  // Return the state of key, which may come from another cache.
+  int Load(Cache &cache, const string &key, bool match_end,
+           MatchKind kind) const;
+  int Next(Cache &cache, int state, unsigned char ch, bool anchored,
+           bool match_end, MatchKind kind) const;
+  int AddState(Cache &cache, vector<vector<unsigned int>> &groups,
+               bool matched, bool match_end, MatchKind kind) const;
+  void AddThread(unsigned int pc, vector<unsigned int> &group,
+                 vector<bool> &seen) const;
+
+  // Run the DFA over n characters read with step from p, and return the
+  // number of characters consumed at the last match, or -1 if none.
+  // The number of characters consumed is saved in scanned.
+  long Scan(Caches &caches, const char *p, long n, long step, bool anchored,
+            bool match_end, MatchKind kind, long &scanned) const;
+
+  // Scan s from segment.from up to segment.end without anchor, from the
+  // state of segment.start, and fill the rest of segment. A key is saved
+  // every kCheckpointInterval characters and where the scan stops, which is
+  // early if no match can follow or stop is set by another thread.
+  // If guess is not nullptr, the scan also stops after max characters, or
+  // when it's in the state of a checkpoint of guess at the same index, which
+  // is then returned. Return -1 if it doesn't meet guess.
+  long ScanSegment(Caches &caches, string_view s, bool match_end,
+                   MatchKind kind, Segment &segment,
+                   const Segment *guess = nullptr, long max = 0,
+                   const std::atomic<bool> *stop = nullptr) const;
+
+  const Program program;
+  mutable std::mutex mutex;         // guards pool
+  mutable vector<CachesPtr> pool;   // caches not used by any search
+};
+
+typedef shared_ptr<Dfa> DfaPtr;
+
+// Create a Dfa from program. Return nullptr if the program has counters
+// (CHECK, INCR and SET), which a finite automaton can't represent.
+// Example:
+//    DfaPtr dfa = CreateDfa(CompileRegexp(ExpandRegexp(ParseRegexp("a+b"))));
+DfaPtr CreateDfa(const Program &program);
+
+};  // namespace Azuki
+
+#endif  // __AZUKI_DFA__
@@ -1,3 +1,4 @@
+#include <cctype>
 #include <iostream>
 #include <sstream>
 #include <unordered_set>
@@ -12,8 +13,13 @@ struct Context {
   int pc;
   unsigned int save_idx;
   unsigned int rpctr_idx;
-  Context(int pc, int save_idx, int rpctr_idx)
-      : pc(pc), save_idx(save_idx), rpctr_idx(rpctr_idx) {}
+  vector<RegexpPtr> *sources;  // source of each instruction (optional)
+  Context(int pc, int save_idx, int rpctr_idx,
+          vector<RegexpPtr> *sources = nullptr)
+      : pc(pc),
+        save_idx(save_idx),
+        rpctr_idx(rpctr_idx),
+        sources(sources) {}
 };
 
 };  // namespace
@@ -23,20 +29,22 @@ InstrPtr CreateAnyInstruction();
 InstrPtr CreateAnyWordInstruction();
 InstrPtr CreateAnyDigitInstruction();
 InstrPtr CreateAnySpaceInstruction();
-InstrPtr CreateCharInstruction(char c);
+InstrPtr CreateCharInstruction(char c, bool fold = false);
 InstrPtr CreateCheckInstruction(unsigned int rpctr_idx, int low_times,
                                 int high_times);
 InstrPtr CreateIncrInstruction(unsigned int rpctr_idx);
 InstrPtr CreateMatchInstruction();
-InstrPtr CreateRangeInstruction(char low_ch, char high_ch);
+InstrPtr CreateRangeInstruction(char low_ch, char high_ch, bool fold = false);
 InstrPtr CreateSaveInstruction(unsigned int save_idx);
 InstrPtr CreateSetInstruction(unsigned int rpctr_idx, int value);
 InstrPtr CreateSplitInstruction(unsigned int dst, bool greedy = false);
 InstrPtr CreateJmpInstruction(unsigned int dst);
 
 // Calculate the number of instructions required to represent the regexp.
-int CalculateInstruction(RegexpPtr rp);
-int CalculateInstructionImpl(RegexpPtr rp);
+// Stop as soon as the number exceeds limit and return a number above limit,
+// so that huge expanded regexps are not walked through.
+unsigned long CalculateInstruction(RegexpPtr rp, unsigned long limit);
+unsigned long CalculateInstructionImpl(RegexpPtr rp, unsigned long limit);
 
 // Emit instructions compiled from regexp to program with starting index pc.
 void Emit(Program &program, Context &context, RegexpPtr rp);
@@ -47,6 +55,40 @@ bool Instruction::ConsumeCharacter() {
   return data_opcodes.count(opcode);
 }
 
+bool Instruction::Accepts(char ch) const {
+  switch (opcode) {
+    case ANY:
+      return true;
+    case ANY_WORD:
+    case ANY_DIGIT:
+    case ANY_SPACE:
+      return InClass(opcode, ch);
+    case CHAR:
+      return c == ch || (fold && c == SwapCase(ch));
+    case RANGE:
+      if (fold && SwapCase(ch) >= low_ch && SwapCase(ch) <= high_ch)
+        return true;
+      return ch >= low_ch && ch <= high_ch;
+    default:
+      return false;
+  }
+}
+
+bool InClass(Opcode opcode, char ch) {
+  // <cctype> functions are undefined for negative values but EOF.
+  unsigned char u = ch;
+  switch (opcode) {
+    case ANY_WORD:
+      return isalnum(u) || u == '_';
+    case ANY_DIGIT:
+      return isdigit(u);
+    case ANY_SPACE:
+      return isspace(u);
+    default:
+      return false;
+  }
+}
+
 std::string Instruction::str() {
   std::stringstream ss;
   ss << "I" << idx << " ";
@@ -64,7 +106,7 @@ std::string Instruction::str() {
       ss << "ANY SPACE";
       break;
     case CHAR:
-      ss << "CHAR '" << c << "'";
+      ss << "CHAR '" << c << "'" << (fold ? " FOLD" : "");
       break;
     case CHECK:
       ss << "CHECK rpctr[" << rpctr_idx << "] " << low_times << " "
@@ -86,10 +128,12 @@ std::string Instruction::str() {
       ss << "SET rpctr[" << rpctr_idx << "]";
       break;
     case SPLIT:
-      ss << "SPLIT I" << idx + 1 << " I" << dst;
+      // Targets in priority order.
+      ss << "SPLIT I" << (greedy ? dst : idx + 1) << " I"
+         << (greedy ? idx + 1 : dst);
       break;
     case RANGE:
-      ss << "RANGE " << low_ch << " " << high_ch;
+      ss << "RANGE " << low_ch << " " << high_ch << (fold ? " FOLD" : "");
       break;
     default:
       throw std::runtime_error("Unexpected instruction opcode.");
@@ -97,9 +141,13 @@ std::string Instruction::str() {
   return ss.str();
 }
 
-Program CompileRegexp(RegexpPtr rp) {
-  Program program(CalculateInstruction(rp));
-  Context context(0, 0, 0);
+Program CompileRegexp(RegexpPtr rp, unsigned int max_size,
+                      vector<RegexpPtr> *sources) {
+  unsigned long size = CalculateInstruction(rp, max_size);
+  if (size > max_size) throw std::runtime_error("Program is too large.");
+  Program program(size);
+  if (sources) sources->assign(size, nullptr);
+  Context context(0, 0, 0, sources);
   Emit(program, context, rp);
   program.back() = CreateMatchInstruction();
 
@@ -108,6 +156,10 @@ Program CompileRegexp(RegexpPtr rp) {
   return program;
 }
 
+Program CompileReversedRegexp(RegexpPtr rp, unsigned int max_size) {
+  return CompileRegexp(ReverseRegexp(ExpandRegexp(rp)), max_size);
+}
+
 void PrintProgram(const Program &program) {
   for (int idx = 0; idx < program.size(); ++idx) {
     auto &instr = program[idx];
@@ -139,10 +191,11 @@ InstrPtr CreateAnySpaceInstruction() {
   return instr;
 }
 
-InstrPtr CreateCharInstruction(char c) {
+InstrPtr CreateCharInstruction(char c, bool fold) {
   InstrPtr instr(new Instruction());
   instr->opcode = CHAR;
   instr->c = c;
+  instr->fold = fold;
   return InstrPtr(instr);
 }
 
@@ -174,11 +227,12 @@ InstrPtr CreateJmpInstruction(unsigned int dst) {
   return instr;
 }
 
-InstrPtr CreateRangeInstruction(char low_ch, char high_ch) {
+InstrPtr CreateRangeInstruction(char low_ch, char high_ch, bool fold) {
   InstrPtr instr(new Instruction());
   instr->opcode = RANGE;
   instr->low_ch = low_ch;
   instr->high_ch = high_ch;
+  instr->fold = fold;
   return instr;
 }
 
@@ -207,34 +261,39 @@ InstrPtr CreateSetInstruction(unsigned int rpctr_idx, int value) {
   return instr;
 }
 
-int CalculateInstruction(RegexpPtr rp) {
-  return CalculateInstructionImpl(rp) + 1;  // the last instruction "MATCH"
+unsigned long CalculateInstruction(RegexpPtr rp, unsigned long limit) {
+  if (limit == 0) return 1;
+  // the last instruction "MATCH"
+  return CalculateInstructionImpl(rp, limit - 1) + 1;
 }
 
-int CalculateInstructionImpl(RegexpPtr rp) {
+unsigned long CalculateInstructionImpl(RegexpPtr rp, unsigned long limit) {
+  unsigned long size = 0;
   switch (rp->type) {
     case ALT:
-      return 2 + CalculateInstructionImpl(rp->left) +
-             CalculateInstructionImpl(rp->right);
+      size = 2 + CalculateInstructionImpl(rp->left, limit);
+      if (size > limit) return size;
+      return size + CalculateInstructionImpl(rp->right, limit - size);
     case CAT:
-      return CalculateInstructionImpl(rp->left) +
-             CalculateInstructionImpl(rp->right);
+      size = CalculateInstructionImpl(rp->left, limit);
+      if (size > limit) return size;
+      return size + CalculateInstructionImpl(rp->right, limit - size);
     case CLASS:
       return 1;
     case CURLY:
-      return 5 + CalculateInstructionImpl(rp->left);
+      return 5 + CalculateInstructionImpl(rp->left, limit);
     case DOT:
       return 1;
     case LIT:
       return 1;
     case PAREN:
-      return 2 + CalculateInstructionImpl(rp->left);
+      return 2 + CalculateInstructionImpl(rp->left, limit);
     case PLUS:
-      return 2 + CalculateInstructionImpl(rp->left);
+      return 2 + CalculateInstructionImpl(rp->left, limit);
     case QUEST:
-      return 1 + CalculateInstructionImpl(rp->left);
+      return 1 + CalculateInstructionImpl(rp->left, limit);
     case STAR:
-      return 2 + CalculateInstructionImpl(rp->left);
+      return 2 + CalculateInstructionImpl(rp->left, limit);
     case SQUARE:
       return 1;
     default:
@@ -246,6 +305,7 @@ void Emit(Program &program, Context &context, RegexpPtr rp) {
   int &pc = context.pc;
   unsigned int &save_idx = context.save_idx;
   unsigned int &rpctr_idx = context.rpctr_idx;
+  int begin_pc = pc;
 
   if (rp->type == ALT) {
     int split_pc = pc++;
@@ -273,14 +333,14 @@ void Emit(Program &program, Context &context, RegexpPtr rp) {
     int split_pc = pc++;
     int jmp_pc = pc++;
     int check_pc = pc++;
-    program[split_pc] = CreateSplitInstruction(check_pc, false);
+    program[split_pc] = CreateSplitInstruction(check_pc, rp->lazy);
     program[jmp_pc] = CreateJmpInstruction(set_pc + 1);
     program[check_pc] =
         CreateCheckInstruction(old_rpctr_idx, rp->low_times, rp->high_times);
   } else if (rp->type == DOT) {
     program[pc++] = CreateAnyInstruction();
   } else if (rp->type == LIT) {
-    program[pc++] = CreateCharInstruction(rp->c);
+    program[pc++] = CreateCharInstruction(rp->c, rp->fold);
   } else if (rp->type == PAREN) {
     int old_save_idx = save_idx;
     save_idx += 2;
@@ -290,23 +350,30 @@ void Emit(Program &program, Context &context, RegexpPtr rp) {
   } else if (rp->type == PLUS) {
     int current_pc = pc;
     Emit(program, context, rp->left);
-    program[pc] = CreateSplitInstruction(pc + 2, true);
+    program[pc] = CreateSplitInstruction(pc + 2, rp->lazy);
     ++pc;
     program[pc++] = CreateJmpInstruction(current_pc);
   } else if (rp->type == QUEST) {
     int split_pc = pc++;
     Emit(program, context, rp->left);
-    program[split_pc] = CreateSplitInstruction(pc);
+    program[split_pc] = CreateSplitInstruction(pc, rp->lazy);
   } else if (rp->type == STAR) {
     int split_pc = pc++;
     Emit(program, context, rp->left);
     program[pc++] = CreateJmpInstruction(split_pc);
-    program[split_pc] = CreateSplitInstruction(pc, true);
+    program[split_pc] = CreateSplitInstruction(pc, rp->lazy);
   } else if (rp->type == SQUARE) {
-    program[pc++] = CreateRangeInstruction(rp->low_ch, rp->high_ch);
+    program[pc++] = CreateRangeInstruction(rp->low_ch, rp->high_ch, rp->fold);
   } else {
     throw std::runtime_error("Unexpected regexp type.");
   }
+
+  // Instructions of children already have their source, the others are
+  // compiled from rp itself.
+  if (!context.sources) return;
+  for (int idx = begin_pc; idx < pc; ++idx) {
+    if (!(*context.sources)[idx]) (*context.sources)[idx] = rp;
+  }
 }
 
 };  // namespace Azuki
@@ -1,6 +1,7 @@
 #ifndef __AZUKI_INSTR__
 #define __AZUKI_INSTR__
 
+#include <climits>
 #include "common.h"
 #include "regexp.h"
 
@@ -23,6 +24,15 @@ enum Opcode {
   JMP
 };
 
+// Rules to choose among matches which begin at the leftmost index. SPLIT of
+// a greedy repetition tries one more time first, and of a lazy one the exit
+// first. Only LEFTMOST_FIRST depends on this priority: LEFTMOST_LONGEST
+// chooses the same match and capture groups in either order.
+enum MatchKind {
+  LEFTMOST_LONGEST,  // the longest match (POSIX)
+  LEFTMOST_FIRST     // the first match in priority order of SPLIT (Perl)
+};
+
 // An instruction struct encodes information for thread to run the instruction.
 // Don't create Instruction directly with constructor as it may lead to
 // uninitialized fields. Use CompileRegexp below to get a whole program (a
@@ -34,6 +44,7 @@ struct Instruction {
 
   // Optional fields (depend on Opcode opcode).
   char c;                 // character to match (CHAR)
+  bool fold;              // also match the other case of letters (CHAR, RANGE)
   unsigned int dst;       // destination instruction index (SPLIT and JMP)
   bool greedy;            // if true, try dst before (idx + 1) (SPLIT)
   unsigned int save_idx;  // index to save current string pointer (SAVE)
@@ -44,17 +55,40 @@ struct Instruction {
   int value;                  // value to set rpctr_idx (SET)
 
   bool ConsumeCharacter();
+  // Return true if the instruction consumes ch. Every engine decides with it
+  // which bytes a data instruction (ANY to RANGE above) accepts; other
+  // instructions accept none.
+  bool Accepts(char ch) const;
   string str();
 };
 
+// Return true if ch is in the class of opcode: \w for ANY_WORD, \d for
+// ANY_DIGIT and \s for ANY_SPACE. Bytes from 0x80 are in none of them.
+bool InClass(Opcode opcode, char ch);
+
 typedef shared_ptr<Instruction> InstrPtr;
 typedef vector<InstrPtr> Program;
 
 // Compile into program the regular expression represented with Regexp.
+// Throw std::runtime_error if the program would have more than max_size
+// instructions, so untrusted patterns can't make huge programs.
+// If sources is not nullptr, it's set to the innermost Regexp node each
+// instruction is compiled from (nullptr for the final MATCH), for profiles
+// (see PrintProgram in machine.h).
 // Example:
 //    RegexpPtr rp = ParseRegexp("a+b");
 //    Program program = CompileRegexp(rp);
-Program CompileRegexp(RegexpPtr rp);
+Program CompileRegexp(RegexpPtr rp, unsigned int max_size = UINT_MAX,
+                      vector<RegexpPtr> *sources = nullptr);
+
+// Compile into program the reversed regular expression (see ReverseRegexp),
+// which matches the reversed strings. It is used to find where a match begins
+// by scanning backward from where it ends. Counters are expanded when possible
+// (see ExpandRegexp).
+// Example:
+//    RegexpPtr rp = ParseRegexp("ab+");
+//    Program reversed = CompileReversedRegexp(rp);  // program of "b+a"
+Program CompileReversedRegexp(RegexpPtr rp, unsigned int max_size = UINT_MAX);
 
 // Print the program (for debug use).
 void PrintProgram(const Program &program);
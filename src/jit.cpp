@@ -0,0 +1,451 @@
+#include <sys/mman.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+#include "jit.h"
+#include "machine.h"
+
+namespace Azuki {
+
+namespace {
+
+// The JitThread struct is a thread in native thread lists: the address of the
+// block to run and the begin index of its substring.
+struct JitThread {
+  const void *code;
+  uint32_t begin;
+  uint32_t padding;
+};
+
+// The JitState struct is shared by C++ and native code. Native code accesses
+// the fields with the fixed offsets checked below, so don't reorder them.
+struct JitState {
+  JitThread *clist;     // threads to run in current iteration
+  uint32_t ccount;      // number of threads in clist
+  uint32_t padding;
+  JitThread *nlist;     // threads to run in next iteration
+  uint32_t ncount;      // number of threads in nlist
+  uint32_t generation;  // threads marked with generation are in nlist
+  uint32_t *mark;       // generation at which each block was last added
+  uint32_t success;     // match result
+  uint32_t begin, end;
+  uint32_t min_end;     // matches ending before min_end are ignored
+};
+
+static_assert(sizeof(JitThread) == 16, "Unexpected JitThread layout.");
+static_assert(offsetof(JitState, clist) == 0, "Unexpected JitState layout.");
+static_assert(offsetof(JitState, ccount) == 8, "Unexpected JitState layout.");
+static_assert(offsetof(JitState, nlist) == 16, "Unexpected JitState layout.");
+static_assert(offsetof(JitState, ncount) == 24, "Unexpected JitState layout.");
+static_assert(offsetof(JitState, generation) == 28,
+              "Unexpected JitState layout.");
+static_assert(offsetof(JitState, mark) == 32, "Unexpected JitState layout.");
+static_assert(offsetof(JitState, success) == 40, "Unexpected JitState layout.");
+static_assert(offsetof(JitState, begin) == 44, "Unexpected JitState layout.");
+static_assert(offsetof(JitState, end) == 48, "Unexpected JitState layout.");
+static_assert(offsetof(JitState, min_end) == 52, "Unexpected JitState layout.");
+
+// Native functions take (JitState *state, int ch, uint32_t pos) where ch is
+// the current character and pos the index after it.
+typedef void (*NativeFunc)(JitState *, int, uint32_t);
+
+// The CodeBuffer class collects machine code and resolves rel32 references
+// to labels once all the code is emitted.
+class CodeBuffer {
+ public:
+  void Emit(std::initializer_list<unsigned char> bytes) {
+    code.insert(code.end(), bytes.begin(), bytes.end());
+  }
+
+  void Emit32(uint32_t value) {
+    for (int i = 0; i < 4; ++i) code.push_back((value >> (8 * i)) & 0xFF);
+  }
+
+  int NewLabel() {
+    labels.push_back(-1);
+    return labels.size() - 1;
+  }
+
+  void Bind(int label) { labels[label] = code.size(); }
+
+  // Emit a rel32 displacement to label, relative to the end of the field.
+  void Rel32(int label) {
+    fixups.push_back(std::make_pair(code.size(), label));
+    Emit32(0);
+  }
+
+  size_t Offset(int label) const { return labels[label]; }
+
+  const vector<unsigned char> &Finalize() {
+    for (auto &f : fixups) {
+      int32_t rel = labels[f.second] - (f.first + 4);
+      std::memcpy(&code[f.first], &rel, sizeof(rel));
+    }
+    return code;
+  }
+
+ private:
+  vector<unsigned char> code;
+  vector<long> labels;
+  vector<pair<size_t, int>> fixups;
+};
+
+// Registers used by native code:
+//    rdi  JitState *          esi  current character
+//    edx  pos                 r8   current thread in clist
+//    r9   end of clist        r10  nlist
+//    r11d number of threads in nlist
+//    rcx  mark                r12d begin of current thread
+//    rax, r13 scratch
+class Compiler {
+ public:
+  explicit Compiler(const Program &program) : program(program) {}
+
+  // Return false if the program contains unsupported instructions.
+  bool Compile();
+
+  const vector<unsigned char> &Code() { return buffer.Finalize(); }
+  size_t StepEntry() const { return buffer.Offset(step_label); }
+  size_t SeedEntry() const { return buffer.Offset(seed_label); }
+  bool HasCapture() const { return has_capture; }
+
+ private:
+  // Collect consuming instructions and MATCH reachable from pc without
+  // consuming any character.
+  bool Closure(unsigned int pc, vector<unsigned int> &targets);
+  bool ClosureImpl(unsigned int pc, vector<bool> &visited,
+                   vector<unsigned int> &targets);
+
+  void EmitPrologue();
+  void EmitBlock(unsigned int pc, const vector<unsigned int> &targets);
+  void EmitTargets(const vector<unsigned int> &targets);
+  void EmitAddThread(unsigned int pc);
+  void EmitMatch();
+  int BitmapLabel(unsigned int pc);
+  void EmitBitmapTest(int table_label);
+  void EmitBitmap(const Instruction &instr);
+
+  const Program &program;
+  CodeBuffer buffer;
+  vector<int> block_labels;
+  int step_label, seed_label, next_label, done_label;
+  // Labels of the bitmaps of ANY_WORD, ANY_DIGIT and ANY_SPACE, shared by
+  // all instructions of the opcode, or -1 before one is used.
+  int word_label = -1, digit_label = -1, space_label = -1;
+  // Labels of the bitmaps, with the pc of the instruction they are made of.
+  vector<pair<int, unsigned int>> bitmap_labels;
+  bool has_capture = false;
+};
+
+bool Compiler::ClosureImpl(unsigned int pc, vector<bool> &visited,
+                           vector<unsigned int> &targets) {
+  if (visited[pc]) return true;
+  visited[pc] = true;
+
+  auto &instr = program[pc];
+  switch (instr->opcode) {
+    case JMP:
+      return ClosureImpl(instr->dst, visited, targets);
+    case SPLIT:
+      if (instr->greedy)
+        return ClosureImpl(instr->dst, visited, targets) &&
+               ClosureImpl(pc + 1, visited, targets);
+      return ClosureImpl(pc + 1, visited, targets) &&
+             ClosureImpl(instr->dst, visited, targets);
+    case SAVE:
+      has_capture = true;
+      return ClosureImpl(pc + 1, visited, targets);
+    case CHECK:
+    case INCR:
+    case SET:
+      return false;
+    default:
+      targets.push_back(pc);
+      return true;
+  }
+}
+
+bool Compiler::Closure(unsigned int pc, vector<unsigned int> &targets) {
+  vector<bool> visited(program.size(), false);
+  return ClosureImpl(pc, visited, targets);
+}
+
+bool Compiler::Compile() {
+  vector<vector<unsigned int>> closures(program.size());
+  vector<unsigned int> start;
+  if (!Closure(0, start)) return false;
+  for (unsigned int pc = 0; pc < program.size(); ++pc) {
+    if (program[pc]->ConsumeCharacter() && !Closure(pc + 1, closures[pc]))
+      return false;
+  }
+
+  for (unsigned int pc = 0; pc < program.size(); ++pc)
+    block_labels.push_back(buffer.NewLabel());
+  step_label = buffer.NewLabel();
+  seed_label = buffer.NewLabel();
+  next_label = buffer.NewLabel();
+  done_label = buffer.NewLabel();
+  int loop_label = buffer.NewLabel();
+
+  // step: run every thread in clist on the current character.
+  buffer.Bind(step_label);
+  EmitPrologue();
+  buffer.Emit({0x4C, 0x8B, 0x07});              // mov r8, [rdi]
+  buffer.Emit({0x44, 0x8B, 0x4F, 0x08});        // mov r9d, [rdi + 8]
+  buffer.Emit({0x49, 0xC1, 0xE1, 0x04});        // shl r9, 4
+  buffer.Emit({0x4D, 0x01, 0xC1});              // add r9, r8
+  buffer.Emit({0xE9});                          // jmp loop
+  buffer.Rel32(loop_label);
+  buffer.Bind(next_label);
+  buffer.Emit({0x49, 0x83, 0xC0, 0x10});        // add r8, 16
+  buffer.Bind(loop_label);
+  buffer.Emit({0x4D, 0x39, 0xC8});              // cmp r8, r9
+  buffer.Emit({0x0F, 0x83});                    // jae done
+  buffer.Rel32(done_label);
+  buffer.Emit({0x45, 0x8B, 0x60, 0x08});        // mov r12d, [r8 + 8]
+  buffer.Emit({0x41, 0xFF, 0x20});              // jmp [r8]
+  buffer.Bind(done_label);
+  buffer.Emit({0x44, 0x89, 0x5F, 0x18});        // mov [rdi + 24], r11d
+  buffer.Emit({0x41, 0x5D});                    // pop r13
+  buffer.Emit({0x41, 0x5C});                    // pop r12
+  buffer.Emit({0xC3});                          // ret
+
+  // seed: add a thread starting at pos.
+  buffer.Bind(seed_label);
+  EmitPrologue();
+  buffer.Emit({0x41, 0x89, 0xD4});              // mov r12d, edx
+  EmitTargets(start);
+  buffer.Emit({0xE9});                          // jmp done
+  buffer.Rel32(done_label);
+
+  for (unsigned int pc = 0; pc < program.size(); ++pc) {
+    if (program[pc]->ConsumeCharacter()) EmitBlock(pc, closures[pc]);
+  }
+
+  for (auto &bitmap : bitmap_labels) {
+    buffer.Bind(bitmap.first);
+    EmitBitmap(*program[bitmap.second]);
+  }
+  return true;
+}
+
+void Compiler::EmitPrologue() {
+  buffer.Emit({0x41, 0x54});                    // push r12
+  buffer.Emit({0x41, 0x55});                    // push r13
+  buffer.Emit({0x4C, 0x8B, 0x57, 0x10});        // mov r10, [rdi + 16]
+  buffer.Emit({0x44, 0x8B, 0x5F, 0x18});        // mov r11d, [rdi + 24]
+  buffer.Emit({0x48, 0x8B, 0x4F, 0x20});        // mov rcx, [rdi + 32]
+}
+
+void Compiler::EmitBlock(unsigned int pc, const vector<unsigned int> &targets) {
+  auto &instr = program[pc];
+  buffer.Bind(block_labels[pc]);
+  switch (instr->opcode) {
+    case ANY:
+      break;
+    case ANY_WORD:
+    case ANY_DIGIT:
+    case ANY_SPACE:
+      EmitBitmapTest(BitmapLabel(pc));
+      break;
+    case CHAR:
+      if (instr->fold) {
+        // Both cases of a letter are equal with bit 0x20 set.
+        buffer.Emit({0x89, 0xF0});              // mov eax, esi
+        buffer.Emit({0x83, 0xC8, 0x20});        // or eax, 0x20
+        buffer.Emit({0x3D});                    // cmp eax, c | 0x20
+        buffer.Emit32(static_cast<int>(instr->c | 0x20));
+        buffer.Emit({0x0F, 0x85});              // jne next
+        buffer.Rel32(next_label);
+        break;
+      }
+      buffer.Emit({0x81, 0xFE});                // cmp esi, c
+      buffer.Emit32(static_cast<int>(instr->c));
+      buffer.Emit({0x0F, 0x85});                // jne next
+      buffer.Rel32(next_label);
+      break;
+    case RANGE:
+      if (instr->fold) {
+        EmitBitmapTest(BitmapLabel(pc));
+        break;
+      }
+      buffer.Emit({0x8D, 0x86});                // lea eax, [rsi - low_ch]
+      buffer.Emit32(-static_cast<int>(instr->low_ch));
+      buffer.Emit({0x3D});                      // cmp eax, high_ch - low_ch
+      buffer.Emit32(instr->high_ch - instr->low_ch);
+      buffer.Emit({0x0F, 0x87});                // ja next
+      buffer.Rel32(next_label);
+      break;
+    default:
+      throw std::runtime_error("Unexpected instruction opcode.");
+  }
+  EmitTargets(targets);
+  buffer.Emit({0xE9});                          // jmp next
+  buffer.Rel32(next_label);
+}
+
+void Compiler::EmitTargets(const vector<unsigned int> &targets) {
+  for (auto pc : targets) {
+    if (program[pc]->opcode == MATCH)
+      EmitMatch();
+    else
+      EmitAddThread(pc);
+  }
+}
+
+void Compiler::EmitAddThread(unsigned int pc) {
+  int skip_label = buffer.NewLabel();
+  buffer.Emit({0x8B, 0x47, 0x1C});              // mov eax, [rdi + 28]
+  buffer.Emit({0x39, 0x81});                    // cmp [rcx + 4 * pc], eax
+  buffer.Emit32(4 * pc);
+  buffer.Emit({0x0F, 0x84});                    // je skip
+  buffer.Rel32(skip_label);
+  buffer.Emit({0x89, 0x81});                    // mov [rcx + 4 * pc], eax
+  buffer.Emit32(4 * pc);
+  buffer.Emit({0x44, 0x89, 0xD8});              // mov eax, r11d
+  buffer.Emit({0x48, 0xC1, 0xE0, 0x04});        // shl rax, 4
+  buffer.Emit({0x4C, 0x01, 0xD0});              // add rax, r10
+  buffer.Emit({0x4C, 0x8D, 0x2D});              // lea r13, [rip + block]
+  buffer.Rel32(block_labels[pc]);
+  buffer.Emit({0x4C, 0x89, 0x28});              // mov [rax], r13
+  buffer.Emit({0x44, 0x89, 0x60, 0x08});        // mov [rax + 8], r12d
+  buffer.Emit({0x41, 0xFF, 0xC3});              // inc r11d
+  buffer.Bind(skip_label);
+}
+
+// Keep the leftmost longest match, like Machine::UpdateResult.
+void Compiler::EmitMatch() {
+  int take_label = buffer.NewLabel();
+  int skip_label = buffer.NewLabel();
+  buffer.Emit({0x3B, 0x57, 0x34});              // cmp edx, [rdi + 52]
+  buffer.Emit({0x0F, 0x82});                    // jb skip
+  buffer.Rel32(skip_label);
+  buffer.Emit({0x83, 0x7F, 0x28, 0x00});        // cmp dword [rdi + 40], 0
+  buffer.Emit({0x0F, 0x84});                    // je take
+  buffer.Rel32(take_label);
+  buffer.Emit({0x44, 0x3B, 0x67, 0x2C});        // cmp r12d, [rdi + 44]
+  buffer.Emit({0x0F, 0x82});                    // jb take
+  buffer.Rel32(take_label);
+  buffer.Emit({0x0F, 0x87});                    // ja skip
+  buffer.Rel32(skip_label);
+  buffer.Emit({0x3B, 0x57, 0x30});              // cmp edx, [rdi + 48]
+  buffer.Emit({0x0F, 0x86});                    // jbe skip
+  buffer.Rel32(skip_label);
+  buffer.Bind(take_label);
+  buffer.Emit({0xC7, 0x47, 0x28});              // mov dword [rdi + 40], 1
+  buffer.Emit32(1);
+  buffer.Emit({0x44, 0x89, 0x67, 0x2C});        // mov [rdi + 44], r12d
+  buffer.Emit({0x89, 0x57, 0x30});              // mov [rdi + 48], edx
+  buffer.Bind(skip_label);
+}
+
+int Compiler::BitmapLabel(unsigned int pc) {
+  Opcode opcode = program[pc]->opcode;
+  int *shared = opcode == ANY_WORD    ? &word_label
+                : opcode == ANY_DIGIT ? &digit_label
+                : opcode == ANY_SPACE ? &space_label
+                                      : nullptr;
+  if (shared && *shared >= 0) return *shared;
+  int label = buffer.NewLabel();
+  bitmap_labels.push_back(std::make_pair(label, pc));
+  if (shared) *shared = label;
+  return label;
+}
+
+void Compiler::EmitBitmapTest(int table_label) {
+  buffer.Emit({0x40, 0x0F, 0xB6, 0xC6});        // movzx eax, sil
+  buffer.Emit({0x0F, 0xA3, 0x05});              // bt [rip + table], eax
+  buffer.Rel32(table_label);
+  buffer.Emit({0x0F, 0x83});                    // jnc next
+  buffer.Rel32(next_label);
+}
+
+void Compiler::EmitBitmap(const Instruction &instr) {
+  unsigned char bitmap[32] = {0};
+  for (int b = 0; b < 256; ++b) {
+    if (instr.Accepts(static_cast<char>(b))) bitmap[b / 8] |= 1 << (b % 8);
+  }
+  for (auto byte : bitmap) buffer.Emit({byte});
+}
+
+};  // namespace
+
+JitProgram::JitProgram(const unsigned char *code, size_t code_size,
+                       size_t step_entry, size_t seed_entry,
+                       unsigned int num_states, bool has_capture)
+    : buffer(nullptr),
+      buffer_size(code_size),
+      num_states(num_states),
+      has_capture(has_capture) {
+  void *p = mmap(nullptr, buffer_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) throw std::runtime_error("Failed to map JIT buffer.");
+  std::memcpy(p, code, code_size);
+  if (mprotect(p, buffer_size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(p, buffer_size);
+    throw std::runtime_error("Failed to protect JIT buffer.");
+  }
+  buffer = p;
+  step = static_cast<char *>(p) + step_entry;
+  seed = static_cast<char *>(p) + seed_entry;
+}
+
+JitProgram::~JitProgram() {
+  if (buffer) munmap(buffer, buffer_size);
+}
+
+void JitProgram::Run(string_view s, bool match_begin, bool match_end,
+                     MatchResult &result) const {
+  NativeFunc step_func = reinterpret_cast<NativeFunc>(step);
+  NativeFunc seed_func = reinterpret_cast<NativeFunc>(seed);
+
+  vector<JitThread> lists(2 * num_states);
+  vector<uint32_t> mark(num_states, 0);
+  JitState state = {};
+  state.clist = lists.data();
+  state.nlist = lists.data() + num_states;
+  state.mark = mark.data();
+  state.generation = 1;
+  state.min_end = match_end ? s.size() : 0;
+
+  seed_func(&state, 0, 0);
+  std::swap(state.clist, state.nlist);
+  state.ccount = state.ncount;
+
+  for (unsigned int idx = 0; idx < s.size(); ++idx) {
+    // No thread can produce a better match.
+    if (state.ccount == 0 && (match_begin || state.success)) break;
+
+    ++state.generation;
+    state.ncount = 0;
+    step_func(&state, static_cast<signed char>(s[idx]), idx + 1);
+    // Threads started later can't beat a match found already.
+    if (!match_begin && !state.success) seed_func(&state, 0, idx + 1);
+    std::swap(state.clist, state.nlist);
+    state.ccount = state.ncount;
+  }
+
+  result.success = state.success;
+  result.begin = state.begin;
+  result.end = state.end;
+  result.input = s.data();
+  result.spans.clear();
+}
+
+JitPtr CompileJit(const Program &program) {
+  Compiler compiler(program);
+  if (!compiler.Compile()) return nullptr;
+
+  auto &code = compiler.Code();
+  try {
+    return JitPtr(new JitProgram(code.data(), code.size(),
+                                 compiler.StepEntry(), compiler.SeedEntry(),
+                                 program.size(), compiler.HasCapture()));
+  } catch (const std::runtime_error &) {
+    return nullptr;
+  }
+}
+
+};  // namespace Azuki
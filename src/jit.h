@@ -0,0 +1,55 @@
+#ifndef __AZUKI_JIT__
+#define __AZUKI_JIT__
+
+#include "common.h"
+#include "instruction.h"
+
+namespace Azuki {
+
+struct MatchResult;  // forward declaration
+
+// The JitProgram class holds native x86-64 code translated from a program.
+// Every consuming instruction becomes a block of native code that tests the
+// current character and appends the threads it reaches to the next thread
+// list, so a whole step of the lock-step simulation runs without going back
+// to the interpreter. Control instructions (SPLIT, JMP, SAVE) are resolved at
+// compile time into the list of blocks each block jumps to.
+// Use CompileJit below instead of the constructor.
+class JitProgram {
+ public:
+  JitProgram(const unsigned char *code, size_t code_size, size_t step_entry,
+             size_t seed_entry, unsigned int num_states, bool has_capture);
+  ~JitProgram();
+
+  JitProgram(const JitProgram &) = delete;
+  JitProgram &operator=(const JitProgram &) = delete;
+
+  // Return true if the program has SAVE instructions. Native code doesn't
+  // track capture groups, so such runs must fall back to the interpreter.
+  bool HasCapture() const { return has_capture; }
+
+  // Run native code on input string s and fill begin and end of the leftmost
+  // longest match in result. Capture groups are not saved.
+  void Run(string_view s, bool match_begin, bool match_end,
+           MatchResult &result) const;
+
+ private:
+  void *buffer;               // executable memory mapped with mmap
+  size_t buffer_size;         // size of mapped memory
+  void *step, *seed;          // entries of the native functions
+  unsigned int num_states;    // maximum number of threads in a thread list
+  bool has_capture;           // if true, the program has SAVE instructions
+};
+
+typedef shared_ptr<JitProgram> JitPtr;
+
+// Translate program into native x86-64 code. Return nullptr if the program
+// contains instructions the JIT doesn't support (CHECK, INCR and SET), or if
+// executable memory can't be allocated.
+// Example:
+//    JitPtr jit = CompileJit(CompileRegexp(ParseRegexp("a+b")));
+JitPtr CompileJit(const Program &program);
+
+};  // namespace Azuki
+
+#endif  // __AZUKI_JIT__
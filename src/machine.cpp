@@ -1,27 +1,442 @@
-#include <cctype>
+#include <algorithm>
+#include <cstdio>
+#include <deque>
 #include <iostream>
+#include <mutex>
+#include <sstream>
 #include "machine.h"
+#ifdef AZUKI_ENABLE_JIT
+#include "jit.h"
+#endif
+
+// Update stats only if they are enabled at build time, and requested by the
+// caller of Run.
+#ifdef AZUKI_ENABLE_STATS
+#define UPDATE_STATS(stats, statement) \
+  if (stats) stats->statement
+#else
+#define UPDATE_STATS(stats, statement)
+#endif
 
 namespace Azuki {
 
 namespace {
 
-void PopulateMatchResult(const Thread::Status &ts, MatchResult &ms) {
+// Maximum number of instructions of programs with expanded counters.
+const unsigned int kMaxExpandedSize = 1 << 16;
+
+// Guards counts added to the profile of any machine. Only runs while
+// profiling take it, once when they finish.
+std::mutex profile_mutex;
+
+void PopulateMatchResult(const Thread::Status &ts, const char *input,
+                         MatchResult &ms) {
   ms.success = true;
   ms.begin = ts.begin;
   ms.end = ts.end;
-  vector<string> temp;
-  for (unsigned i = 0; i < ts.saved.size(); i += 2)
-    temp.push_back(string(ts.saved[i], ts.saved[i + 1]));
-  ms.capture = std::move(temp);
+  ms.input = input;
+  // Better matches are found again and again, so only indices are saved.
+  // Spans are sized to the groups of the program once per run, and slots
+  // of a thread only grow up to the last group it saved.
+  for (unsigned i = 0; i < ms.spans.size(); ++i) {
+    const char *begin = 2 * i + 1 < ts.saved.size() ? ts.saved[2 * i] : nullptr;
+    const char *end = begin ? ts.saved[2 * i + 1] : nullptr;
+    if (begin && end)
+      ms.spans[i] = std::make_pair(begin - input, end - input);
+    else
+      ms.spans[i] = std::make_pair(UINT_MAX, UINT_MAX);
+  }
+}
+
+// Return the estimated bytes of a thread running program.
+unsigned long ThreadSize(const Program &program) {
+  unsigned long slots = 0, counters = 0;
+  for (auto &instr : program) {
+    if (instr->opcode == SAVE)
+      slots = std::max<unsigned long>(slots, instr->save_idx + 1);
+    else if (instr->opcode == SET)
+      counters = std::max<unsigned long>(counters, instr->rpctr_idx + 1);
+  }
+  // Shared pointers take about two more pointers for the control block.
+  return sizeof(Thread) + 2 * sizeof(void *) + slots * sizeof(const char *) +
+         counters * sizeof(int);
+}
+
+// Return true if the threads run so far exceed budget.
+bool ExceedBudget(const MatchBudget &budget, unsigned long steps,
+                  unsigned long threads, unsigned long thread_size) {
+  return (budget.max_steps && steps > budget.max_steps) ||
+         (budget.max_threads && threads > budget.max_threads) ||
+         (budget.max_memory && threads * thread_size > budget.max_memory);
+}
+
+bool IsDotStar(RegexpPtr rp) {
+  return rp->type == STAR && !rp->lazy && rp->left->type == DOT;
+}
+
+// Return true if rp has a lazy repetition.
+bool HasLazy(RegexpPtr rp) {
+  if (!rp) return false;
+  return rp->lazy || HasLazy(rp->left) || HasLazy(rp->right);
+}
+
+// Return true if rp has a capture group.
+bool HasParen(RegexpPtr rp) {
+  if (!rp) return false;
+  return rp->type == PAREN || HasParen(rp->left) || HasParen(rp->right);
+}
+
+// Return the first (or the last if last is true) item of a concatenation.
+RegexpPtr EdgeItem(RegexpPtr rp, bool last) {
+  while (rp->type == CAT) rp = last ? rp->right : rp->left;
+  return rp;
+}
+
+// Return the concatenation without its first (or last) item.
+RegexpPtr RemoveEdgeItem(RegexpPtr rp, bool last) {
+  RegexpPtr &inner = last ? rp->right : rp->left;
+  if (inner->type != CAT) return last ? rp->left : rp->right;
+  RegexpPtr rest = RemoveEdgeItem(inner, last);
+  return last ? CreateCatRegexp(rp->left, rest)
+              : CreateCatRegexp(rest, rp->right);
+}
+
+// Return the characters which every match of program begins with.
+string LiteralPrefix(const Program &program) {
+  string prefix;
+  for (auto &instr : program) {
+    if (instr->opcode == CHAR && !instr->fold)
+      prefix += instr->c;
+    else if (instr->opcode != SAVE)
+      break;
+  }
+  return prefix;
+}
+
+const char *kEngineNames[] = {"INTERPRETER", "JIT", "TWO_PHASE", "ONE_PASS",
+                              "BIT_PARALLEL"};
+
+// Return the number of SAVE slots in program.
+unsigned int CountSaves(const Program &program) {
+  unsigned int count = 0;
+  for (auto &instr : program) {
+    if (instr->opcode == SAVE && count <= instr->save_idx)
+      count = instr->save_idx + 1;
+  }
+  return count;
+}
+
+// Return n shortened for reading, like "950", "40.3K" or "1.2M".
+string FormatCount(unsigned long n) {
+  if (n < 1000) return std::to_string(n);
+  const char units[] = "KMGT";
+  double value = n;
+  int unit = -1;
+  while (value >= 1000 && unit < 3) {
+    value /= 1000;
+    ++unit;
+  }
+  char s[32];
+  snprintf(s, sizeof(s), "%.1f%c", value, units[unit]);
+  return s;
 }
 
 };  // namespace
 
-MatchResult::MatchResult() : success(false), begin(0), end(0) {}
+size_t CaptureGroups::size() const { return ms->spans.size(); }
+
+string_view CaptureGroups::View(size_t i) const {
+  auto &span = ms->spans[i];
+  if (span.first == UINT_MAX) return string_view();
+  return string_view(ms->input + span.first, span.second - span.first);
+}
+
+CaptureGroups::const_iterator CaptureGroups::begin() const {
+  return const_iterator(*this, 0);
+}
+
+CaptureGroups::const_iterator CaptureGroups::end() const {
+  return const_iterator(*this, size());
+}
+
+CaptureGroups::operator vector<string>() const {
+  vector<string> groups;
+  for (size_t i = 0; i < size(); ++i) groups.push_back((*this)[i]);
+  return groups;
+}
+
+bool operator==(const CaptureGroups &a, const CaptureGroups &b) {
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (a.View(i) != b.View(i)) return false;
+  }
+  return true;
+}
+
+bool operator==(const CaptureGroups &groups, const vector<string> &v) {
+  if (groups.size() != v.size()) return false;
+  for (size_t i = 0; i < v.size(); ++i) {
+    if (groups.View(i) != v[i]) return false;
+  }
+  return true;
+}
+
+MatchResult::MatchResult()
+    : success(false),
+      begin(0),
+      end(0),
+      input(nullptr),
+      capture(*this),
+      budget_exceeded(false) {}
+
+// capture refers to its own MatchResult, so it is never copied.
+MatchResult::MatchResult(const MatchResult &other)
+    : success(other.success),
+      begin(other.begin),
+      end(other.end),
+      spans(other.spans),
+      input(other.input),
+      capture(*this),
+      budget_exceeded(other.budget_exceeded) {}
+
+MatchResult::MatchResult(MatchResult &&other)
+    : success(other.success),
+      begin(other.begin),
+      end(other.end),
+      spans(std::move(other.spans)),
+      input(other.input),
+      capture(*this),
+      budget_exceeded(other.budget_exceeded) {}
+
+MatchResult &MatchResult::operator=(const MatchResult &other) {
+  success = other.success;
+  begin = other.begin;
+  end = other.end;
+  spans = other.spans;
+  input = other.input;
+  budget_exceeded = other.budget_exceeded;
+  return *this;
+}
+
+MatchResult &MatchResult::operator=(MatchResult &&other) {
+  success = other.success;
+  begin = other.begin;
+  end = other.end;
+  spans = std::move(other.spans);
+  input = other.input;
+  budget_exceeded = other.budget_exceeded;
+  return *this;
+}
+
+void ShiftMatchResult(MatchResult &ms, unsigned int offset) {
+  ms.begin += offset;
+  ms.end += offset;
+  // Indices are relative to the input, so it begins offset characters
+  // earlier.
+  if (ms.input) ms.input -= offset;
+  for (auto &span : ms.spans) {
+    if (span.first == UINT_MAX) continue;
+    span.first += offset;
+    span.second += offset;
+  }
+}
+
+MatchPlan::MatchPlan()
+    : first_bytes(std::bitset<256>().set()),
+      existence(INTERPRETER),
+      anchored(INTERPRETER),
+      search(INTERPRETER),
+      capture(INTERPRETER) {}
+
+void PrintProgram(const Program &program, const MatchProfile &profile,
+                  std::ostream &os) {
+  auto count = [](const vector<unsigned long> &counts, unsigned int idx) {
+    return idx < counts.size() ? counts[idx] : 0UL;
+  };
+  unsigned long total = 0;
+  for (auto n : profile.executions) total += n;
+  vector<string> lines;
+  size_t width = 0;
+  for (auto &instr : program) {
+    lines.push_back(instr->str());
+    width = std::max(width, lines.back().size());
+  }
+
+  for (unsigned int idx = 0; idx < program.size(); ++idx) {
+    auto &instr = program[idx];
+    unsigned long executions = count(profile.executions, idx);
+    os << lines[idx] << string(width - lines[idx].size() + 2, ' ') << "-- "
+       << FormatCount(executions) << " exec, "
+       << (total ? (executions * 100 + total / 2) / total : 0) << "%";
+    if (instr->opcode == SPLIT)
+      os << ", " << FormatCount(count(profile.spawns, idx)) << " spawns";
+    if (idx < profile.sources.size() && profile.sources[idx])
+      os << "  <- " << FormatRegexp(profile.sources[idx]);
+    os << std::endl;
+  }
+}
+
+string MatchPlan::str() const {
+  std::stringstream ss;
+  ss << "prefix \"" << prefix << "\", first bytes " << first_bytes.str()
+     << ", existence " << kEngineNames[existence]
+     << ", anchored " << kEngineNames[anchored] << ", search "
+     << kEngineNames[search] << ", capture " << kEngineNames[capture];
+  return ss.str();
+}
+
+MatchBudget::MatchBudget() : max_threads(0), max_steps(0), max_memory(0) {}
+
+CompiledRegexp::CompiledRegexp()
+    : match_begin(false),
+      match_end(false),
+      dot_star_begin(false),
+      dot_star_end(false),
+      kind(LEFTMOST_LONGEST) {}
+
+CompiledRegexp CreateCompiledRegexp(RegexpPtr rp,
+                                    unsigned int max_program_size,
+                                    MatchKind kind, bool keep_sources) {
+  CompiledRegexp cr;
+  // Lazy repetitions only prefer fewer times by the priority of SPLIT.
+  cr.kind = HasLazy(rp) ? LEFTMOST_FIRST : kind;
+  // Threads would carry ".*" through every character. Both edges decide what
+  // capture groups hold: the leading ".*" which occurrence, as it matches as
+  // much as it can first, and the trailing ".*" how long the groups before it
+  // are, as the longest match ties on its end.
+  if (rp->type == CAT && IsDotStar(EdgeItem(rp, true)) && !HasParen(rp)) {
+    rp = RemoveEdgeItem(rp, true);
+    cr.dot_star_end = true;
+    if (rp->type == CAT && IsDotStar(EdgeItem(rp, false))) {
+      rp = RemoveEdgeItem(rp, false);
+      cr.dot_star_begin = true;
+    }
+  }
+  cr.program = CompileRegexp(rp, max_program_size,
+                             keep_sources ? &cr.sources : nullptr);
+  // Expanded counters can make programs much larger. Keep running the
+  // program with counters if they are too large.
+  unsigned int max_size = std::min(max_program_size, kMaxExpandedSize);
+  try {
+    cr.expanded = CompileRegexp(ExpandRegexp(rp), max_size);
+    cr.reversed = CompileReversedRegexp(rp, max_size);
+  } catch (const std::runtime_error &) {
+    cr.expanded.clear();
+    cr.reversed.clear();
+  }
+  cr.engines =
+      std::make_shared<const CompiledEngines>(CreateCompiledEngines(cr));
+  return cr;
+}
+
+CompiledEngines CreateCompiledEngines(const CompiledRegexp &cr) {
+  CompiledEngines engines{LiteralPrefix(cr.program), FirstBytes(cr.program),
+                          nullptr, nullptr};
+  if (cr.expanded.empty() || cr.reversed.empty()) return engines;
+  engines.bitparallel = CreateBitParallel(cr.expanded);
+  // Capture groups repeated by counters are numbered again in each copy, so
+  // the expanded program only fits if it has the same SAVE slots.
+  if (CountSaves(cr.expanded) == CountSaves(cr.program))
+    engines.onepass = CreateOnePass(cr.expanded);
+  return engines;
+}
+
+MatchStats::MatchStats()
+    : runs(),
+      instructions(0),
+      threads(0),
+      peak_threads(0),
+      bytes_scanned(0),
+      bytes_skipped(0),
+      engine(INTERPRETER) {}
+
+MatchStats &MatchStats::operator+=(const MatchStats &other) {
+  for (int i = 0; i < NUM_ENGINES; ++i) runs[i] += other.runs[i];
+  instructions += other.instructions;
+  threads += other.threads;
+  peak_threads = std::max(peak_threads, other.peak_threads);
+  bytes_scanned += other.bytes_scanned;
+  bytes_skipped += other.bytes_skipped;
+  engine = other.engine;
+  return *this;
+}
+
+// The RunState struct holds what a run of the interpreter changes, so that
+// runs of the same machine don't share anything but the machine.
+struct RunState {
+  RunState(const Machine &machine, string_view s, bool save_capture,
+           MatchStats *stats);
+  // Add the counts of the run to the profile of the machine.
+  ~RunState();
+
+  // Add a thread to run in current iteration.
+  // With LEFTMOST_FIRST, threads added by a step run before other threads
+  // (see Machine::Interpret), so threads run in priority order.
+  void AddReadyThread(ThreadPtr tp) {
+    if (machine.kind == LEFTMOST_FIRST)
+      added.push_back(tp);
+    else
+      ready.push_back(tp);
+  }
+
+  // Update match result (called only when the thread successfully matches).
+  void UpdateResult(const Thread::Status &ts);
+
+  const Machine &machine;
+  std::deque<ThreadPtr> ready;  // threads to run in current iteration
+  vector<ThreadPtr> added;      // threads added by current step
+  MatchResult result;           // match result
+  bool matched;                 // a thread matched in current step
+  const char *input;            // input of the interpreter
+  MatchStats *stats;            // stats of the run (optional)
+  MatchProfile *profile;        // counts of the run while profiling
+  MatchProfile counts;
+};
+
+RunState::RunState(const Machine &machine, string_view s, bool save_capture,
+                   MatchStats *stats)
+    : machine(machine),
+      matched(false),
+      input(s.data()),
+      stats(stats),
+      profile(machine.profiling ? &counts : nullptr) {
+  result.spans.assign(save_capture ? machine.num_groups : 0,
+                      std::make_pair(UINT_MAX, UINT_MAX));
+  if (!profile) return;
+  counts.executions.assign(machine.program.size(), 0);
+  counts.spawns.assign(machine.program.size(), 0);
+}
+
+RunState::~RunState() {
+  if (!profile) return;
+  std::lock_guard<std::mutex> lock(profile_mutex);
+  MatchProfile &total = machine.profile;
+  for (size_t i = 0; i < total.executions.size(); ++i) {
+    total.executions[i] += counts.executions[i];
+    total.spawns[i] += counts.spawns[i];
+  }
+}
+
+void RunState::UpdateResult(const Thread::Status &ts) {
+  matched = true;
+  // With LEFTMOST_FIRST, threads of lower priority are dropped on a match, so
+  // a later match is always better.
+  if (!result.success || machine.kind == LEFTMOST_FIRST) {
+    PopulateMatchResult(ts, input, result);
+  } else {
+    if (result.begin < ts.begin) {
+      return;
+    } else if (result.begin > ts.begin) {
+      PopulateMatchResult(ts, input, result);
+      return;
+    } else {
+      if (result.end < ts.end) PopulateMatchResult(ts, input, result);
+    }
+  }
+}
 
-Thread::Thread(const Machine &machine, int pc, unsigned int begin)
-    : machine(machine), pc(pc) {
+Thread::Thread(RunState &run, int pc, unsigned int begin)
+    : run(run), pc(pc) {
   status.begin = begin;
   status.end = begin;
 }
@@ -32,55 +447,55 @@ Thread *Thread::Split(int other_pc) {
   return tp;
 }
 
-bool Thread::RunOneStep(StringPtr sp, bool save_capture) {
-  InstrPtr instr = machine.FetchInstruction(pc++);
+bool Thread::RunOneStep(const char *sp, bool save_capture) {
+  InstrPtr instr = run.machine.FetchInstruction(pc++);
   Opcode opcode = instr->opcode;
+  UPDATE_STATS(run.stats, instructions++);
+  if (run.profile) ++run.profile->executions[pc - 1];
+
+  if (instr->ConsumeCharacter()) {
+    ++status.end;
+    return instr->Accepts(*sp);
+  }
 
-  if (instr->ConsumeCharacter()) ++status.end;
-
-  if (opcode == ANY) {
-    return true;
-  } else if (opcode == ANY_WORD) {
-    return isalnum(*sp) || (*sp == '_');
-  } else if (opcode == ANY_DIGIT) {
-    return isdigit(*sp);
-  } else if (opcode == ANY_SPACE) {
-    return isspace(*sp);
-  } else if (opcode == CHAR) {
-    return (instr->c == *sp);
-  } else if (opcode == CHECK) {
+  if (opcode == CHECK) {
+    // A jump may skip the SET of a loaded program, then the counter is 0.
+    if (status.repeated.size() <= instr->rpctr_idx)
+      status.repeated.resize(instr->rpctr_idx + 1);
     if (status.repeated[instr->rpctr_idx] >= instr->low_times &&
         status.repeated[instr->rpctr_idx] <= instr->high_times)
-      machine.AddReadyThread(shared_from_this());
+      run.AddReadyThread(shared_from_this());
   } else if (opcode == INCR) {
+    if (status.repeated.size() <= instr->rpctr_idx)
+      status.repeated.resize(instr->rpctr_idx + 1);
     ++status.repeated[instr->rpctr_idx];
-    machine.AddReadyThread(shared_from_this());
+    run.AddReadyThread(shared_from_this());
   } else if (opcode == JMP) {
     this->pc = instr->dst;
-    machine.AddReadyThread(shared_from_this());
+    run.AddReadyThread(shared_from_this());
   } else if (opcode == MATCH) {
-    machine.UpdateResult(status);
-  } else if (opcode == RANGE) {
-    return (*sp) >= instr->low_ch && (*sp) <= instr->high_ch;
+    run.UpdateResult(status);
   } else if (opcode == SAVE) {
     if (save_capture) {
       if (status.saved.size() <= instr->save_idx)
         status.saved.resize(instr->save_idx + 1);
       status.saved[instr->save_idx] = sp;
     }
-    machine.AddReadyThread(shared_from_this());
+    run.AddReadyThread(shared_from_this());
   } else if (opcode == SET) {
     if (status.repeated.size() <= instr->rpctr_idx)
       status.repeated.resize(instr->rpctr_idx + 1);
     status.repeated[instr->rpctr_idx] = instr->value;
-    machine.AddReadyThread(shared_from_this());
+    run.AddReadyThread(shared_from_this());
   } else if (opcode == SPLIT) {
+    UPDATE_STATS(run.stats, threads++);
+    if (run.profile) ++run.profile->spawns[pc - 1];
     if (instr->greedy) {
-      machine.AddReadyThread(ThreadPtr(this->Split(instr->dst)));
-      machine.AddReadyThread(shared_from_this());
+      run.AddReadyThread(ThreadPtr(this->Split(instr->dst)));
+      run.AddReadyThread(shared_from_this());
     } else {
-      machine.AddReadyThread(shared_from_this());
-      machine.AddReadyThread(ThreadPtr(this->Split(instr->dst)));
+      run.AddReadyThread(shared_from_this());
+      run.AddReadyThread(ThreadPtr(this->Split(instr->dst)));
     }
   } else {
     throw std::runtime_error("Unexpected instruction opcode.");
@@ -89,51 +504,450 @@ bool Thread::RunOneStep(StringPtr sp, bool save_capture) {
 }
 
 Machine::Machine(const Program &program)
-    : program(program), match_begin(false), match_end(false) {}
+    : program(program),
+      num_groups(CountSaves(program) / 2),
+      match_begin(false),
+      match_end(false),
+      dot_star_begin(false),
+      dot_star_end(false),
+      kind(LEFTMOST_LONGEST),
+      profiling(false) {}
 
-MatchResult Machine::Run(const string &s, bool save_capture) const {
-  ready = std::queue<ThreadPtr>();
-  result.success = false;
+Machine::Machine(const CompiledRegexp &cr)
+    : program(cr.program),
+      num_groups(CountSaves(program) / 2),
+      match_begin(cr.match_begin),
+      match_end(cr.match_end),
+      dot_star_begin(cr.dot_star_begin),
+      dot_star_end(cr.dot_star_end),
+      kind(cr.kind),
+      profiling(false),
+      sources(cr.sources) {
+  auto engines = cr.engines;
+  if (!engines)
+    engines =
+        std::make_shared<const CompiledEngines>(CreateCompiledEngines(cr));
+  plan.prefix = engines->prefix;
+  plan.first_bytes = engines->first_bytes;
+  if (cr.expanded.empty() || cr.reversed.empty()) return;
+  bitparallel = engines->bitparallel;
+  onepass = engines->onepass;
+  forward = CreateDfa(cr.expanded);
+  reverse = CreateDfa(cr.reversed);
+  if (!forward || !reverse) {
+    forward.reset();
+    reverse.reset();
+  }
+  PlanEngines();
+}
 
-  if (match_begin) ready.push(ThreadPtr(new Thread(*this, 0, 0)));
+Machine::Machine(RegexpPtr rp, unsigned int max_program_size)
+    : Machine(CreateCompiledRegexp(rp, max_program_size)) {}
+
+
+void Machine::PlanEngines() {
+  plan.search = jit ? JIT : forward ? TWO_PHASE : INTERPRETER;
+  // The JIT doesn't save capture groups.
+  plan.capture = jit && NumGroups() == 0 ? JIT
+                 : forward               ? TWO_PHASE
+                                         : INTERPRETER;
+  plan.anchored = onepass ? ONE_PASS : plan.search;
+  plan.existence = bitparallel ? BIT_PARALLEL : plan.search;
+}
+
+void Machine::SetPlan(const MatchPlan &p) {
+  auto available = [&](Engine engine) {
+    switch (engine) {
+      case INTERPRETER:
+        return true;
+      case JIT:
+        return jit != nullptr;
+      case TWO_PHASE:
+        return forward != nullptr;
+      case ONE_PASS:
+        return onepass != nullptr;
+      default:
+        return false;
+    }
+  };
+  if (!(p.existence == BIT_PARALLEL ? bitparallel != nullptr
+                                    : available(p.existence)) ||
+      !available(p.anchored) || !available(p.search) ||
+      !available(p.capture))
+    throw std::runtime_error("Engine is not available in the machine.");
+  if (LiteralPrefix(program).compare(0, p.prefix.size(), p.prefix) != 0)
+    throw std::runtime_error("Not a prefix of every match.");
+  if ((FirstBytes(program).Bytes() & ~p.first_bytes.Bytes()).any())
+    throw std::runtime_error("Missing first bytes of some match.");
+  plan = p;
+}
+
+void Machine::EnableProfiling(bool b) {
+  profiling = b;
+  if (!b) return;
+  profile.executions.assign(program.size(), 0);
+  profile.spawns.assign(program.size(), 0);
+  profile.sources = sources;
+}
+
+MatchProfile Machine::GetProfile() const {
+  std::lock_guard<std::mutex> lock(profile_mutex);
+  return profile;
+}
+
+bool Machine::EnableJit() {
+#ifdef AZUKI_ENABLE_JIT
+  if (!jit) jit = CompileJit(program);
+  if (jit) PlanEngines();
+  return jit != nullptr;
+#else
+  return false;
+#endif
+}
+
+MatchResult Machine::Run(string_view s, bool save_capture,
+                         MatchStats &stats) const {
+  MatchStats current;
+  MatchResult ms = ExtendMatch(
+      s, Execute(s, save_capture, match_begin && !dot_star_begin,
+                 match_end && !dot_star_end, &current));
+  stats += current;
+  return ms;
+}
+
+MatchResult Machine::Run(string_view s, bool save_capture) const {
+  return ExtendMatch(s, Execute(s, save_capture, match_begin && !dot_star_begin,
+                                match_end && !dot_star_end, nullptr));
+}
+
+MatchResult Machine::RunAnchored(string_view s, bool match_end,
+                                 bool save_capture) const {
+  return ExtendMatch(
+      s, Execute(s, save_capture, !dot_star_begin,
+                 (match_end || this->match_end) && !dot_star_end, nullptr));
+}
+
+MatchResult Machine::ExtendMatch(string_view s, MatchResult ms) const {
+  if (!ms.success) return ms;
+  if (dot_star_begin) ms.begin = 0;
+  if (dot_star_end) ms.end = s.size();
+  return ms;
+}
+
+MatchResult Machine::RunParallel(string_view s, unsigned int num_threads,
+                                 bool save_capture) const {
+  bool begin = match_begin && !dot_star_begin;
+  bool end_of_input = match_end && !dot_star_end;
+  if (!forward || begin || num_threads <= 1 || profiling)
+    return Run(s, save_capture);
+
+  // Segments are made after the first candidate, and scans from the start
+  // state skip to the next one.
+  size_t pos = Skip(s, 0, nullptr);
+  if (pos == string_view::npos) return MatchResult();
+  string_view rest = s.substr(pos);
+  std::function<size_t(size_t)> skip;
+  if (!plan.prefix.empty())
+    skip = [&](size_t from) { return rest.find(plan.prefix, from); };
+  else if (!plan.first_bytes.Full())
+    skip = [&](size_t from) { return plan.first_bytes.Find(rest, from); };
+
+  MatchResult ms;
+  if (!forward->SearchParallel(rest, num_threads, end_of_input, kind, ms.end,
+                               nullptr, skip))
+    return ms;
+  reverse->SearchBackward(rest, ms.end, ms.begin);
+  ms.success = true;
+  if (save_capture) {
+    // Track capture groups only inside the match.
+    unsigned int offset = ms.begin;
+    ms = Execute(rest.substr(offset, ms.end - offset), true, true, true,
+                 nullptr);
+    if (!ms.success) return ms;
+    ShiftMatchResult(ms, offset);
+  }
+  ShiftMatchResult(ms, pos);
+  return ExtendMatch(s, ms);
+}
+
+bool Machine::HasMatch(string_view s) const {
+  bool begin = match_begin && !dot_star_begin;
+  bool end_of_input = match_end && !dot_star_end;
+  if (plan.existence != BIT_PARALLEL || profiling)
+    return Execute(s, false, begin, end_of_input, nullptr).success;
+
+  if (!begin) {
+    size_t pos = Skip(s, 0, nullptr);
+    if (pos == string_view::npos) return false;
+    s = s.substr(pos);
+  }
+  if (!begin) return bitparallel->Search(s, end_of_input);
+  unsigned int end = 0;
+  return bitparallel->SearchAnchored(s, end_of_input, end);
+}
+
+unsigned long Machine::Count(string_view s) const {
+  bool use_jit = false;
+#ifdef AZUKI_ENABLE_JIT
+  use_jit = jit && kind == LEFTMOST_LONGEST;
+#endif
+
+  unsigned long count = 0;
+  bool begin = match_begin && !dot_star_begin;
+  bool end_of_input = match_end && !dot_star_end;
+  // Whether a match can be empty, found once it matters. Then the Dfa only
+  // knows where a match ends, and the reverse Dfa finds where it begins.
+  int nullable = -1;
+  // An empty match may end the input, so pos goes up to s.size(). A match
+  // which is empty moves pos past its own index, so none is counted twice.
+  for (unsigned int pos = 0; pos <= s.size();) {
+    unsigned int start = pos;
+    if (!begin) {
+      size_t found = Skip(s, pos, nullptr);
+      if (found == string_view::npos) break;
+      pos = found;
+    }
+    string_view rest = s.substr(pos);
+    unsigned int match_begin_idx = 0, match_end_idx = 0;
+    if (forward && !use_jit && !profiling) {
+      if (!forward->SearchForward(rest, begin, end_of_input, kind,
+                                  match_end_idx))
+        break;
+      match_begin_idx = match_end_idx;
+      if (match_end_idx > 0 && nullable < 0) {
+        unsigned int empty_end = 0;
+        nullable = forward->SearchForward(string_view(), true, false, kind,
+                                          empty_end);
+      }
+      if (match_end_idx > 0 && (begin || !nullable))
+        match_begin_idx = 0;
+      else if (match_end_idx > 0)
+        reverse->SearchBackward(rest, match_end_idx, match_begin_idx);
+    } else {
+      MatchResult ms = Execute(rest, false, begin, end_of_input, nullptr);
+      if (!ms.success) break;
+      match_begin_idx = ms.begin;
+      match_end_idx = ms.end;
+    }
+    ++count;
+    if (match_begin) break;
+    // A removed leading ".*" begins where the search did, and a removed
+    // trailing one ends at the end of s.
+    unsigned int first = dot_star_begin ? start : pos + match_begin_idx;
+    unsigned int last = dot_star_end ? s.size() : pos + match_end_idx;
+    pos = last > first ? last : last + 1;
+  }
+  return count;
+}
+
+void Machine::ForEachMatch(
+    string_view s, bool save_capture,
+    const std::function<bool(const MatchResult &)> &f) const {
+  bool begin = match_begin && !dot_star_begin;
+  bool end_of_input = match_end && !dot_star_end;
+  // Same as Count, but every match is located and reported.
+  for (unsigned int pos = 0; pos <= s.size();) {
+    MatchResult ms =
+        Execute(s.substr(pos), save_capture, begin, end_of_input, nullptr);
+    if (!ms.success) break;
+    ShiftMatchResult(ms, pos);
+    // A removed leading ".*" begins where the search did, and a removed
+    // trailing one ends at the end of s.
+    if (dot_star_begin) ms.begin = pos;
+    if (dot_star_end) ms.end = s.size();
+    if (!f(ms) || match_begin) break;
+    pos = ms.end > ms.begin ? ms.end : ms.end + 1;
+  }
+}
+
+Engine Machine::Select(Engine engine, bool save_capture,
+                       bool match_begin) const {
+  if (profiling) return INTERPRETER;
+  if (engine == JIT) {
+    bool runnable = false;
+#ifdef AZUKI_ENABLE_JIT
+    runnable = jit && kind == LEFTMOST_LONGEST &&
+               !(save_capture && jit->HasCapture());
+#else
+    (void)save_capture;
+#endif
+    if (!runnable) engine = ONE_PASS;
+  }
+  if (engine == ONE_PASS && !(onepass && match_begin)) engine = TWO_PHASE;
+  if (engine == TWO_PHASE && !forward) engine = INTERPRETER;
+  return engine;
+}
+
+size_t Machine::Skip(string_view s, size_t pos, MatchStats *stats) const {
+  size_t found = pos;
+  if (!plan.prefix.empty())
+    found = s.find(plan.prefix, pos);
+  else if (!plan.first_bytes.Full())
+    found = plan.first_bytes.Find(s, pos);
+  UPDATE_STATS(stats, bytes_skipped += std::min(found, s.size()) - pos);
+  return found;
+}
+
+MatchResult Machine::Execute(string_view s, bool save_capture,
+                             bool match_begin, bool match_end,
+                             MatchStats *stats) const {
+  if (!match_begin) {
+    size_t pos = Skip(s, 0, stats);
+    if (pos == string_view::npos) return MatchResult();
+    // No match begins before pos.
+    if (pos > 0) {
+      MatchResult ms = Dispatch(s.substr(pos), save_capture, match_begin,
+                                match_end, stats);
+      if (ms.success) ShiftMatchResult(ms, pos);
+      return ms;
+    }
+  }
+  return Dispatch(s, save_capture, match_begin, match_end, stats);
+}
+
+MatchResult Machine::Dispatch(string_view s, bool save_capture,
+                              bool match_begin, bool match_end,
+                              MatchStats *stats) const {
+  unsigned long *scanned = nullptr;
+#ifdef AZUKI_ENABLE_STATS
+  if (stats) scanned = &stats->bytes_scanned;
+#endif
+
+  // BitParallel only finds where matches end. Anchored runs get the end of
+  // the longest match from it, and runs with match_end know it's s.size(), so
+  // the reverse Dfa finds the begin. Other runs don't use it, as the search
+  // engine would scan the input again up to the match.
+  if (plan.existence == BIT_PARALLEL && !save_capture && !profiling &&
+      (match_begin || (match_end && reverse))) {
+    UPDATE_STATS(stats, engine = BIT_PARALLEL);
+    UPDATE_STATS(stats, runs[BIT_PARALLEL]++);
+    MatchResult ms;
+    if (!match_begin) {
+      if (!bitparallel->Search(s, true, scanned)) return ms;
+      ms.end = s.size();
+      reverse->SearchBackward(s, ms.end, ms.begin, scanned);
+      ms.success = true;
+      return ms;
+    }
+    if (!bitparallel->SearchAnchored(s, match_end, ms.end, scanned))
+      return ms;
+    // The longest match is also the leftmost first one if it ends at
+    // s.size(). Otherwise the leftmost first match ends before it.
+    ms.success = true;
+    if (kind == LEFTMOST_LONGEST || match_end) return ms;
+    s = s.substr(0, ms.end);
+  }
+
+  Engine engine = match_begin    ? plan.anchored
+                  : save_capture ? plan.capture
+                                 : plan.search;
+  engine = Select(engine, save_capture, match_begin);
+#ifdef AZUKI_ENABLE_JIT
+  if (engine == JIT) {
+    UPDATE_STATS(stats, engine = JIT);
+    UPDATE_STATS(stats, runs[JIT]++);
+    UPDATE_STATS(stats, bytes_scanned += s.size());
+    MatchResult ms;
+    jit->Run(s, match_begin, match_end, ms);
+    return ms;
+  }
+#endif
+  if (engine == ONE_PASS) {
+    UPDATE_STATS(stats, engine = ONE_PASS);
+    UPDATE_STATS(stats, runs[ONE_PASS]++);
+    return onepass->Run(s, match_end, kind, save_capture, scanned);
+  }
+  if (engine == TWO_PHASE) {
+    UPDATE_STATS(stats, engine = TWO_PHASE);
+    UPDATE_STATS(stats, runs[TWO_PHASE]++);
+    MatchResult ms;
+    if (!forward->SearchForward(s, match_begin, match_end, kind, ms.end,
+                                scanned))
+      return ms;
+    reverse->SearchBackward(s, ms.end, ms.begin, scanned);
+    ms.success = true;
+    if (!save_capture) return ms;
+
+    // Track capture groups only inside the match.
+    unsigned int offset = ms.begin;
+    ms = Interpret(s.substr(offset, ms.end - offset), true, true, true,
+                   stats);
+    if (ms.budget_exceeded) return ms;
+    ShiftMatchResult(ms, offset);
+    return ms;
+  }
+  UPDATE_STATS(stats, engine = INTERPRETER);
+  UPDATE_STATS(stats, runs[INTERPRETER]++);
+  return Interpret(s, save_capture, match_begin, match_end, stats);
+}
+
+MatchResult Machine::Interpret(string_view s, bool save_capture,
+                               bool match_begin, bool match_end,
+                               MatchStats *stats) const {
+  RunState run(*this, s, save_capture, stats);
+  std::deque<ThreadPtr> &ready = run.ready;
+  vector<ThreadPtr> &added = run.added;
+  MatchResult &result = run.result;
+  UPDATE_STATS(stats, bytes_scanned += s.size());
+
+  bool first = kind == LEFTMOST_FIRST;
+  bool skip =
+      !match_begin && (!plan.prefix.empty() || !plan.first_bytes.Full());
+  bool limited = budget.max_threads || budget.max_steps || budget.max_memory;
+  unsigned long steps = 0, thread_size = limited ? ThreadSize(program) : 0;
+
+  if (match_begin) ready.push_back(ThreadPtr(new Thread(run, 0, 0)));
 
   // Need an extra character to finish ready threads.
   for (unsigned int idx = 0; idx <= s.size(); ++idx) {
-    auto sp = s.begin() + idx;
-    if (!match_begin) ready.push(ThreadPtr(new Thread(*this, 0, idx)));
+    // No match begins before the next candidate if no thread is alive.
+    if (skip && ready.empty()) {
+      size_t found = Skip(s, idx, stats);
+      if (found == string_view::npos) break;
+      idx = found;
+    }
+    const char *sp = s.data() + idx;
+    // Threads started later have the lowest priority, and can't beat a match
+    // with LEFTMOST_FIRST.
+    if (!match_begin && !(first && result.success))
+      ready.push_back(ThreadPtr(new Thread(run, 0, idx)));
 
-    std::queue<ThreadPtr> next;  // keep threads to run in next round
+    std::deque<ThreadPtr> next;  // keep threads to run in next round
     while (!ready.empty()) {
+      UPDATE_STATS(stats, peak_threads = std::max<unsigned long>(
+                              stats->peak_threads, ready.size()));
       auto tp = ready.front();
-      ready.pop();
+      ready.pop_front();
 
       // If the thread successfully consumes the character, we need to save it
       // for next round.
-      if (tp->RunOneStep(sp, save_capture)) next.push(tp);
-      if (result.success) {
-        if (match_end && idx != s.size()) {
+      run.matched = false;
+      if (tp->RunOneStep(sp, save_capture)) next.push_back(tp);
+      // Threads split from tp run next, in their priority order.
+      if (first) {
+        for (auto it = added.rbegin(); it != added.rend(); ++it)
+          ready.push_front(*it);
+        added.clear();
+      }
+      if (limited && ExceedBudget(budget, ++steps, ready.size() + next.size(),
+                                  thread_size)) {
+        ready.clear();
+        result.success = false;
+        result.budget_exceeded = true;
+        return result;
+      }
+      if (run.matched) {
+        if (match_end && idx != s.size())
           result.success = false;
-        }
+        else if (first)
+          ready.clear();  // threads of lower priority
       }
     }
     ready = std::move(next);
+    // No thread left, and no thread will be started.
+    if (ready.empty() && (match_begin || (first && result.success))) break;
   }
   return result;
 }
 
-void Machine::UpdateResult(const Thread::Status &ts) const {
-  if (!result.success) {
-    PopulateMatchResult(ts, result);
-  } else {
-    if (result.begin < ts.begin) {
-      return;
-    } else if (result.begin > ts.begin) {
-      PopulateMatchResult(ts, result);
-      return;
-    } else {
-      if (result.end < ts.end) PopulateMatchResult(ts, result);
-    }
-  }
-}
-
 };  // namespace Azuki
@@ -1,36 +1,234 @@
 #ifndef __AZUKI_MACHINE__
 #define __AZUKI_MACHINE__
 
-#include <queue>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include "bitparallel.h"
+#include "byteset.h"
 #include "common.h"
+#include "dfa.h"
 #include "instruction.h"
+#include "onepass.h"
 
 namespace Azuki {
 
-// The MatchResult struct holds results of regexp match.
+struct MatchResult;
+
+// The CaptureGroups class reads capture groups of a MatchResult like a
+// const vector<string>. Groups are only kept as spans of the searched input,
+// and substrings are copied when they are read, so the input must outlive the
+// MatchResult until then.
+// Example:
+//    MatchResult ms = machine.Run(s);
+//    for (auto &group : ms.capture) cout << group << endl;
+//    string_view first = ms.capture.View(0);
+class CaptureGroups {
+ public:
+  class const_iterator;
+  typedef const_iterator iterator;
+  typedef string value_type;
+
+  explicit CaptureGroups(const MatchResult &ms) : ms(&ms) {}
+
+  size_t size() const;
+  bool empty() const { return size() == 0; }
+
+  // Return capture group i as a view of the input, or an empty view if the
+  // group is not matched.
+  string_view View(size_t i) const;
+
+  // Return a copy of capture group i.
+  string operator[](size_t i) const { return string(View(i)); }
+
+  const_iterator begin() const;
+  const_iterator end() const;
+
+  // Copy all capture groups.
+  operator vector<string>() const;
+
+ private:
+  const MatchResult *ms;
+};
+
+// Iterate capture groups, copying each group when it is dereferenced.
+class CaptureGroups::const_iterator {
+ public:
+  typedef std::input_iterator_tag iterator_category;
+  typedef string value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef const string *pointer;
+  typedef const string &reference;
+
+  const_iterator(const CaptureGroups &groups, size_t i)
+      : groups(&groups), i(i) {}
+
+  const string &operator*() const { return group = (*groups)[i]; }
+  const string *operator->() const { return &**this; }
+  const_iterator &operator++() {
+    ++i;
+    return *this;
+  }
+  bool operator==(const const_iterator &other) const { return i == other.i; }
+  bool operator!=(const const_iterator &other) const { return i != other.i; }
+
+ private:
+  const CaptureGroups *groups;
+  size_t i;
+  mutable string group;
+};
+
+bool operator==(const CaptureGroups &a, const CaptureGroups &b);
+inline bool operator!=(const CaptureGroups &a, const CaptureGroups &b) {
+  return !(a == b);
+}
+bool operator==(const CaptureGroups &groups, const vector<string> &v);
+inline bool operator==(const vector<string> &v, const CaptureGroups &groups) {
+  return groups == v;
+}
+inline bool operator!=(const CaptureGroups &groups, const vector<string> &v) {
+  return !(groups == v);
+}
+inline bool operator!=(const vector<string> &v, const CaptureGroups &groups) {
+  return !(groups == v);
+}
+
+// The MatchResult struct holds results of regexp match. Engines only record
+// indices while they run, and capture groups are read from input afterwards.
 struct MatchResult {
   bool success;
   unsigned int begin, end;  // begin and end index of matched substring
-  vector<string> capture;   // capture groups
+  // Begin and end index of each capture group, or both UINT_MAX if the group
+  // is not matched (and its capture is empty). There is one span for each
+  // capture group of the program if capture groups are saved.
+  vector<pair<unsigned int, unsigned int>> spans;
+  const char *input;        // the searched input which indices refer to
+  CaptureGroups capture;    // capture groups, read from input on demand
+
+  bool budget_exceeded;     // run aborted as a MatchBudget is exceeded
 
   MatchResult();
+  MatchResult(const MatchResult &other);
+  MatchResult(MatchResult &&other);
+  MatchResult &operator=(const MatchResult &other);
+  MatchResult &operator=(MatchResult &&other);
+};
+
+// Add offset to all indices in ms, for a match found in a substring which
+// begins at offset.
+void ShiftMatchResult(MatchResult &ms, unsigned int offset);
+
+// The MatchBudget struct limits the work of a single Machine::Run, so that
+// patterns from untrusted sources can't take unbounded time or memory. A
+// limit of 0 means no limit.
+// Budgets are enforced by the threads of the virtual machine. Dfa, OnePass
+// and the JIT run in time linear to the input with bounded memory.
+struct MatchBudget {
+  unsigned long max_threads;  // live threads at any time
+  unsigned long max_steps;    // instructions executed by all threads
+  unsigned long max_memory;   // bytes of thread states at any time
+
+  MatchBudget();
+};
+
+// Engines which can run a match in Machine::Run.
+enum Engine {
+  INTERPRETER,   // threads of the virtual machine
+  JIT,           // native code
+  TWO_PHASE,     // Dfa, then threads inside the match
+  ONE_PASS,      // OnePass
+  BIT_PARALLEL,  // BitParallel
+  NUM_ENGINES
 };
 
-class Machine;  // forward declaration
+// The MatchStats struct holds execution statistics of Machine::Run. Stats of
+// several runs can be added up with operator+=.
+// Counters are only updated if Azuki is built with AZUKI_ENABLE_STATS (CMake
+// option of the same name), otherwise they stay zero.
+struct MatchStats {
+  unsigned long runs[NUM_ENGINES];  // number of runs by each engine
+  unsigned long instructions;       // instructions executed by threads
+  unsigned long threads;            // threads created by SPLIT
+  unsigned long peak_threads;       // peak size of the ready queue
+  unsigned long bytes_scanned;      // characters consumed by any engine
+  unsigned long bytes_skipped;      // characters skipped by prefilters
+  Engine engine;                    // engine of the last run
+
+  MatchStats();
+
+  MatchStats &operator+=(const MatchStats &other);
+};
+
+// The MatchProfile struct counts, for each instruction of the program of a
+// Machine, how often threads ran it and how many threads it split off, over
+// all runs since profiling was enabled (see Machine::EnableProfiling).
+// Example:
+//    machine.EnableProfiling();
+//    for (auto &s : input) machine.Run(s);
+//    PrintProgram(machine.GetProgram(), machine.GetProfile());
+struct MatchProfile {
+  vector<unsigned long> executions;  // steps of threads at each instruction
+  vector<unsigned long> spawns;      // threads created by each SPLIT
+  // Regexp node each instruction is compiled from, if the machine is compiled
+  // with them (see CreateCompiledRegexp), or empty.
+  vector<RegexpPtr> sources;
+};
+
+// Print the program like PrintProgram, with the executions of each
+// instruction, their share of all executions, threads it split off, and the
+// Regexp node it's compiled from if the profile has sources, so that hot
+// parts of the pattern stand out.
+// Example:
+//    // I3 SPLIT I4 I7  -- 1.2M exec, 40%, 300.5K spawns  <- (a|b)*
+void PrintProgram(const Program &program, const MatchProfile &profile,
+                  std::ostream &os = std::cout);
+
+// The MatchPlan struct records which engines a Machine runs. It's chosen when
+// the machine is created from a CompiledRegexp, by what the program allows:
+// a literal prefix or first bytes, a BitParallel small enough, a one-pass
+// program, or expanded programs for Dfa. If an engine can't run a call, e.g.
+// JIT with capture groups, the next of JIT, ONE_PASS, TWO_PHASE and
+// INTERPRETER which can is run.
+struct MatchPlan {
+  // Literal every match begins with, or empty. Unanchored runs skip input up
+  // to its first occurrence, and fail at once if there is none.
+  string prefix;
+  // Bytes every match begins with. Without a prefix, unanchored runs skip
+  // input up to the next of them, and so does the interpreter whenever it
+  // has no thread left.
+  ByteSet first_bytes;
+  Engine existence;  // decides if there is a match without capture groups
+  Engine anchored;   // finds matches anchored at the begin
+  Engine search;     // finds other matches without capture groups
+  Engine capture;    // finds other matches with capture groups
+
+  MatchPlan();
+
+  // Return a description of the plan for debugging.
+  // Example:
+  //    CreateMachine("ERROR:(\\d+)").GetPlan().str();
+  //    // prefix "ERROR:", first bytes [E], existence BIT_PARALLEL, ...
+  string str() const;
+};
+
+class Machine;     // forward declaration
+class JitProgram;  // forward declaration
+struct RunState;   // state of a run of the interpreter (see machine.cpp)
 
 // The Thread class implements "fake" threads to run in the virtual machine.
-// Each thread keeps its own program counter and match status.
+// Each thread keeps its own program counter and match status, and belongs to
+// a single run.
 class Thread : public std::enable_shared_from_this<Thread> {
  public:
   // The Thread::Status struct holds current match status of a thread.
   struct Status {
     unsigned int begin, end;  // begin and end index of current substring
-    vector<StringPtr> saved;  // begin and end pointer of capture groups
+    vector<const char *> saved;  // begin and end of capture groups
     vector<int> repeated;     // counters of repeat times
   };
 
  public:
-  Thread(const Machine &machine, int pc, unsigned int begin);
+  Thread(RunState &run, int pc, unsigned int begin);
 
   // Create a new thread with exact same state as this thread but a different
   // program counter.
@@ -41,17 +239,80 @@ class Thread : public std::enable_shared_from_this<Thread> {
   // the thread either runs a control instruction and succeeds, or runs a data
   // instruction and fails.
   // If save_capture is true, then capture groups will be saved.
-  bool RunOneStep(StringPtr sp, bool save_capture = true);
+  bool RunOneStep(const char *sp, bool save_capture = true);
 
  private:
-  const Machine &machine;  // host machine
+  RunState &run;           // run of the host machine
   unsigned int pc;         // program counter
   Thread::Status status;   // this thread's match status
 };
 
 typedef shared_ptr<Thread> ThreadPtr;
 
+// The CompiledEngines struct holds what a Machine takes from the programs of
+// a CompiledRegexp besides Dfa, which are built lazily anyway.
+struct CompiledEngines {
+  string prefix;               // literal every match begins with, or empty
+  ByteSet first_bytes;         // bytes every match begins with
+  OnePassPtr onepass;          // for anchored match (optional)
+  BitParallelPtr bitparallel;  // for runs without capture (optional)
+};
+
+// The CompiledRegexp struct holds everything a Machine needs, so that it can
+// be saved and loaded without parsing and compiling again (see serialize.h).
+struct CompiledRegexp {
+  Program program;   // program run by threads
+  Program expanded;  // program with expanded counters (optional)
+  Program reversed;  // reversed program with expanded counters (optional)
+  bool match_begin, match_end;  // flags for positonal match
+  bool dot_star_begin, dot_star_end;  // leading or trailing ".*" removed
+  MatchKind kind;                     // rule to choose among matches
+  // Regexp node each instruction of program is compiled from, only kept for
+  // profiles (optional, not saved).
+  vector<RegexpPtr> sources;
+  // Engines created from the programs by CreateCompiledEngines, or loaded
+  // with them. Machines create them again if they are missing (optional).
+  shared_ptr<const CompiledEngines> engines;
+
+  CompiledRegexp();
+};
+
+// Compile rp into program, and also into capture-free forward and reversed
+// programs for two-phase matching (see Machine). Counters are expanded when
+// possible (see ExpandRegexp); if expanded programs would be too large, they
+// are left empty.
+// A trailing ".*" is removed from programs, since '.' matches any character
+// and the match always extends to the end of input. A leading ".*" is also
+// removed if there is a trailing one and no capture group, then any match
+// spans the whole input.
+// Machines created from the result choose among matches by kind, or by
+// LEFTMOST_FIRST if rp has lazy repetitions, which only work by priority.
+// Engines of the result are created by CreateCompiledEngines below.
+// If keep_sources is true, the Regexp node of each instruction is kept in
+// sources, so that profiles of the machine show them. Otherwise rp is not
+// referenced by the result.
+// Throw std::runtime_error if the program has more than max_program_size
+// instructions.
+// Example:
+//    CompiledRegexp cr = CreateCompiledRegexp(ParseRegexp("(a+)b"));
+CompiledRegexp CreateCompiledRegexp(RegexpPtr rp,
+                                    unsigned int max_program_size = UINT_MAX,
+                                    MatchKind kind = LEFTMOST_LONGEST,
+                                    bool keep_sources = false);
+
+// Create the engines which a Machine takes from the programs of cr: the
+// literal prefix and first bytes of the program, and OnePass and BitParallel
+// of the expanded program if it allows them. Without expanded and reversed
+// programs, there are no OnePass and BitParallel.
+// Example:
+//    CompiledEngines engines = CreateCompiledEngines(cr);
+//    engines.prefix;  // "ERROR:" for "ERROR:(\d+)"
+CompiledEngines CreateCompiledEngines(const CompiledRegexp &cr);
+
 // The Machine class implements a virtual machine to run Thompson's algorithm.
+// Each run keeps its threads in its own state, and Dfa caches are taken from
+// a pool per search, so a machine may run in several threads at once. Its
+// settings (Set* and Enable* below) must not change while it runs.
 // Example:
 //    Machine machine(program);
 //    MatchResult status = machine.Run("abc");
@@ -59,33 +320,204 @@ class Machine {
  public:
   Machine(const Program &program);
 
-  // Set flags for positional match.
+  // Create machine from programs compiled by CreateCompiledRegexp. If there
+  // are expanded and reversed programs, they are used for two-phase matching:
+  // Run finds where the match ends with a forward Dfa, where it begins with a
+  // backward Dfa, and then tracks capture groups only inside the match. If
+  // the expanded program is one-pass, anchored runs (match_begin) use OnePass
+  // instead. If the expanded program is small enough for BitParallel, runs
+  // without capture groups use it: anchored runs take the match end from it,
+  // and runs anchored at the end (match_end) take the begin from the
+  // backward Dfa. Matches are chosen by the kind of cr.
+  explicit Machine(const CompiledRegexp &cr);
+
+  // Create machine from Regexp with CreateCompiledRegexp.
+  Machine(RegexpPtr rp, unsigned int max_program_size = UINT_MAX);
+
+  // Return the number of capture groups in the program.
+  unsigned int NumGroups() const { return num_groups; }
+
+  // Set and return flags for positional match.
   void SetMatchBegin(bool b) { match_begin = b; }
   void SetMatchEnd(bool b)  { match_end = b; }
+  bool MatchBegin() const { return match_begin; }
+  bool MatchEnd() const { return match_end; }
+
+  // Set the rule to choose among matches which begin at the same index. The
+  // default is LEFTMOST_LONGEST. With LEFTMOST_FIRST, threads of lower
+  // priority are dropped as soon as a thread matches, which saves work on
+  // patterns ending in ".*" or with many alternatives. The JIT only runs
+  // LEFTMOST_LONGEST, other engines support both.
+  // Example:
+  //    machine.SetMatchKind(LEFTMOST_FIRST);
+  //    machine.Run("ab");  // "a|ab" matches "a"
+  void SetMatchKind(MatchKind k) { kind = k; }
+
+  // Set limits for each run. If a limit is exceeded, Run stops and returns a
+  // result with budget_exceeded set instead of success.
+  // Example:
+  //    MatchBudget budget;
+  //    budget.max_steps = 100000;
+  //    machine.SetBudget(budget);
+  void SetBudget(const MatchBudget &b) { budget = b; }
+
+  // Translate the program into native code, so that Run skips the interpreter
+  // whenever capture groups are not needed. Return false if the JIT is
+  // disabled at build time or doesn't support the program (counters), in
+  // which case Run keeps using the interpreter. Engines are planned again to
+  // run the JIT, which overrides SetPlan.
+  bool EnableJit();
+
+  // Return the engines chosen for this machine (see MatchPlan).
+  const MatchPlan &GetPlan() const { return plan; }
+
+  // Replace the plan, e.g. to compare engines while debugging. Throw
+  // std::runtime_error if an engine is not in the machine, prefix is not a
+  // prefix of the literal every match begins with, or first_bytes misses a
+  // byte a match may begin with.
+  // Example:
+  //    MatchPlan plan = machine.GetPlan();
+  //    plan.anchored = plan.search = plan.capture = INTERPRETER;
+  //    machine.SetPlan(plan);
+  void SetPlan(const MatchPlan &p);
+
+  // Count executions of each instruction in later runs, starting from zero,
+  // or stop counting if b is false. While profiling, every run uses the
+  // interpreter, so that all instructions are counted. Results stay the same
+  // but runs are slower.
+  void EnableProfiling(bool b = true);
+
+  // Return a copy of the counts since profiling was enabled (see
+  // MatchProfile). Counts of a run are added when it finishes, so this may be
+  // called while other threads run the machine.
+  MatchProfile GetProfile() const;
+
+  // Return the program run by threads of the interpreter.
+  const Program &GetProgram() const { return program; }
 
   // Run program on input string s with Rob Pike's implementation.
   // It maintains a collection of threads ready to run, and threads run in lock
   // step -- all threads process the same character in each iteration.
-  // If save_capture is true, then capture groups will be saved.
-  MatchResult Run(const string &s, bool save_capture = true) const;
+  // If the machine is created from Regexp, anchored one-pass programs run
+  // with a single thread. Otherwise the match is located with Dfa first and
+  // threads only run over the matched substring.
+  // If save_capture is true, then capture groups will be saved as spans, and
+  // result.capture reads them from s.
+  MatchResult Run(string_view s, bool save_capture = true) const;
 
- private:
-  friend class Thread;
+  // Same as above, and add execution statistics of this run to stats.
+  // Example:
+  //    MatchStats stats;
+  //    for (auto &s : input) machine.Run(s, false, stats);
+  //    // stats.instructions is the total of all runs
+  MatchResult Run(string_view s, bool save_capture, MatchStats &stats) const;
+
+  // Run program on s anchored at the begin, and also at the end if match_end
+  // is true, in addition to the positional flags of the machine. Only a
+  // single thread is started, and the run stops as soon as all threads die.
+  // Example:
+  //    Machine machine(ParseRegexp("a+"));
+  //    machine.RunAnchored("aab", false);  // success, end = 2
+  //    machine.RunAnchored("aab", true);   // no match
+  MatchResult RunAnchored(string_view s, bool match_end,
+                          bool save_capture = true) const;
+
+  // Same as Run, but the end of the leftmost match is searched by up to
+  // num_threads threads, each scanning a segment of s (see
+  // Dfa::SearchParallel). Segments are made after the first candidate found
+  // with the plan's prefix or first bytes. The backward Dfa then finds where
+  // the match begins, and capture groups are tracked only inside the match.
+  // Inputs of a few segments, anchored machines and machines without Dfa run
+  // as Run.
+  // Example:
+  //    Machine machine(ParseRegexp("FATAL (\\w+)"));
+  //    machine.RunParallel(huge_log, 16);
+  MatchResult RunParallel(string_view s, unsigned int num_threads,
+                          bool save_capture = true) const;
 
-  // Add a thread to run in current iteration.
-  void AddReadyThread(ThreadPtr tp) const { ready.push(tp); }
+  // Return true if s has a match. Only the existence of a match is needed, so
+  // BitParallel stops at the first match end if it can run the program.
+  // Example:
+  //    Machine machine(ParseRegexp("a+b"));
+  //    machine.HasMatch("xxaab");  // true
+  bool HasMatch(string_view s) const;
 
-  // Update match result (called only when the thread successfully matches).
-  void UpdateResult(const Thread::Status &tstatus) const;
+  // Count non-overlapping matches in s in a single forward scan, without
+  // tracking capture groups. After an empty match, the next match is searched
+  // from the character after it, and an empty match at the end of s is
+  // counted too (like Python re.findall). If the machine has match_begin,
+  // there is at most one match. Two-phase matching runs the reverse Dfa only
+  // when a match may be empty, to find where it begins.
+  // Example:
+  //    Machine machine(ParseRegexp("a+"));
+  //    machine.Count("aabaca");  // 3
+  unsigned long Count(string_view s) const;
+
+  // Call f with each non-overlapping match in s from left to right, found in
+  // a single forward scan which goes on after each match, until f returns
+  // false. Matches are the ones Count counts, with begin and end indexes into
+  // s. If save_capture is true, capture groups are saved as spans.
+  // Example:
+  //    Machine machine(ParseRegexp("a+"));
+  //    machine.ForEachMatch("aabaca", false, [](const MatchResult &ms) {
+  //      std::cout << ms.begin << " ";  // 0 3 5
+  //      return true;
+  //    });
+  void ForEachMatch(string_view s, bool save_capture,
+                    const std::function<bool(const MatchResult &)> &f) const;
+
+ private:
+  friend class Thread;
+  friend struct RunState;
 
   // Fetch instruction by program counter (index).
   const InstrPtr FetchInstruction(int pc) const { return program[pc]; }
 
+  // Choose the engines of plan from engines in the machine.
+  void PlanEngines();
+
+  // Return the first engine from engine on which can run a call with given
+  // flags (see MatchPlan), or INTERPRETER while profiling.
+  Engine Select(Engine engine, bool save_capture, bool match_begin) const;
+
+  // Extend successful match ms in s over the removed ".*" (see
+  // CompiledRegexp).
+  MatchResult ExtendMatch(string_view s, MatchResult ms) const;
+
+  // Return the first index of s from pos where a match may begin, by the
+  // literal prefix or else the first bytes of the plan, or string_view::npos
+  // if there is none. Skipped characters are added to stats (optional).
+  size_t Skip(string_view s, size_t pos, MatchStats *stats) const;
+
+  // Run the planned engines on input string s with given positional match
+  // flags, after skipping input to where a match may begin. Statistics of
+  // the run are added to stats (optional).
+  MatchResult Execute(string_view s, bool save_capture, bool match_begin,
+                      bool match_end, MatchStats *stats) const;
+
+  // Same as above without skipping input.
+  MatchResult Dispatch(string_view s, bool save_capture, bool match_begin,
+                       bool match_end, MatchStats *stats) const;
+
+  // Run the interpreter on input string s with given positional match flags.
+  MatchResult Interpret(string_view s, bool save_capture, bool match_begin,
+                        bool match_end, MatchStats *stats) const;
+
  private:
   const Program program;
-  mutable std::queue<ThreadPtr> ready;  // threads to run in current iteration
-  mutable MatchResult result;           // match result
+  unsigned int num_groups;              // capture groups in the program
   bool match_begin, match_end;          // flags for positonal match
+  bool dot_star_begin, dot_star_end;    // see CompiledRegexp
+  MatchKind kind;                       // rule to choose among matches
+  shared_ptr<JitProgram> jit;           // native code (optional)
+  DfaPtr forward, reverse;              // for two-phase matching (optional)
+  OnePassPtr onepass;                   // for anchored match (optional)
+  BitParallelPtr bitparallel;           // for runs without capture (optional)
+  MatchPlan plan;                       // engines to run
+  mutable MatchProfile profile;         // counts of finished runs
+  bool profiling;                       // runs update profile
+  MatchBudget budget;                   // limits of each run
+  vector<RegexpPtr> sources;            // see CompiledRegexp (optional)
 };
 
 };  // namespace Azuki
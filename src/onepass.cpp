@@ -0,0 +1,148 @@
+#include <climits>
+#include "machine.h"
+#include "onepass.h"
+
+namespace Azuki {
+
+namespace {
+
+const unsigned int kUnset = UINT_MAX;
+
+// Collect edges reachable from pc without consuming a character into node.
+// Return false if the program is not one-pass: an instruction is reached by
+// more than one path, or a counter is used.
+bool Closure(const Program &program, unsigned int pc, uint64_t saves,
+             vector<bool> &visited, OnePass::Node &node) {
+  if (visited[pc]) return false;
+  visited[pc] = true;
+
+  auto &instr = program[pc];
+  switch (instr->opcode) {
+    case JMP:
+      return Closure(program, instr->dst, saves, visited, node);
+    case SPLIT: {
+      // Follow the priority order of SPLIT.
+      unsigned int first = instr->greedy ? instr->dst : pc + 1;
+      unsigned int second = instr->greedy ? pc + 1 : instr->dst;
+      return Closure(program, first, saves, visited, node) &&
+             Closure(program, second, saves, visited, node);
+    }
+    case SAVE:
+      if (instr->save_idx >= 64) return false;
+      return Closure(program, pc + 1, saves | (uint64_t(1) << instr->save_idx),
+                     visited, node);
+    case MATCH:
+      node.has_match = true;
+      node.match_saves = saves;
+      node.match_rank = node.edges.size();
+      return true;
+    case CHECK:
+    case INCR:
+    case SET:
+      return false;
+    default:
+      node.edges.push_back(OnePass::Edge{pc, 0, saves});
+      return true;
+  }
+}
+
+// Set slots in saves to pos.
+void ApplySaves(uint64_t saves, unsigned int pos,
+                vector<unsigned int> &slots) {
+  for (unsigned int slot = 0; saves; ++slot, saves >>= 1) {
+    if (saves & 1) slots[slot] = pos;
+  }
+}
+
+};  // namespace
+
+OnePass::OnePass(vector<Node> nodes, unsigned int num_slots)
+    : nodes(std::move(nodes)), num_slots(num_slots) {}
+
+MatchResult OnePass::Run(string_view s, bool match_end, MatchKind kind,
+                         bool save_capture, unsigned long *scanned) const {
+  MatchResult result;
+  vector<unsigned int> slots(num_slots, kUnset), best;
+
+  unsigned int current = 0, pos = 0;
+  for (;; ++pos) {
+    const Node &node = nodes[current];
+    if (node.has_match && (!match_end || pos == s.size())) {
+      result.success = true;
+      result.end = pos;
+      if (save_capture) {
+        best = slots;
+        ApplySaves(node.match_saves, pos, best);
+      }
+    }
+    if (pos == s.size()) break;
+
+    int e = node.next[static_cast<unsigned char>(s[pos])];
+    if (e < 0) break;
+    // The thread going on has lower priority than the match.
+    if (kind == LEFTMOST_FIRST && result.success && result.end == pos &&
+        e >= static_cast<int>(node.match_rank))
+      break;
+    const Edge &edge = node.edges[e];
+    if (save_capture) ApplySaves(edge.saves, pos, slots);
+    current = edge.next;
+  }
+  if (scanned) *scanned += pos;
+
+  if (result.success && save_capture) {
+    result.input = s.data();
+    // One span for each group, matched or not.
+    for (unsigned int i = 0; i < num_slots; i += 2) {
+      if (best[i] == kUnset || best[i + 1] == kUnset)
+        result.spans.push_back(std::make_pair(UINT_MAX, UINT_MAX));
+      else
+        result.spans.push_back(std::make_pair(best[i], best[i + 1]));
+    }
+  }
+  return result;
+}
+
+OnePassPtr CreateOnePass(const Program &program) {
+  unsigned int num_slots = 0;
+  for (auto &instr : program) {
+    if (instr->opcode == SAVE && num_slots <= instr->save_idx)
+      num_slots = instr->save_idx + 1;
+  }
+  if (num_slots % 2) ++num_slots;
+
+  // Nodes are created for index 0 and after each consuming instruction.
+  vector<OnePass::Node> nodes;
+  vector<int> node_of(program.size() + 1, -1);
+  vector<unsigned int> starts = {0};
+  node_of[0] = 0;
+  for (unsigned int idx = 0; idx < starts.size(); ++idx) {
+    OnePass::Node node;
+    node.next.fill(-1);
+    node.has_match = false;
+    node.match_saves = 0;
+    node.match_rank = 0;
+    vector<bool> visited(program.size(), false);
+    if (!Closure(program, starts[idx], 0, visited, node)) return nullptr;
+
+    for (unsigned int e = 0; e < node.edges.size(); ++e) {
+      auto &edge = node.edges[e];
+      const Instruction &instr = *program[edge.target];
+      for (int b = 0; b < 256; ++b) {
+        if (!instr.Accepts(static_cast<char>(b))) continue;
+        // Two threads could consume the character.
+        if (node.next[b] >= 0) return nullptr;
+        node.next[b] = e;
+      }
+      unsigned int start = edge.target + 1;
+      if (node_of[start] < 0) {
+        node_of[start] = starts.size();
+        starts.push_back(start);
+      }
+      edge.next = node_of[start];
+    }
+    nodes.push_back(std::move(node));
+  }
+  return OnePassPtr(new OnePass(std::move(nodes), num_slots));
+}
+
+};  // namespace Azuki
@@ -0,0 +1,69 @@
+#ifndef __AZUKI_ONEPASS__
+#define __AZUKI_ONEPASS__
+
+#include <array>
+#include <cstdint>
+#include "common.h"
+#include "instruction.h"
+
+namespace Azuki {
+
+struct MatchResult;  // forward declaration
+
+// The OnePass class runs anchored one-pass programs. A program is one-pass if
+// at every point of a match at most one thread can consume the next
+// character: threads reachable without consuming a character never accept a
+// same character, and every instruction is reached by a single path. Such a
+// program runs with a single thread that writes capture groups directly, no
+// ready queue and no SPLIT.
+// Use CreateOnePass below instead of the constructor.
+class OnePass {
+ public:
+  // The Edge struct is a transition from a node to the consuming instruction
+  // target, setting the SAVE slots in saves on the way.
+  struct Edge {
+    unsigned int target;  // consuming instruction
+    unsigned int next;    // node after consuming the character
+    uint64_t saves;       // SAVE slots set before consuming the character
+  };
+
+  // The Node struct holds transitions from a point between two characters.
+  struct Node {
+    std::array<int, 256> next;  // index in edges for each character, or -1
+    vector<Edge> edges;
+    bool has_match;             // MATCH is reachable
+    uint64_t match_saves;       // SAVE slots set on the way to MATCH
+    unsigned int match_rank;    // edges[0, match_rank) have priority over MATCH
+  };
+
+  OnePass(vector<Node> nodes, unsigned int num_slots);
+
+  // Return the nodes and the number of SAVE slots, e.g. to save them.
+  const vector<Node> &Nodes() const { return nodes; }
+  unsigned int NumSlots() const { return num_slots; }
+
+  // Run on input string s from index 0. If match_end is true, only matches
+  // ending at s.size() are considered. kind chooses among matches (see
+  // MatchKind).
+  // If save_capture is true, then capture groups will be saved.
+  // If scanned is not nullptr, consumed characters are counted in it.
+  MatchResult Run(string_view s, bool match_end,
+                  MatchKind kind = LEFTMOST_LONGEST, bool save_capture = true,
+                  unsigned long *scanned = nullptr) const;
+
+ private:
+  const vector<Node> nodes;  // nodes[0] is where the match begins
+  unsigned int num_slots;    // number of SAVE slots in program
+};
+
+typedef shared_ptr<OnePass> OnePassPtr;
+
+// Analyze program and create OnePass from it. Return nullptr if the program
+// is not one-pass, or has counters (CHECK, INCR and SET).
+// Example:
+//    OnePassPtr op = CreateOnePass(CompileRegexp(ParseRegexp("\\d+-\\d+")));
+OnePassPtr CreateOnePass(const Program &program);
+
+};  // namespace Azuki
+
+#endif  // __AZUKI_ONEPASS__
@@ -1,6 +1,7 @@
 #include <boost/fusion/adapted.hpp>
 #include <boost/spirit/include/phoenix.hpp>
 #include <boost/spirit/include/qi.hpp>
+#include <algorithm>
 #include <climits>
 #include <iostream>
 #include "regexp.h"
@@ -92,6 +93,12 @@ RegexpPtr CreateCurlyRegexp(RegexpPtr left, int low_times, int high_times) {
   return rp;
 }
 
+RegexpPtr CreateLazyRegexp(RegexpPtr rp) {
+  RegexpPtr lazy(new Regexp(*rp));
+  lazy->lazy = true;
+  return lazy;
+}
+
 // This is a wrapper to handle arbitrary escaped character.
 // Either CreateClassRegexp or CreateLitRegexp is called to create the Regexp.
 // Example:
@@ -112,50 +119,215 @@ RegexpPtr CreateRegexpWithEscaped(char c) {
     throw std::runtime_error("Invalid escaped character.");
 }
 
+namespace {
+
+const unsigned int kMaxCodepoint = 0x10FFFF;
+
+// Largest code points encoded with 1, 2, 3 and 4 bytes.
+const unsigned int kMaxEncoded[] = {0x7F, 0x7FF, 0xFFFF, kMaxCodepoint};
+
+// Encode code point cp into UTF-8 bytes.
+string EncodeUtf8(unsigned int cp) {
+  string s;
+  if (cp <= 0x7F) {
+    s += static_cast<char>(cp);
+  } else if (cp <= 0x7FF) {
+    s += static_cast<char>(0xC0 | (cp >> 6));
+    s += static_cast<char>(0x80 | (cp & 0x3F));
+  } else if (cp <= 0xFFFF) {
+    s += static_cast<char>(0xE0 | (cp >> 12));
+    s += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    s += static_cast<char>(0x80 | (cp & 0x3F));
+  } else {
+    s += static_cast<char>(0xF0 | (cp >> 18));
+    s += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    s += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    s += static_cast<char>(0x80 | (cp & 0x3F));
+  }
+  return s;
+}
+
+// Decode a single code point from UTF-8 bytes s checked by the grammar.
+unsigned int DecodeUtf8(const string &s) {
+  static const unsigned char masks[] = {0x7F, 0x1F, 0x0F, 0x07};
+  unsigned int cp = static_cast<unsigned char>(s[0]) & masks[s.size() - 1];
+  for (unsigned int i = 1; i < s.size(); ++i)
+    cp = (cp << 6) | (static_cast<unsigned char>(s[i]) & 0x3F);
+  if (cp > kMaxCodepoint || cp <= kMaxEncoded[s.size() - 2])
+    throw std::runtime_error("Invalid UTF-8 character.");
+  return cp;
+}
+
+RegexpPtr Alt(RegexpPtr left, RegexpPtr right) {
+  return left ? CreateAltRegexp(left, right) : right;
+}
+
+// Add byte sequences of code points from low to high, which are encoded with
+// the same number of bytes, as alternatives to rp.
+// Ranges are split until all code points share the leading bytes up to some
+// position, and the remaining bytes cover whole ranges of continuation bytes.
+// Then each byte position is a single byte range, e.g. U+0800 to U+FFFF
+// becomes [\xE0][\xA0-\xBF][\x80-\xBF] | [\xE1-\xEF][\x80-\xBF][\x80-\xBF].
+void AddUtf8Ranges(RegexpPtr &rp, unsigned int low, unsigned int high) {
+  for (unsigned int i = 1; i < 4; ++i) {
+    unsigned int mask = (1u << (6 * i)) - 1;
+    if ((low & ~mask) == (high & ~mask)) continue;
+    if ((low & mask) != 0) {
+      AddUtf8Ranges(rp, low, low | mask);
+      AddUtf8Ranges(rp, (low | mask) + 1, high);
+      return;
+    }
+    if ((high & mask) != mask) {
+      AddUtf8Ranges(rp, low, (high & ~mask) - 1);
+      AddUtf8Ranges(rp, high & ~mask, high);
+      return;
+    }
+  }
+
+  string low_bytes = EncodeUtf8(low), high_bytes = EncodeUtf8(high);
+  RegexpPtr seq;
+  for (int i = low_bytes.size() - 1; i >= 0; --i) {
+    RegexpPtr byte = low_bytes[i] == high_bytes[i]
+                         ? CreateLitRegexp(low_bytes[i])
+                         : CreateSquareRegexp(low_bytes[i], high_bytes[i]);
+    seq = seq ? CreateCatRegexp(byte, seq) : byte;
+  }
+  rp = Alt(rp, seq);
+}
+
+// Create Regexp of a literal code point in UTF-8 bytes s.
+RegexpPtr CreateUtf8LitRegexp(const string &s) {
+  DecodeUtf8(s);  // check the encoding
+  RegexpPtr rp = CreateLitRegexp(s.back());
+  for (int i = s.size() - 2; i >= 0; --i)
+    rp = CreateCatRegexp(CreateLitRegexp(s[i]), rp);
+  return rp;
+}
+
+// Return repetition rp of another item left, keeping its bounds and laziness.
+RegexpPtr CopyRepeat(RegexpPtr rp, RegexpPtr left) {
+  RegexpPtr copy(new Regexp(*rp));
+  copy->left = left;
+  return copy;
+}
+
+RegexpPtr CreateUtf8DotRegexp() {
+  return CreateUtf8RangeRegexp(0, kMaxCodepoint);
+}
+
+// Return true if an ASCII letter is in the range from low to high.
+bool HasLetter(char low, char high) {
+  return (low <= 'z' && high >= 'a') || (low <= 'Z' && high >= 'A');
+}
+
+};  // namespace
+
+char SwapCase(char ch) {
+  if (ch >= 'a' && ch <= 'z') return ch - 'a' + 'A';
+  if (ch >= 'A' && ch <= 'Z') return ch - 'A' + 'a';
+  return ch;
+}
+
+RegexpPtr CreateUtf8RangeRegexp(unsigned int low, unsigned int high) {
+  if (low > high || high > kMaxCodepoint)
+    throw std::runtime_error("Invalid regular expression.");
+  // Split the range by the number of bytes first, so that each part is
+  // encoded with byte ranges which don't cross 0x80. RANGE compares chars,
+  // which may be signed.
+  RegexpPtr rp;
+  unsigned int begin = 0;
+  for (unsigned int end : kMaxEncoded) {
+    if (low <= end && high >= begin)
+      AddUtf8Ranges(rp, std::max(low, begin), std::min(high, end));
+    begin = end + 1;
+  }
+  return rp;
+}
+
 template <typename Iterator>
 struct regexp_grammer : qi::grammar<Iterator, RegexpPtr()> {
   qi::rule<Iterator, RegexpPtr()> regexp;
   qi::rule<Iterator, RegexpPtr()> alt;
   qi::rule<Iterator, RegexpPtr()> concat;
   qi::rule<Iterator, RegexpPtr()> repeat;
+  qi::rule<Iterator, RegexpPtr()> quantifier;
   qi::rule<Iterator, RegexpPtr()> single;
+  qi::rule<Iterator, RegexpPtr()> group;
+  qi::rule<Iterator, RegexpPtr()> byte_single;
+  qi::rule<Iterator, RegexpPtr()> utf8_single;
+  qi::rule<Iterator, std::string()> utf8_char;  // non-ASCII code point
+  qi::rule<Iterator, unsigned int()> codepoint;
 
-  regexp_grammer() : regexp_grammer::base_type(regexp) {
+  regexp_grammer(bool utf8, bool capture)
+      : regexp_grammer::base_type(regexp) {
     using namespace qi;
 
     regexp = alt[_val = _1];
-    alt = (concat >> "|" >> alt)[_val = phx::bind(CreateAltRegexp, _1, _2)] |
-          concat[_val = _1];
-    concat = (repeat >> concat)[_val = phx::bind(CreateCatRegexp, _1, _2)] |
-             repeat[_val = _1];
-    repeat =
-        (single >> "{" >> int_ >>
-         "}")[_val = phx::bind(CreateCurlyRegexp, _1, _2, _2)] |
-        (single >> "{" >> int_ >> "," >> int_ >>
-         "}")[_val = phx::bind(CreateCurlyRegexp, _1, _2, _3)] |
-        (single >> "{" >> int_ >>
-         ",}")[_val = phx::bind(CreateCurlyRegexp, _1, _2, phx::val(INT_MAX))] |
-        (single >> "+")[_val = phx::bind(CreatePlusRegexp, _1)] |
-        (single >> "?")[_val = phx::bind(CreateQuestRegexp, _1)] |
-        (single >> "*")[_val = phx::bind(CreateStarRegexp, _1)] |
-        single[_val = _1];
-    single = ("(" >> regexp >> ")")[_val = phx::bind(CreateParenRegexp, _1)] |
-             ("[" >> char_ >> "-" >> char_ >>
-              "]")[_val = phx::bind(CreateSquareRegexp, _1, _2)] |
-             ("\\" >> char_)[_val = phx::bind(CreateRegexpWithEscaped, _1)] |
-             (alnum)[_val = phx::bind(CreateLitRegexp, _1)] |
-             (space)[_val = phx::bind(CreateLitRegexp, _1)] |
-             (char_("~!@#%&=:;,_<>-"))[_val = phx::bind(CreateLitRegexp, _1)] |
-             char_('.')[_val = CreateDotRegexp()];
+    // Operators are optional after their operands, so that operands (and
+    // nested groups in them) are never parsed again on backtracking.
+    alt = concat[_val = _1] >>
+          -("|" >> alt[_val = phx::bind(CreateAltRegexp, _val, _1)]);
+    concat = repeat[_val = _1] >>
+             -concat[_val = phx::bind(CreateCatRegexp, _val, _1)];
+    repeat = single[_val = _1] >>
+             -(quantifier[_val = phx::bind(CopyRepeat, _1, _val)] >>
+               -lit('?')[_val = phx::bind(CreateLazyRegexp, _val)]);
+    // Repetitions without their items.
+    RegexpPtr none;
+    quantifier =
+        ("{" >> int_ >>
+         "}")[_val = phx::bind(CreateCurlyRegexp, none, _1, _1)] |
+        ("{" >> int_ >> "," >> int_ >>
+         "}")[_val = phx::bind(CreateCurlyRegexp, none, _1, _2)] |
+        ("{" >> int_ >>
+         ",}")[_val = phx::bind(CreateCurlyRegexp, none, _1, INT_MAX)] |
+        lit('+')[_val = phx::bind(CreatePlusRegexp, none)] |
+        lit('?')[_val = phx::bind(CreateQuestRegexp, none)] |
+        lit('*')[_val = phx::bind(CreateStarRegexp, none)];
+    // Non-capturing groups are kept as their items, without PAREN.
+    if (capture)
+      group = ("(?:" >> regexp >> ")")[_val = _1] |
+              ("(" >> regexp >> ")")[_val = phx::bind(CreateParenRegexp, _1)];
+    else
+      group = ("(?:" >> regexp >> ")")[_val = _1] |
+              ("(" >> regexp >> ")")[_val = _1];
+    byte_single =
+        group[_val = _1] |
+        ("[" >> char_ >> "-" >> char_ >>
+         "]")[_val = phx::bind(CreateSquareRegexp, _1, _2)] |
+        ("\\" >> char_)[_val = phx::bind(CreateRegexpWithEscaped, _1)] |
+        (alnum)[_val = phx::bind(CreateLitRegexp, _1)] |
+        (space)[_val = phx::bind(CreateLitRegexp, _1)] |
+        (char_("~!@#%&=:;,_<>-"))[_val = phx::bind(CreateLitRegexp, _1)] |
+        char_('.')[_val = CreateDotRegexp()];
+    if (!utf8) {
+      single = byte_single[_val = _1];
+      return;
+    }
+
+    // In UTF-8 mode, code points are parsed before single bytes.
+    auto cont = char_('\x80', '\xBF');
+    utf8_char = raw[(char_('\xC0', '\xDF') >> cont) |
+                    (char_('\xE0', '\xEF') >> cont >> cont) |
+                    (char_('\xF0', '\xF7') >> cont >> cont >> cont)];
+    codepoint = utf8_char[_val = phx::bind(DecodeUtf8, _1)] |
+                char_('\x01', '\x7F')[_val = _1];
+    utf8_single =
+        ("[" >> codepoint >> "-" >> codepoint >>
+         "]")[_val = phx::bind(CreateUtf8RangeRegexp, _1, _2)] |
+        utf8_char[_val = phx::bind(CreateUtf8LitRegexp, _1)] |
+        char_('.')[_val = phx::bind(CreateUtf8DotRegexp)];
+    single = utf8_single[_val = _1] | byte_single[_val = _1];
   }
 };
 
-RegexpPtr ParseRegexp(const std::string &s) {
-  regexp_grammer<StringPtr> g;
+RegexpPtr ParseRegexp(const std::string &s, int flags) {
+  regexp_grammer<StringPtr> g(flags & UTF8, !(flags & NO_CAPTURE));
   RegexpPtr rp;
 
   bool ok = qi::phrase_parse(s.begin(), s.end(), g, ascii::space, rp);
-  if (ok && IsValidRegexp(rp)) return rp;
+  if (ok && IsValidRegexp(rp))
+    return flags & CASE_INSENSITIVE ? FoldCaseRegexp(rp) : rp;
   throw std::runtime_error("Invalid regular expression.");
 }
 
@@ -163,7 +335,7 @@ void PrintRegexpImpl(int depth, RegexpPtr rp) {
   if (depth > 0) std::cout << string((depth - 1) * 4, ' ') << "|--";
   switch (rp->type) {
     case LIT:
-      std::cout << "LIT " << rp->c << std::endl;
+      std::cout << "LIT " << rp->c << (rp->fold ? " FOLD" : "") << std::endl;
       break;
     case ALT:
       std::cout << "ALT" << std::endl;
@@ -180,7 +352,7 @@ void PrintRegexpImpl(int depth, RegexpPtr rp) {
       break;
     case CURLY:
       std::cout << "CURLY " << rp->low_times << " " << rp->high_times
-                << std::endl;
+                << (rp->lazy ? " LAZY" : "") << std::endl;
       PrintRegexpImpl(depth + 1, rp->left);
       break;
     case DOT:
@@ -191,19 +363,20 @@ void PrintRegexpImpl(int depth, RegexpPtr rp) {
       PrintRegexpImpl(depth + 1, rp->left);
       break;
     case PLUS:
-      std::cout << "PLUS" << std::endl;
+      std::cout << "PLUS" << (rp->lazy ? " LAZY" : "") << std::endl;
       PrintRegexpImpl(depth + 1, rp->left);
       break;
     case QUEST:
-      std::cout << "QUEST" << std::endl;
+      std::cout << "QUEST" << (rp->lazy ? " LAZY" : "") << std::endl;
       PrintRegexpImpl(depth + 1, rp->left);
       break;
     case STAR:
-      std::cout << "STAR" << std::endl;
+      std::cout << "STAR" << (rp->lazy ? " LAZY" : "") << std::endl;
       PrintRegexpImpl(depth + 1, rp->left);
       break;
     case SQUARE:
-      std::cout << "SQUARE " << rp->low_ch << " " << rp->high_ch << std::endl;
+      std::cout << "SQUARE " << rp->low_ch << " " << rp->high_ch
+                << (rp->fold ? " FOLD" : "") << std::endl;
       break;
     default:
       throw std::runtime_error("Unexpected regexp type.");
@@ -212,6 +385,66 @@ void PrintRegexpImpl(int depth, RegexpPtr rp) {
 
 void PrintRegexp(RegexpPtr rp) { PrintRegexpImpl(0, rp); }
 
+string FormatRegexp(RegexpPtr rp) {
+  // Wrap the operand of a repetition unless it is a single item, and
+  // alternatives inside a concatenation.
+  auto group = [](RegexpPtr r, bool repeated) {
+    bool wrap = r->type == ALT || (repeated && r->type != CLASS &&
+                                   r->type != DOT && r->type != LIT &&
+                                   r->type != PAREN && r->type != SQUARE);
+    return wrap ? "(?:" + FormatRegexp(r) + ")" : FormatRegexp(r);
+  };
+  string lazy = rp->lazy ? "?" : "";
+  switch (rp->type) {
+    case LIT: {
+      static const string special_char = ".+?*|\\()[]{}";
+      string escape = special_char.find(rp->c) != string::npos ? "\\" : "";
+      if (rp->fold) return string("(?:") + rp->c + "|" + SwapCase(rp->c) + ")";
+      return escape + rp->c;
+    }
+    case ALT:
+      return FormatRegexp(rp->left) + "|" + FormatRegexp(rp->right);
+    case CAT:
+      return group(rp->left, false) + group(rp->right, false);
+    case CLASS:
+      return string("\\") + rp->c;
+    case CURLY: {
+      string times = std::to_string(rp->low_times);
+      if (rp->high_times == INT_MAX)
+        times += ",";
+      else if (rp->high_times != rp->low_times)
+        times += "," + std::to_string(rp->high_times);
+      return group(rp->left, true) + "{" + times + "}" + lazy;
+    }
+    case DOT:
+      return ".";
+    case PAREN:
+      return "(" + FormatRegexp(rp->left) + ")";
+    case PLUS:
+      return group(rp->left, true) + "+" + lazy;
+    case QUEST:
+      return group(rp->left, true) + "?" + lazy;
+    case STAR:
+      return group(rp->left, true) + "*" + lazy;
+    case SQUARE: {
+      auto square = [](char low, char high) {
+        return string("[") + low + "-" + high + "]";
+      };
+      if (!rp->fold) return square(rp->low_ch, rp->high_ch);
+      // Add the other case of letters in the range.
+      string folded = "(?:" + square(rp->low_ch, rp->high_ch);
+      for (char first : {'a', 'A'}) {
+        char low = std::max(rp->low_ch, first);
+        char high = std::min<char>(rp->high_ch, first + 25);
+        if (low <= high) folded += "|" + square(SwapCase(low), SwapCase(high));
+      }
+      return folded + ")";
+    }
+    default:
+      throw std::runtime_error("Unexpected regexp type.");
+  }
+}
+
 bool IsValidRegexp(RegexpPtr rp) {
   if (rp.get()) {
     switch (rp->type) {
@@ -252,18 +485,21 @@ bool operator==(RegexpPtr rp1, RegexpPtr rp2) {
       return rp1->c == rp2->c;
     case CURLY:
       return rp1->low_times == rp2->low_times &&
-             rp1->high_times == rp2->high_times && rp1->left == rp2->left;
+             rp1->high_times == rp2->high_times && rp1->lazy == rp2->lazy &&
+             rp1->left == rp2->left;
     case DOT:
       return true;
     case PAREN:
+      return rp1->left == rp2->left;
     case PLUS:
     case QUEST:
     case STAR:
-      return rp1->left == rp2->left;
+      return rp1->lazy == rp2->lazy && rp1->left == rp2->left;
     case LIT:
-      return rp1->c == rp2->c;
+      return rp1->c == rp2->c && rp1->fold == rp2->fold;
     case SQUARE:
-      return rp1->low_ch == rp2->low_ch && rp1->high_ch == rp2->high_ch;
+      return rp1->low_ch == rp2->low_ch && rp1->high_ch == rp2->high_ch &&
+             rp1->fold == rp2->fold;
     default:
       std::cerr << "Unexpected regexp type." << std::endl;
       return false;
@@ -271,4 +507,107 @@ bool operator==(RegexpPtr rp1, RegexpPtr rp2) {
   return false;
 }
 
+namespace {
+
+RegexpPtr Lazy(RegexpPtr rp, bool lazy) {
+  return lazy ? CreateLazyRegexp(rp) : rp;
+}
+
+};  // namespace
+
+RegexpPtr ExpandRegexp(RegexpPtr rp, int max_times) {
+  switch (rp->type) {
+    case ALT:
+      return CreateAltRegexp(ExpandRegexp(rp->left, max_times),
+                             ExpandRegexp(rp->right, max_times));
+    case CAT:
+      return CreateCatRegexp(ExpandRegexp(rp->left, max_times),
+                             ExpandRegexp(rp->right, max_times));
+    case CURLY: {
+      RegexpPtr left = ExpandRegexp(rp->left, max_times);
+      int low_times = std::max(rp->low_times, 1);
+      int copies = rp->high_times == INT_MAX ? low_times : rp->high_times;
+      if (rp->high_times < 1 || copies > max_times)
+        return CopyRepeat(rp, left);
+
+      // Optional copies are nested, "a{1,3}" becomes "a(a(a)?)?", and
+      // "a{1,3}?" becomes "a(a(a)??)??".
+      RegexpPtr optional;
+      if (rp->high_times == INT_MAX) {
+        optional = Lazy(CreateStarRegexp(left), rp->lazy);
+      } else {
+        for (int i = low_times; i < rp->high_times; ++i)
+          optional = Lazy(CreateQuestRegexp(optional
+                                                ? CreateCatRegexp(left, optional)
+                                                : left),
+                          rp->lazy);
+      }
+      RegexpPtr expanded = optional;
+      for (int i = 0; i < low_times; ++i)
+        expanded = expanded ? CreateCatRegexp(left, expanded) : left;
+      return expanded;
+    }
+    case PAREN:
+      return CreateParenRegexp(ExpandRegexp(rp->left, max_times));
+    case PLUS:
+    case QUEST:
+    case STAR:
+      return CopyRepeat(rp, ExpandRegexp(rp->left, max_times));
+    default:
+      return rp;
+  }
+}
+
+RegexpPtr FoldCaseRegexp(RegexpPtr rp) {
+  switch (rp->type) {
+    case ALT:
+      return CreateAltRegexp(FoldCaseRegexp(rp->left),
+                             FoldCaseRegexp(rp->right));
+    case CAT:
+      return CreateCatRegexp(FoldCaseRegexp(rp->left),
+                             FoldCaseRegexp(rp->right));
+    case CURLY:
+      return CopyRepeat(rp, FoldCaseRegexp(rp->left));
+    case LIT:
+    case SQUARE: {
+      bool letter = rp->type == LIT
+                        ? SwapCase(rp->c) != rp->c
+                        : HasLetter(rp->low_ch, rp->high_ch);
+      if (!letter) return rp;
+      RegexpPtr folded(new Regexp(*rp));
+      folded->fold = true;
+      return folded;
+    }
+    case PAREN:
+      return CreateParenRegexp(FoldCaseRegexp(rp->left));
+    case PLUS:
+    case QUEST:
+    case STAR:
+      return CopyRepeat(rp, FoldCaseRegexp(rp->left));
+    default:
+      return rp;
+  }
+}
+
+RegexpPtr ReverseRegexp(RegexpPtr rp) {
+  switch (rp->type) {
+    case ALT:
+      return CreateAltRegexp(ReverseRegexp(rp->left),
+                             ReverseRegexp(rp->right));
+    case CAT:
+      return CreateCatRegexp(ReverseRegexp(rp->right),
+                             ReverseRegexp(rp->left));
+    case CURLY:
+      return CopyRepeat(rp, ReverseRegexp(rp->left));
+    case PAREN:
+      return CreateParenRegexp(ReverseRegexp(rp->left));
+    case PLUS:
+    case QUEST:
+    case STAR:
+      return CopyRepeat(rp, ReverseRegexp(rp->left));
+    default:
+      return rp;
+  }
+}
+
 };  // namespace Azuki
@@ -34,6 +34,10 @@ struct Regexp {
   shared_ptr<Regexp> right;
   char low_ch, high_ch;       // Lower and upper bounds of character. (SQUARE)
   int low_times, high_times;  // Lower and upper bounds of character. (CURLY)
+  // Prefer fewer repetitions. (CURLY, PLUS, QUEST, STAR)
+  bool lazy;
+  // Also match the other case of ASCII letters. (LIT, SQUARE)
+  bool fold;
 };
 
 typedef shared_ptr<Regexp> RegexpPtr;
@@ -53,20 +57,84 @@ RegexpPtr CreateQuestRegexp(RegexpPtr left);
 RegexpPtr CreateStarRegexp(RegexpPtr left);
 RegexpPtr CreateSquareRegexp(char low_ch, char high_ch);
 
+// Return a copy of repetition rp (CURLY, PLUS, QUEST or STAR) which prefers
+// fewer repetitions, like "a*?". Which match is preferred only matters with
+// LEFTMOST_FIRST (see Machine::SetMatchKind).
+// Example:
+//    RegexpPtr rp = CreateLazyRegexp(CreateStarRegexp(CreateDotRegexp()));
+RegexpPtr CreateLazyRegexp(RegexpPtr rp);
+
+// Build Regexp matching UTF-8 encoded code points from low to high, made of
+// byte ranges only, so that programs still consume a byte per step. Throw
+// std::runtime_error if the range is empty or above U+10FFFF.
+// Example:
+//    RegexpPtr rp = CreateUtf8RangeRegexp(0x80, 0x7FF);  // [\xC2-\xDF][\x80-\xBF]
+RegexpPtr CreateUtf8RangeRegexp(unsigned int low, unsigned int high);
+
+// Return ASCII letter ch in the other case, or ch if it is not a letter.
+// Example:
+//    SwapCase('a');  // 'A'
+char SwapCase(char ch);
+
 // Check the equality of two Regexp.
 bool operator==(RegexpPtr rp1, RegexpPtr rp2);
 
-// Build Regexp representation from raw regular expression.
+// Flags of ParseRegexp, which can be combined with '|'.
+enum RegexpFlags {
+  // Match UTF-8 encoded code points instead of bytes: '.' matches a code
+  // point, and non-ASCII characters can be used in literals and ranges. Other
+  // classes (\w, \d, \s) are still ASCII only. Invalid UTF-8 in the input
+  // doesn't match '.' or ranges.
+  UTF8 = 1,
+  // Match ASCII letters of either case, see FoldCaseRegexp.
+  CASE_INSENSITIVE = 2,
+  // Parse all groups as non-capturing, for machines which only tell if there
+  // is a match.
+  NO_CAPTURE = 4
+};
+
+// Build Regexp representation from raw regular expression. Groups "(...)"
+// are capture groups (PAREN), and groups "(?:...)" only group their items.
+// A repetition followed by '?' is lazy (see CreateLazyRegexp).
 // Example:
 //    RegexpPtr rp = ParseRegexp("a+b");
-RegexpPtr ParseRegexp(const std::string &s);
+//    RegexpPtr rp = ParseRegexp("(?:ab)+(c)");  // one capture group
+//    RegexpPtr rp = ParseRegexp("[α-ω]+", UTF8);
+RegexpPtr ParseRegexp(const std::string &s, int flags = 0);
 
 // Print the Regexp (for debug use).
 void PrintRegexp(RegexpPtr rp);
 
+// Return the Regexp in pattern syntax (for debug use). Groups are added only
+// where needed, so the pattern may differ from the parsed one.
+// Example:
+//    FormatRegexp(ParseRegexp("(a|b)+c?"));  // "(a|b)+c?"
+//    FormatRegexp(ParseRegexp("[a-c]"));     // "[a-c]"
+string FormatRegexp(RegexpPtr rp);
+
 // Check whether the Regexp is valid.
 bool IsValidRegexp(RegexpPtr rp);
 
+// Rewrite CURLY into copies of its item, so that the Regexp compiles into a
+// program without counters. CURLY needing more than max_times copies is kept.
+// Like the compiled CURLY, the item is always matched at least once.
+// Example:
+//    RegexpPtr rp = ExpandRegexp(ParseRegexp("a{2,3}"));  // same as "aa(a)?"
+RegexpPtr ExpandRegexp(RegexpPtr rp, int max_times = 64);
+
+// Mark literals and ranges of ASCII letters to match both cases, so that
+// case-insensitive matching needs no transformation of the input. A marked
+// item still compiles into a single CHAR or RANGE instruction.
+// Example:
+//    // same as "(?:a|A)(?:[x-z]|[X-Z])"
+//    RegexpPtr rp = FoldCaseRegexp(ParseRegexp("a[x-z]"));
+RegexpPtr FoldCaseRegexp(RegexpPtr rp);
+
+// Build Regexp matching the reversed strings of the Regexp.
+// Example:
+//    RegexpPtr rp = ReverseRegexp(ParseRegexp("ab+"));  // same as "b+a"
+RegexpPtr ReverseRegexp(RegexpPtr rp);
+
 };  // namespace Azuki
 
 #endif  // __AZUKI_REGEXP__
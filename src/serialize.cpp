@@ -0,0 +1,488 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include "serialize.h"
+
+namespace Azuki {
+
+namespace {
+
+const char kMagic[8] = {'A', 'Z', 'U', 'K', 'I', 'P', 'R', 'G'};
+const uint32_t kByteOrder = 0x01020304;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t byte_order;  // kByteOrder in native byte order
+  uint32_t version;
+  uint32_t count;       // number of entries
+  uint32_t reserved;
+};
+
+struct EntryHeader {
+  uint32_t flags;     // kMatchBegin, kMatchEnd, kDotStarBegin, kDotStarEnd
+                      // and kLeftmostFirst
+  uint32_t sizes[3];  // sizes of program, expanded and reversed
+};
+
+const uint32_t kMatchBegin = 1;
+const uint32_t kMatchEnd = 2;
+const uint32_t kDotStarBegin = 4;
+const uint32_t kDotStarEnd = 8;
+const uint32_t kLeftmostFirst = 16;
+
+// Engines of an entry, after its programs (version 5). The prefix follows,
+// then for each OnePass node a NodeRecord, its RunRecords and EdgeRecords,
+// then a BitParallelRecord and TableRecords if there is a BitParallel.
+struct EngineHeader {
+  uint32_t flags;           // kHasOnePass, kHasBitParallel and kNullable
+  uint32_t prefix_size;     // bytes of the literal prefix
+  uint64_t first_bytes[4];  // byte ch is bit ch % 64 of first_bytes[ch / 64]
+  uint32_t num_nodes;       // OnePass nodes
+  uint32_t num_slots;       // OnePass SAVE slots
+  uint32_t num_tables;      // BitParallel tables
+  uint32_t reserved;
+};
+
+const uint32_t kHasOnePass = 1;
+const uint32_t kHasBitParallel = 2;
+const uint32_t kNullable = 4;
+
+// A OnePass::Node, with next as runs of bytes going to the same edge.
+struct NodeRecord {
+  uint32_t num_edges;
+  uint32_t num_runs;
+  uint32_t has_match;
+  uint32_t match_rank;
+  uint64_t match_saves;
+};
+
+struct RunRecord {
+  uint8_t first, last;  // bytes of the run
+  uint8_t reserved[2];
+  uint32_t edge;        // index in edges of the node
+};
+
+struct EdgeRecord {
+  uint32_t target;
+  uint32_t next;
+  uint64_t saves;
+};
+
+// BitParallel::Automaton except nullable (in EngineHeader) and tables.
+struct BitParallelRecord {
+  uint64_t accept[256];
+  uint64_t start, shifted, finals;
+};
+
+struct TableRecord {
+  uint32_t offset;
+  uint32_t reserved;
+  uint64_t follow[256];
+};
+
+// An instruction of fixed size, with the fields of Instruction.
+struct InstructionRecord {
+  uint8_t opcode;
+  uint8_t greedy;
+  char c;
+  char low_ch, high_ch;
+  uint8_t fold;
+  uint8_t reserved[2];
+  uint32_t dst;
+  uint32_t save_idx;
+  uint32_t rpctr_idx;
+  int32_t low_times, high_times;
+  int32_t value;
+};
+
+static_assert(sizeof(FileHeader) == 24, "unexpected padding");
+static_assert(sizeof(EntryHeader) == 16, "unexpected padding");
+static_assert(sizeof(InstructionRecord) == 32, "unexpected padding");
+static_assert(sizeof(EngineHeader) == 56, "unexpected padding");
+static_assert(sizeof(NodeRecord) == 24, "unexpected padding");
+static_assert(sizeof(RunRecord) == 8, "unexpected padding");
+static_assert(sizeof(EdgeRecord) == 16, "unexpected padding");
+static_assert(sizeof(BitParallelRecord) == 2072, "unexpected padding");
+static_assert(sizeof(TableRecord) == 2056, "unexpected padding");
+
+void Write(std::ostream &os, const void *p, size_t n) {
+  os.write(static_cast<const char *>(p), n);
+  if (!os) throw std::runtime_error("Failed to write programs.");
+}
+
+void WriteProgram(std::ostream &os, const Program &program) {
+  for (auto &instr : program) {
+    InstructionRecord record;
+    memset(&record, 0, sizeof(record));
+    record.opcode = instr->opcode;
+    record.greedy = instr->greedy;
+    record.c = instr->c;
+    record.fold = instr->fold;
+    record.low_ch = instr->low_ch;
+    record.high_ch = instr->high_ch;
+    record.dst = instr->dst;
+    record.save_idx = instr->save_idx;
+    record.rpctr_idx = instr->rpctr_idx;
+    record.low_times = instr->low_times;
+    record.high_times = instr->high_times;
+    record.value = instr->value;
+    Write(os, &record, sizeof(record));
+  }
+}
+
+void WriteEngines(std::ostream &os, const CompiledEngines &engines) {
+  EngineHeader header;
+  memset(&header, 0, sizeof(header));
+  header.prefix_size = engines.prefix.size();
+  for (int ch = 0; ch < 256; ++ch) {
+    if (engines.first_bytes.Contains(ch))
+      header.first_bytes[ch / 64] |= uint64_t(1) << (ch % 64);
+  }
+  if (engines.onepass) {
+    header.flags |= kHasOnePass;
+    header.num_nodes = engines.onepass->Nodes().size();
+    header.num_slots = engines.onepass->NumSlots();
+  }
+  if (engines.bitparallel) {
+    auto &automaton = engines.bitparallel->GetAutomaton();
+    header.flags |= kHasBitParallel | (automaton.nullable ? kNullable : 0);
+    header.num_tables = automaton.tables.size();
+  }
+  Write(os, &header, sizeof(header));
+  Write(os, engines.prefix.data(), engines.prefix.size());
+
+  if (engines.onepass) {
+    for (auto &node : engines.onepass->Nodes()) {
+      vector<RunRecord> runs;
+      for (int b = 0; b < 256; ++b) {
+        if (node.next[b] < 0) continue;
+        if (!runs.empty() && runs.back().last + 1 == b &&
+            static_cast<int>(runs.back().edge) == node.next[b]) {
+          runs.back().last = b;
+          continue;
+        }
+        RunRecord run;
+        memset(&run, 0, sizeof(run));
+        run.first = run.last = b;
+        run.edge = node.next[b];
+        runs.push_back(run);
+      }
+      NodeRecord record;
+      memset(&record, 0, sizeof(record));
+      record.num_edges = node.edges.size();
+      record.num_runs = runs.size();
+      record.has_match = node.has_match;
+      record.match_rank = node.match_rank;
+      record.match_saves = node.match_saves;
+      Write(os, &record, sizeof(record));
+      Write(os, runs.data(), runs.size() * sizeof(RunRecord));
+      for (auto &edge : node.edges) {
+        EdgeRecord edge_record{edge.target, edge.next, edge.saves};
+        Write(os, &edge_record, sizeof(edge_record));
+      }
+    }
+  }
+
+  if (engines.bitparallel) {
+    auto &automaton = engines.bitparallel->GetAutomaton();
+    BitParallelRecord record;
+    memcpy(record.accept, automaton.accept.data(), sizeof(record.accept));
+    record.start = automaton.start;
+    record.shifted = automaton.shifted;
+    record.finals = automaton.finals;
+    Write(os, &record, sizeof(record));
+    for (auto &table : automaton.tables) {
+      TableRecord table_record;
+      memset(&table_record, 0, sizeof(table_record));
+      table_record.offset = table.first;
+      memcpy(table_record.follow, table.second.data(),
+             sizeof(table_record.follow));
+      Write(os, &table_record, sizeof(table_record));
+    }
+  }
+}
+
+void WriteEntry(std::ostream &os, const CompiledRegexp &cr) {
+  EntryHeader entry;
+  entry.flags = (cr.match_begin ? kMatchBegin : 0) |
+                (cr.match_end ? kMatchEnd : 0) |
+                (cr.dot_star_begin ? kDotStarBegin : 0) |
+                (cr.dot_star_end ? kDotStarEnd : 0) |
+                (cr.kind == LEFTMOST_FIRST ? kLeftmostFirst : 0);
+  entry.sizes[0] = cr.program.size();
+  entry.sizes[1] = cr.expanded.size();
+  entry.sizes[2] = cr.reversed.size();
+  Write(os, &entry, sizeof(entry));
+  WriteProgram(os, cr.program);
+  WriteProgram(os, cr.expanded);
+  WriteProgram(os, cr.reversed);
+  WriteEngines(os, cr.engines ? *cr.engines : CreateCompiledEngines(cr));
+}
+
+// Copy n bytes at offset of length bytes from data to p, and advance offset.
+void Read(const char *data, size_t length, uint64_t &offset, void *p,
+          size_t n) {
+  if (offset > length || length - offset < n)
+    throw std::runtime_error("Invalid program file.");
+  memcpy(p, data + offset, n);
+  offset += n;
+}
+
+// Return true if saves has a slot from num_slots.
+bool OutOfSlots(uint64_t saves, uint32_t num_slots) {
+  return num_slots < 64 && (saves >> num_slots) != 0;
+}
+
+// Read engines of cr at offset of length bytes from data. Fields are checked
+// like instructions, so that invalid data can't make OnePass or BitParallel
+// read out of their tables.
+shared_ptr<const CompiledEngines> ReadEngines(const char *data, size_t length,
+                                              uint64_t offset,
+                                              const CompiledRegexp &cr) {
+  EngineHeader header;
+  Read(data, length, offset, &header, sizeof(header));
+  bool has_programs = !cr.expanded.empty() && !cr.reversed.empty();
+  if ((header.flags & ~(kHasOnePass | kHasBitParallel | kNullable)) ||
+      (!has_programs && (header.flags & (kHasOnePass | kHasBitParallel))))
+    throw std::runtime_error("Invalid program file.");
+
+  if (length - offset < header.prefix_size)
+    throw std::runtime_error("Invalid program file.");
+  string prefix(data + offset, header.prefix_size);
+  offset += header.prefix_size;
+  std::bitset<256> first_bytes;
+  for (int ch = 0; ch < 256; ++ch)
+    first_bytes[ch] = header.first_bytes[ch / 64] >> (ch % 64) & 1;
+  auto engines = std::make_shared<CompiledEngines>(
+      CompiledEngines{prefix, ByteSet(first_bytes), nullptr, nullptr});
+
+  if (header.flags & kHasOnePass) {
+    // OnePass has a pair of slots for each group of the program.
+    uint32_t num_slots = 0;
+    for (auto &instr : cr.program) {
+      if (instr->opcode == SAVE && num_slots <= instr->save_idx)
+        num_slots = instr->save_idx + 1;
+    }
+    num_slots += num_slots % 2;
+    if (header.num_nodes == 0 || header.num_slots != num_slots ||
+        num_slots > 64)
+      throw std::runtime_error("Invalid program file.");
+
+    vector<OnePass::Node> nodes;
+    for (uint32_t idx = 0; idx < header.num_nodes; ++idx) {
+      NodeRecord record;
+      Read(data, length, offset, &record, sizeof(record));
+      if (record.match_rank > record.num_edges ||
+          OutOfSlots(record.match_saves, num_slots))
+        throw std::runtime_error("Invalid program file.");
+      OnePass::Node node;
+      node.next.fill(-1);
+      node.has_match = record.has_match;
+      node.match_saves = record.match_saves;
+      node.match_rank = record.match_rank;
+      for (uint32_t r = 0; r < record.num_runs; ++r) {
+        RunRecord run;
+        Read(data, length, offset, &run, sizeof(run));
+        if (run.first > run.last || run.edge >= record.num_edges)
+          throw std::runtime_error("Invalid program file.");
+        for (int b = run.first; b <= run.last; ++b) node.next[b] = run.edge;
+      }
+      for (uint32_t e = 0; e < record.num_edges; ++e) {
+        EdgeRecord edge;
+        Read(data, length, offset, &edge, sizeof(edge));
+        if (edge.target >= cr.expanded.size() ||
+            edge.next >= header.num_nodes || OutOfSlots(edge.saves, num_slots))
+          throw std::runtime_error("Invalid program file.");
+        node.edges.push_back(OnePass::Edge{edge.target, edge.next, edge.saves});
+      }
+      nodes.push_back(std::move(node));
+    }
+    engines->onepass = std::make_shared<OnePass>(std::move(nodes), num_slots);
+  }
+
+  if (header.flags & kHasBitParallel) {
+    BitParallelRecord record;
+    Read(data, length, offset, &record, sizeof(record));
+    BitParallel::Automaton automaton;
+    memcpy(automaton.accept.data(), record.accept, sizeof(record.accept));
+    automaton.start = record.start;
+    automaton.shifted = record.shifted;
+    automaton.finals = record.finals;
+    automaton.nullable = header.flags & kNullable;
+    // Tables follow 8 positions each of 64 at most.
+    if (header.num_tables > 8)
+      throw std::runtime_error("Invalid program file.");
+    for (uint32_t t = 0; t < header.num_tables; ++t) {
+      TableRecord table;
+      Read(data, length, offset, &table, sizeof(table));
+      if (table.offset >= 64 || table.offset % 8)
+        throw std::runtime_error("Invalid program file.");
+      automaton.tables.emplace_back(table.offset, std::array<uint64_t, 256>());
+      memcpy(automaton.tables.back().second.data(), table.follow,
+             sizeof(table.follow));
+    }
+    engines->bitparallel = std::make_shared<BitParallel>(std::move(automaton));
+  }
+  return engines;
+}
+
+// Read size instruction records from p. Fields are checked, so that invalid
+// data can't make the machine run out of the program. Like compiled programs,
+// each counter must be set by a SET before a CHECK or INCR uses it.
+Program ReadProgram(const char *p, uint32_t size) {
+  Program program(size);
+  vector<bool> counter_set(size);
+  for (uint32_t idx = 0; idx < size; ++idx) {
+    InstructionRecord record;
+    memcpy(&record, p + idx * sizeof(record), sizeof(record));
+    if (record.opcode > JMP || record.dst >= size ||
+        record.save_idx >= 2 * size || record.rpctr_idx >= size)
+      throw std::runtime_error("Invalid program file.");
+    if (record.opcode == SET) {
+      counter_set[record.rpctr_idx] = true;
+    } else if ((record.opcode == CHECK || record.opcode == INCR) &&
+               !counter_set[record.rpctr_idx]) {
+      throw std::runtime_error("Invalid program file.");
+    }
+
+    InstrPtr instr(new Instruction());
+    instr->idx = idx;
+    instr->opcode = static_cast<Opcode>(record.opcode);
+    instr->greedy = record.greedy;
+    instr->c = record.c;
+    instr->fold = record.fold;
+    instr->low_ch = record.low_ch;
+    instr->high_ch = record.high_ch;
+    instr->dst = record.dst;
+    instr->save_idx = record.save_idx;
+    instr->rpctr_idx = record.rpctr_idx;
+    instr->low_times = record.low_times;
+    instr->high_times = record.high_times;
+    instr->value = record.value;
+    program[idx] = instr;
+  }
+  if (program.empty() || program.back()->opcode != MATCH)
+    throw std::runtime_error("Invalid program file.");
+  return program;
+}
+
+// Check the header of length bytes from data, and return it.
+FileHeader ReadHeader(const char *data, size_t length) {
+  FileHeader header;
+  if (length < sizeof(header))
+    throw std::runtime_error("Invalid program file.");
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.byte_order != kByteOrder)
+    throw std::runtime_error("Invalid program file.");
+  if (header.version == 0 || header.version > kProgramFileVersion)
+    throw std::runtime_error("Unsupported program file version.");
+  if ((length - sizeof(header)) / sizeof(uint64_t) < header.count)
+    throw std::runtime_error("Invalid program file.");
+  return header;
+}
+
+// Read entry idx of length bytes from data, saved in version.
+CompiledRegexp ReadEntry(const char *data, size_t length, uint32_t version,
+                         uint32_t idx) {
+  uint64_t offset;
+  memcpy(&offset, data + sizeof(FileHeader) + idx * sizeof(offset),
+         sizeof(offset));
+  EntryHeader entry;
+  if (offset > length || length - offset < sizeof(entry))
+    throw std::runtime_error("Invalid program file.");
+  memcpy(&entry, data + offset, sizeof(entry));
+  offset += sizeof(entry);
+
+  CompiledRegexp cr;
+  cr.match_begin = entry.flags & kMatchBegin;
+  cr.match_end = entry.flags & kMatchEnd;
+  cr.dot_star_begin = entry.flags & kDotStarBegin;
+  cr.dot_star_end = entry.flags & kDotStarEnd;
+  cr.kind = entry.flags & kLeftmostFirst ? LEFTMOST_FIRST : LEFTMOST_LONGEST;
+  Program *programs[3] = {&cr.program, &cr.expanded, &cr.reversed};
+  for (int i = 0; i < 3; ++i) {
+    if ((length - offset) / sizeof(InstructionRecord) < entry.sizes[i])
+      throw std::runtime_error("Invalid program file.");
+    if (entry.sizes[i] == 0 && i > 0) continue;
+    *programs[i] = ReadProgram(data + offset, entry.sizes[i]);
+    offset += entry.sizes[i] * sizeof(InstructionRecord);
+  }
+  // Machines create engines of older versions.
+  if (version >= 5) cr.engines = ReadEngines(data, length, offset, cr);
+  return cr;
+}
+
+};  // namespace
+
+void SavePrograms(const vector<CompiledRegexp> &v, std::ostream &os) {
+  FileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.byte_order = kByteOrder;
+  header.version = kProgramFileVersion;
+  header.count = v.size();
+  Write(os, &header, sizeof(header));
+
+  // Engines vary in size, so entries are written out first for offsets.
+  vector<string> entries;
+  for (auto &cr : v) {
+    std::ostringstream entry;
+    WriteEntry(entry, cr);
+    entries.push_back(entry.str());
+  }
+  uint64_t offset = sizeof(header) + v.size() * sizeof(uint64_t);
+  for (auto &entry : entries) {
+    Write(os, &offset, sizeof(offset));
+    offset += entry.size();
+  }
+  for (auto &entry : entries) Write(os, entry.data(), entry.size());
+}
+
+vector<CompiledRegexp> LoadPrograms(std::istream &is) {
+  string data((std::istreambuf_iterator<char>(is)),
+              std::istreambuf_iterator<char>());
+  FileHeader header = ReadHeader(data.data(), data.size());
+  vector<CompiledRegexp> v;
+  for (uint32_t idx = 0; idx < header.count; ++idx)
+    v.push_back(ReadEntry(data.data(), data.size(), header.version, idx));
+  return v;
+}
+
+ProgramFile::ProgramFile(const string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("Failed to open " + path + ".");
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    throw std::runtime_error("Invalid program file.");
+  }
+  length = st.st_size;
+  void *p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) throw std::runtime_error("Failed to map " + path + ".");
+  data = static_cast<const char *>(p);
+
+  try {
+    FileHeader header = ReadHeader(data, length);
+    version = header.version;
+    count = header.count;
+  } catch (...) {
+    munmap(const_cast<char *>(data), length);
+    throw;
+  }
+}
+
+ProgramFile::~ProgramFile() { munmap(const_cast<char *>(data), length); }
+
+CompiledRegexp ProgramFile::Get(unsigned int idx) const {
+  if (idx >= count) throw std::runtime_error("Program index out of range.");
+  return ReadEntry(data, length, version, idx);
+}
+
+};  // namespace Azuki
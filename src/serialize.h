@@ -0,0 +1,72 @@
+#ifndef __AZUKI_SERIALIZE__
+#define __AZUKI_SERIALIZE__
+
+#include <cstdint>
+#include <iostream>
+#include "common.h"
+#include "machine.h"
+
+namespace Azuki {
+
+// Programs are saved in a versioned binary format, so that many patterns can
+// be loaded without parsing and compiling them again. A file holds:
+//    FileHeader                  magic, byte order, version, number of entries
+//    uint64_t offsets[count]     offset of each entry from the file begin
+//    entries                     EntryHeader followed by InstructionRecords
+// of the program, the expanded program and the reversed program, and the
+// engines (see CompiledEngines). Integers are in native byte order, files of
+// the other byte order are rejected.
+// Version 2 adds flags for removed ".*" (see CompiledRegexp), version 3 the
+// match kind, version 4 case folded CHAR and RANGE instructions, and version
+// 5 the engines, so that creating a Machine from a loaded entry only creates
+// Dfa. Files of older versions are still loaded, with LEFTMOST_LONGEST and
+// without engines.
+const uint32_t kProgramFileVersion = 5;
+
+// Save compiled regexps to os. Throw std::runtime_error if writing fails.
+// Example:
+//    std::ofstream os("patterns.bin", std::ios::binary);
+//    SavePrograms({CreateCompiledRegexp("^a+b$")}, os);
+void SavePrograms(const vector<CompiledRegexp> &v, std::ostream &os);
+
+// Load all compiled regexps saved by SavePrograms from is. Throw
+// std::runtime_error if the data is invalid or of another version.
+// Example:
+//    std::ifstream is("patterns.bin", std::ios::binary);
+//    vector<CompiledRegexp> v = LoadPrograms(is);
+vector<CompiledRegexp> LoadPrograms(std::istream &is);
+
+// The ProgramFile class maps a file saved by SavePrograms into memory
+// read-only. Opening it only checks the header, and each entry is read in
+// place when it's requested, so startup doesn't depend on the number of
+// patterns in the file.
+// Example:
+//    ProgramFile file("patterns.bin");
+//    Machine m(file.Get(42));
+class ProgramFile {
+ public:
+  // Map file at path. Throw std::runtime_error if the file can't be mapped
+  // or its header is invalid.
+  explicit ProgramFile(const string &path);
+  ~ProgramFile();
+
+  ProgramFile(const ProgramFile &) = delete;
+  ProgramFile &operator=(const ProgramFile &) = delete;
+
+  // Number of compiled regexps in the file.
+  unsigned int size() const { return count; }
+
+  // Read the compiled regexp at index idx. Throw std::runtime_error if idx is
+  // out of range or the entry is invalid.
+  CompiledRegexp Get(unsigned int idx) const;
+
+ private:
+  const char *data;  // mapped file
+  size_t length;     // bytes of the file
+  uint32_t version;  // version of the file
+  uint32_t count;    // number of entries
+};
+
+};  // namespace Azuki
+
+#endif  // __AZUKI_SERIALIZE__
@@ -0,0 +1,712 @@
+#ifndef __AZUKI_STATIC_REGEX__
+#define __AZUKI_STATIC_REGEX__
+
+#if __cplusplus < 202002L
+#error "static_regex.h requires C++20."
+#endif
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include "common.h"
+#include "instruction.h"
+#include "machine.h"
+#include "utility.h"
+
+namespace Azuki {
+
+// The FixedString struct holds a string literal, so that a regular expression
+// can be passed as template argument.
+template <size_t N>
+struct FixedString {
+  char data[N] = {};
+
+  constexpr FixedString(const char (&s)[N]) { std::copy_n(s, N, data); }
+  constexpr size_t size() const { return N - 1; }
+};
+
+namespace internal {
+
+// The StaticNode struct is the compile time counterpart of Regexp. Children
+// are referenced with indices into the node vector.
+struct StaticNode {
+  RegexpType type = LIT;
+  char c = 0;
+  int left = -1, right = -1;
+  char low_ch = 0, high_ch = 0;
+  int low_times = 0, high_times = 0;
+  unsigned int group = 0;  // capture group index (PAREN)
+};
+
+// The StaticInstruction struct is the compile time counterpart of Instruction.
+struct StaticInstruction {
+  Opcode opcode = MATCH;
+  char c = 0;
+  unsigned int dst = 0;
+  bool greedy = false;
+  unsigned int save_idx = 0;
+  char low_ch = 0, high_ch = 0;
+};
+
+// The StaticEdge struct is an edge in the epsilon closure of an instruction:
+// the consuming (or MATCH) instruction it reaches and the SAVE slots it passes.
+struct StaticEdge {
+  unsigned int target = 0;
+  uint64_t saves = 0;
+  unsigned int level = 0;  // epsilon instructions followed to reach target
+};
+
+constexpr bool IsSpaceChar(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' ||
+         c == '\v';
+}
+
+constexpr bool IsAlnumChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9');
+}
+
+constexpr bool IsConsuming(Opcode opcode) {
+  return opcode == ANY || opcode == ANY_WORD || opcode == ANY_DIGIT ||
+         opcode == ANY_SPACE || opcode == CHAR || opcode == RANGE;
+}
+
+// The StaticParser class parses a regular expression in constant evaluation.
+// It accepts the syntax of ParseRegexp without flags (UTF8, CASE_INSENSITIVE
+// or NO_CAPTURE): characters and escapes, '.', \d, \s, \w, [a-z], groups
+// "(...)" and "(?:...)", '|', and greedy '*', '+', '?' and {t1,t2}, skipping
+// whitespace between tokens. Lazy quantifiers ("*?", ...) and trailing input
+// that can't be parsed are rejected.
+class StaticParser {
+ public:
+  constexpr StaticParser(const char *s, size_t n) : s(s), n(n) {}
+
+  constexpr int Parse() {
+    int root = Alt();
+    if (Peek() != '\0') throw std::runtime_error("Invalid regular expression.");
+    return root;
+  }
+
+  vector<StaticNode> nodes;
+  unsigned int groups = 0;
+
+ private:
+  constexpr char Peek() {
+    while (pos < n && IsSpaceChar(s[pos])) ++pos;
+    return pos < n ? s[pos] : '\0';
+  }
+
+  constexpr char Next() {
+    char c = Peek();
+    if (c == '\0') throw std::runtime_error("Invalid regular expression.");
+    ++pos;
+    return c;
+  }
+
+  constexpr void Expect(char c) {
+    if (Next() != c) throw std::runtime_error("Invalid regular expression.");
+  }
+
+  constexpr int Add(StaticNode node) {
+    nodes.push_back(node);
+    return nodes.size() - 1;
+  }
+
+  constexpr int Wrap(RegexpType type, int left) {
+    StaticNode node;
+    node.type = type;
+    node.left = left;
+    return Add(node);
+  }
+
+  constexpr int Number() {
+    if (Peek() < '0' || Peek() > '9')
+      throw std::runtime_error("Invalid regular expression.");
+    int value = 0;
+    while (pos < n && s[pos] >= '0' && s[pos] <= '9')
+      value = value * 10 + (s[pos++] - '0');
+    return value;
+  }
+
+  constexpr bool StartsSingle(char c) {
+    const char *others = "([\\.~!@#%&=:;,_<>-";
+    for (; *others; ++others) {
+      if (c == *others) return true;
+    }
+    return IsAlnumChar(c);
+  }
+
+  constexpr int Alt() {
+    int left = Concat();
+    if (Peek() != '|') return left;
+    ++pos;
+    StaticNode node;
+    node.type = ALT;
+    node.left = left;
+    node.right = Alt();
+    return Add(node);
+  }
+
+  constexpr int Concat() {
+    int left = Repeat();
+    if (!StartsSingle(Peek())) return left;
+    StaticNode node;
+    node.type = CAT;
+    node.left = left;
+    node.right = Concat();
+    return Add(node);
+  }
+
+  constexpr int Repeat() {
+    int left = Single();
+    char c = Peek();
+    if (c == '+' || c == '?' || c == '*') {
+      ++pos;
+      return Wrap(c == '+' ? PLUS : (c == '?' ? QUEST : STAR), left);
+    }
+    if (c != '{') return left;
+    ++pos;
+    StaticNode node;
+    node.type = CURLY;
+    node.left = left;
+    node.low_times = node.high_times = Number();
+    if (Peek() == ',') {
+      ++pos;
+      node.high_times = Peek() == '}' ? INT_MAX : Number();
+    }
+    Expect('}');
+    // A counter of Emit never lets "{0}" match, which can't be unrolled.
+    if (node.low_times > node.high_times || node.high_times == 0)
+      throw std::runtime_error("Invalid regular expression.");
+    return Add(node);
+  }
+
+  constexpr int Single() {
+    char c = Next();
+    StaticNode node;
+    if (c == '(' && Peek() == '?') {
+      // Non-capturing groups are kept as their items, without PAREN.
+      ++pos;
+      Expect(':');
+      int left = Alt();
+      Expect(')');
+      return left;
+    } else if (c == '(') {
+      node.type = PAREN;
+      node.group = groups++;
+      node.left = Alt();
+      Expect(')');
+    } else if (c == '[') {
+      node.type = SQUARE;
+      node.low_ch = Next();
+      Expect('-');
+      node.high_ch = Next();
+      Expect(']');
+      if (node.low_ch > node.high_ch)
+        throw std::runtime_error("Invalid regular expression.");
+    } else if (c == '\\') {
+      node.c = Next();
+      if (node.c == 'd' || node.c == 's' || node.c == 'w') {
+        node.type = CLASS;
+      } else {
+        bool special = false;
+        for (const char *p = ".+?*|\\()[]{}"; *p; ++p)
+          special = special || node.c == *p;
+        if (!special) throw std::runtime_error("Invalid escaped character.");
+        node.type = LIT;
+      }
+    } else if (c == '.') {
+      node.type = DOT;
+    } else if (StartsSingle(c)) {
+      node.type = LIT;
+      node.c = c;
+    } else {
+      throw std::runtime_error("Invalid regular expression.");
+    }
+    return Add(node);
+  }
+
+  const char *s;
+  size_t n;
+  size_t pos = 0;
+};
+
+// Emit instructions like Emit in instruction.cpp. CURLY is unrolled into
+// copies of its item instead of using counters, so the program is a plain
+// NFA. Like the counters of Emit, the item is matched at least once even if
+// the low bound is 0.
+constexpr void StaticEmit(const vector<StaticNode> &nodes, int idx,
+                          vector<StaticInstruction> &program) {
+  const StaticNode &node = nodes[idx];
+  StaticInstruction instr;
+  switch (node.type) {
+    case ALT: {
+      unsigned int split_pc = program.size();
+      instr.opcode = SPLIT;
+      program.push_back(instr);
+      StaticEmit(nodes, node.left, program);
+      unsigned int jmp_pc = program.size();
+      instr.opcode = JMP;
+      program.push_back(instr);
+      program[split_pc].dst = jmp_pc + 1;
+      StaticEmit(nodes, node.right, program);
+      program[jmp_pc].dst = program.size();
+      break;
+    }
+    case CAT:
+      StaticEmit(nodes, node.left, program);
+      StaticEmit(nodes, node.right, program);
+      break;
+    case CLASS:
+      instr.opcode =
+          node.c == 'w' ? ANY_WORD : (node.c == 'd' ? ANY_DIGIT : ANY_SPACE);
+      program.push_back(instr);
+      break;
+    case CURLY: {
+      int low_times = node.low_times > 0 ? node.low_times : 1;
+      for (int i = 0; i < low_times; ++i)
+        StaticEmit(nodes, node.left, program);
+      if (node.high_times == INT_MAX) {
+        StaticNode star;
+        star.type = STAR;
+        star.left = node.left;
+        vector<StaticNode> temp = nodes;
+        temp.push_back(star);
+        StaticEmit(temp, temp.size() - 1, program);
+      } else {
+        vector<unsigned int> splits;
+        for (int i = low_times; i < node.high_times; ++i) {
+          splits.push_back(program.size());
+          instr.opcode = SPLIT;
+          program.push_back(instr);
+          StaticEmit(nodes, node.left, program);
+        }
+        for (auto pc : splits) program[pc].dst = program.size();
+      }
+      break;
+    }
+    case DOT:
+      instr.opcode = ANY;
+      program.push_back(instr);
+      break;
+    case LIT:
+      instr.opcode = CHAR;
+      instr.c = node.c;
+      program.push_back(instr);
+      break;
+    case PAREN:
+      instr.opcode = SAVE;
+      instr.save_idx = 2 * node.group;
+      program.push_back(instr);
+      StaticEmit(nodes, node.left, program);
+      instr.save_idx = 2 * node.group + 1;
+      program.push_back(instr);
+      break;
+    case PLUS: {
+      unsigned int current_pc = program.size();
+      StaticEmit(nodes, node.left, program);
+      instr.opcode = SPLIT;
+      instr.dst = program.size() + 2;
+      program.push_back(instr);
+      instr = StaticInstruction();
+      instr.opcode = JMP;
+      instr.dst = current_pc;
+      program.push_back(instr);
+      break;
+    }
+    case QUEST: {
+      unsigned int split_pc = program.size();
+      instr.opcode = SPLIT;
+      program.push_back(instr);
+      StaticEmit(nodes, node.left, program);
+      program[split_pc].dst = program.size();
+      break;
+    }
+    case STAR: {
+      unsigned int split_pc = program.size();
+      instr.opcode = SPLIT;
+      program.push_back(instr);
+      StaticEmit(nodes, node.left, program);
+      instr = StaticInstruction();
+      instr.opcode = JMP;
+      instr.dst = split_pc;
+      program.push_back(instr);
+      program[split_pc].dst = program.size();
+      break;
+    }
+    case SQUARE:
+      instr.opcode = RANGE;
+      instr.low_ch = node.low_ch;
+      instr.high_ch = node.high_ch;
+      program.push_back(instr);
+      break;
+  }
+}
+
+// The StaticCompiled struct holds everything computed from a pattern in
+// constant evaluation.
+struct StaticCompiled {
+  vector<StaticInstruction> program;
+  vector<StaticEdge> edges;
+  vector<unsigned int> offsets;  // edges of closure(pc) are in
+                                 // [offsets[pc], offsets[pc + 1])
+  unsigned int groups = 0;
+  bool match_begin = false, match_end = false;
+};
+
+// Walk the epsilon closure of pc breadth first, in the order the ready queue
+// of Machine::Interpret visits it, so the edges are in Machine's priority
+// order. Only the first path reaching an instruction is kept.
+constexpr void StaticClosure(const vector<StaticInstruction> &program,
+                             unsigned int pc, vector<StaticEdge> &edges) {
+  vector<bool> visited(program.size(), false);
+  vector<StaticEdge> queue = {StaticEdge{pc, 0, 0}};
+  for (size_t i = 0; i < queue.size(); ++i) {
+    StaticEdge item = queue[i];
+    if (visited[item.target]) continue;
+    visited[item.target] = true;
+    const StaticInstruction &instr = program[item.target];
+    if (instr.opcode == JMP) {
+      queue.push_back(StaticEdge{instr.dst, item.saves, item.level + 1});
+    } else if (instr.opcode == SPLIT) {
+      unsigned int first = instr.greedy ? instr.dst : item.target + 1;
+      unsigned int second = instr.greedy ? item.target + 1 : instr.dst;
+      queue.push_back(StaticEdge{first, item.saves, item.level + 1});
+      queue.push_back(StaticEdge{second, item.saves, item.level + 1});
+    } else if (instr.opcode == SAVE) {
+      queue.push_back(
+          StaticEdge{item.target + 1,
+                     item.saves | (uint64_t(1) << instr.save_idx),
+                     item.level + 1});
+    } else {
+      edges.push_back(item);
+    }
+  }
+}
+
+template <size_t N>
+constexpr StaticCompiled StaticCompile(const FixedString<N> &pattern) {
+  StaticCompiled compiled;
+  const char *e = pattern.data;
+  size_t begin = 0, end = pattern.size();
+  compiled.match_begin = end > 0 && e[0] == '^';
+  compiled.match_end = end > begin && e[end - 1] == '$' &&
+                       !(end > 1 && e[end - 2] == '\\');
+  if (compiled.match_begin) ++begin;
+  if (compiled.match_end) --end;
+
+  StaticParser parser(e + begin, end - begin);
+  int root = parser.Parse();
+  compiled.groups = parser.groups;
+  if (2 * compiled.groups > 64)
+    throw std::runtime_error("Too many capture groups.");
+  StaticEmit(parser.nodes, root, compiled.program);
+  compiled.program.push_back(StaticInstruction());  // MATCH
+
+  for (unsigned int pc = 0; pc <= compiled.program.size(); ++pc) {
+    compiled.offsets.push_back(compiled.edges.size());
+    if (pc == compiled.program.size()) break;
+    if (pc > 0 && !IsConsuming(compiled.program[pc - 1].opcode)) continue;
+    StaticClosure(compiled.program, pc, compiled.edges);
+  }
+  return compiled;
+}
+
+// The StaticProgram struct stores the compiled pattern in constexpr arrays.
+template <FixedString Pattern>
+struct StaticProgram {
+  static constexpr size_t size = StaticCompile(Pattern).program.size();
+  static constexpr size_t num_edges = StaticCompile(Pattern).edges.size();
+  static constexpr unsigned int groups = StaticCompile(Pattern).groups;
+  static constexpr bool match_begin = StaticCompile(Pattern).match_begin;
+  static constexpr bool match_end = StaticCompile(Pattern).match_end;
+
+  static constexpr std::array<StaticInstruction, size> program = [] {
+    std::array<StaticInstruction, size> a;
+    auto v = StaticCompile(Pattern).program;
+    std::copy(v.begin(), v.end(), a.begin());
+    return a;
+  }();
+
+  static constexpr std::array<StaticEdge, num_edges> edges = [] {
+    std::array<StaticEdge, num_edges> a;
+    auto v = StaticCompile(Pattern).edges;
+    std::copy(v.begin(), v.end(), a.begin());
+    return a;
+  }();
+
+  static constexpr std::array<unsigned int, size + 1> offsets = [] {
+    std::array<unsigned int, size + 1> a{};
+    auto v = StaticCompile(Pattern).offsets;
+    std::copy(v.begin(), v.end(), a.begin());
+    return a;
+  }();
+};
+
+};  // namespace internal
+
+// The StaticRegex class is a regular expression parsed and compiled at compile
+// time. The matcher runs the same lock-step simulation as Machine::Run (with
+// leftmost longest semantics), but every instruction is a template
+// instantiation, so the compiler unrolls the loop over the program and folds
+// the opcode dispatch and the epsilon closures away.
+// Positional anchors '^' and '$' are handled like CreateMachine. Counters
+// ({t1,t2}) are unrolled, so keep their bounds small.
+// Example:
+//    StaticRegex<"(233+)"> m;
+//    MatchResult ms;
+//    RegexSearch(m, "6662333QAQ", ms);  // true, ms.capture = {"2333"}
+template <FixedString Pattern>
+class StaticRegex {
+  typedef internal::StaticProgram<Pattern> P;
+
+ public:
+  static constexpr bool match_begin = P::match_begin;
+  static constexpr bool match_end = P::match_end;
+
+  // Return the number of instructions in the compiled program.
+  static constexpr size_t ProgramSize() { return P::size; }
+
+  // Run program on input string s, like Machine::Run.
+  // If save_capture is true, then capture groups will be saved.
+  MatchResult Run(string_view s, bool save_capture = true) const {
+    return save_capture ? RunImpl<true>(s) : RunImpl<false>(s);
+  }
+
+ private:
+  static constexpr unsigned int kUnset = UINT_MAX;
+  static constexpr size_t kSlots = 2 * P::groups;
+  // Threads consume in rank order, and the new thread of each step comes last.
+  static constexpr unsigned int kSeedRank = P::size;
+
+  struct Thread {
+    unsigned int generation = 0;  // alive if equal to generation of the list
+    unsigned int begin = 0;
+    unsigned int rank = 0;   // position among the live threads of the list
+    uint64_t priority = 0;   // position in the ready queue of Machine
+    std::array<unsigned int, kSlots> saved;
+  };
+
+  struct ThreadList {
+    unsigned int generation = 1;
+    unsigned int live = 0;
+    std::array<unsigned int, P::size> pcs;  // pcs of the live threads
+    std::array<Thread, P::size> threads;
+  };
+
+  struct State {
+    bool success = false;
+    unsigned int begin = 0, end = 0;
+    unsigned int min_end = 0;  // matches ending before min_end are ignored
+    uint64_t priority = 0;
+    std::array<unsigned int, kSlots> saved;
+  };
+
+  // Machine::Interpret runs a step breadth first: the threads reaching an
+  // instruction after fewer epsilon moves come first, then the ones started
+  // from a thread consuming earlier, then the ones on the preferred branch.
+  template <size_t E>
+  static uint64_t Priority(const Thread &t, size_t index) {
+    constexpr uint64_t kRanks = P::size + 1;
+    return (P::edges[E].level * kRanks + t.rank) * kRanks + index;
+  }
+
+  // Order the live threads of list like Machine orders its next threads.
+  static void Rank(ThreadList &list) {
+    auto &pcs = list.pcs;
+    for (unsigned int i = 1; i < list.live; ++i) {
+      unsigned int pc = pcs[i], j = i;
+      for (; j > 0 && list.threads[pcs[j - 1]].priority >
+                          list.threads[pc].priority;
+           --j)
+        pcs[j] = pcs[j - 1];
+      pcs[j] = pc;
+    }
+    for (unsigned int i = 0; i < list.live; ++i) list.threads[pcs[i]].rank = i;
+  }
+
+  template <uint64_t kSaves>
+  static void ApplySaves(std::array<unsigned int, kSlots> &saved,
+                         unsigned int pos) {
+    for (size_t slot = 0; slot < kSlots; ++slot) {
+      if (kSaves & (uint64_t(1) << slot)) saved[slot] = pos;
+    }
+  }
+
+  template <bool kCapture, size_t E>
+  static void AddEdge(ThreadList &next, const Thread &t, unsigned int pos,
+                      uint64_t priority, State &state) {
+    constexpr internal::StaticEdge edge = P::edges[E];
+    if constexpr (P::program[edge.target].opcode == MATCH) {
+      // Keep the leftmost longest match, like Machine::UpdateResult. Of the
+      // matches ending together, the first one in Machine's queue wins.
+      if (pos < state.min_end) return;
+      if (state.success &&
+          (t.begin > state.begin ||
+           (t.begin == state.begin &&
+            (pos < state.end ||
+             (pos == state.end && priority >= state.priority)))))
+        return;
+      state.success = true;
+      state.begin = t.begin;
+      state.end = pos;
+      state.priority = priority;
+      if constexpr (kCapture) {
+        state.saved = t.saved;
+        ApplySaves<edge.saves>(state.saved, pos);
+      }
+    } else {
+      Thread &nt = next.threads[edge.target];
+      if (nt.generation == next.generation) {
+        // A thread started earlier, or ahead in the queue, already reached
+        // this instruction.
+        if (nt.begin < t.begin ||
+            (nt.begin == t.begin && nt.priority <= priority))
+          return;
+      } else {
+        next.pcs[next.live++] = edge.target;
+      }
+      nt.generation = next.generation;
+      nt.begin = t.begin;
+      nt.priority = priority;
+      if constexpr (kCapture) {
+        nt.saved = t.saved;
+        ApplySaves<edge.saves>(nt.saved, pos);
+      }
+    }
+  }
+
+  // Add threads in the epsilon closure of instruction pc.
+  template <bool kCapture, size_t kPc>
+  static void Follow(ThreadList &next, const Thread &t, unsigned int pos,
+                     State &state) {
+    constexpr size_t first = P::offsets[kPc];
+    constexpr size_t last = P::offsets[kPc + 1];
+    [&]<size_t... E>(std::index_sequence<E...>) {
+      (AddEdge<kCapture, first + E>(next, t, pos,
+                                    Priority<first + E>(t, E), state),
+       ...);
+    }(std::make_index_sequence<last - first>());
+  }
+
+  template <size_t kPc>
+  static bool Consume(char ch) {
+    constexpr internal::StaticInstruction instr = P::program[kPc];
+    if constexpr (instr.opcode == ANY)
+      return true;
+    else if constexpr (instr.opcode == ANY_WORD ||
+                       instr.opcode == ANY_DIGIT || instr.opcode == ANY_SPACE)
+      return InClass(instr.opcode, ch);
+    else if constexpr (instr.opcode == CHAR)
+      return ch == instr.c;
+    else
+      return ch >= instr.low_ch && ch <= instr.high_ch;
+  }
+
+  template <bool kCapture, size_t kPc>
+  static void StepOne(const ThreadList &current, ThreadList &next, char ch,
+                      unsigned int pos, State &state) {
+    if constexpr (internal::IsConsuming(P::program[kPc].opcode)) {
+      const Thread &t = current.threads[kPc];
+      if (t.generation == current.generation && Consume<kPc>(ch))
+        Follow<kCapture, kPc + 1>(next, t, pos, state);
+    }
+  }
+
+  template <bool kCapture, size_t... I>
+  static void Step(const ThreadList &current, ThreadList &next, char ch,
+                   unsigned int pos, State &state, std::index_sequence<I...>) {
+    (StepOne<kCapture, I>(current, next, ch, pos, state), ...);
+  }
+
+  template <bool kCapture>
+  static MatchResult RunImpl(string_view s) {
+    ThreadList lists[2];
+    ThreadList *current = &lists[0], *next = &lists[1];
+    State state;
+    state.min_end = match_end ? s.size() : 0;
+
+    Thread seed;
+    seed.rank = kSeedRank;
+    seed.saved.fill(kUnset);
+    Follow<kCapture, 0>(*current, seed, 0, state);
+    Rank(*current);
+
+    for (unsigned int idx = 0; idx < s.size(); ++idx) {
+      // No thread can produce a better match.
+      if (current->live == 0 && (match_begin || state.success)) break;
+
+      ++next->generation;
+      next->live = 0;
+      Step<kCapture>(*current, *next, s[idx], idx + 1, state,
+                     std::make_index_sequence<P::size>());
+      // Threads started later can't beat a match found already.
+      if (!match_begin && !state.success) {
+        seed.begin = idx + 1;
+        Follow<kCapture, 0>(*next, seed, idx + 1, state);
+      }
+      Rank(*next);
+      std::swap(current, next);
+    }
+
+    MatchResult result;
+    result.success = state.success;
+    result.begin = state.begin;
+    result.end = state.end;
+    if (kCapture && state.success) {
+      result.input = s.data();
+      for (size_t i = 0; i < kSlots; i += 2) {
+        if (state.saved[i] == kUnset || state.saved[i + 1] == kUnset)
+          result.spans.push_back(std::make_pair(UINT_MAX, UINT_MAX));
+        else
+          result.spans.push_back(
+              std::make_pair(state.saved[i], state.saved[i + 1]));
+      }
+    }
+    return result;
+  }
+};
+
+// Overloads of RegexSearch and RegexReplace in azuki.h for StaticRegex.
+template <FixedString Pattern>
+bool RegexSearch(const StaticRegex<Pattern> &m, string_view s) {
+  return m.Run(s, false).success;
+}
+
+template <FixedString Pattern>
+bool RegexSearch(const StaticRegex<Pattern> &m, string_view s,
+                 MatchResult &result, bool save_capture = true) {
+  // An empty match may end s, so the search may begin at s.size().
+  unsigned int offset = result.end;
+  if (offset > s.size() || (offset > 0 && StaticRegex<Pattern>::match_begin))
+    return false;
+
+  auto temp = m.Run(s.substr(offset), save_capture);
+  if (!temp.success) return false;
+  ShiftMatchResult(temp, offset);
+  result = std::move(temp);
+  return result.success;
+}
+
+template <FixedString Pattern>
+string RegexReplace(const StaticRegex<Pattern> &m, const string &s,
+                    const string &fmt, bool replace_global = false) {
+  string output;
+  unsigned int pos = 0;
+  MatchResult ms = m.Run(s, true);
+  while (ms.success) {
+    output += s.substr(pos, ms.begin - pos) + CreateNewSubs(fmt, ms.capture);
+    pos = ms.end;
+    // After an empty match, search again from the next character.
+    if (ms.begin == ms.end) ++ms.end;
+    if (!replace_global || !RegexSearch(m, s, ms, true)) break;
+  }
+  return output + s.substr(pos);
+}
+
+};  // namespace Azuki
+
+#endif  // __AZUKI_STATIC_REGEX__
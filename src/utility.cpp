@@ -1,4 +1,7 @@
 #include <algorithm>
+#include <cctype>
+#include <sstream>
+#include <stdexcept>
 #include "utility.h"
 
 namespace Azuki {
@@ -21,4 +24,30 @@ bool EndsWith(const string &s, const string &suffix) {
   return std::equal(suffix.rbegin(), suffix.rend(), s.rbegin());
 }
 
+string CreateNewSubs(const string &fmt, const vector<string> &capture) {
+  std::stringstream ss;
+  unsigned idx = 0;
+  while (idx < fmt.size()) {
+    if (fmt[idx] != '$') {
+      ss << fmt[idx++];
+    } else {
+      ++idx;
+      if (idx >= fmt.size())
+        throw std::runtime_error("Unexpected format string.");
+      if (fmt[idx] == '$') {
+        ss << '$';
+        ++idx;
+      } else if (isdigit(fmt[idx])) {
+        int ref_id = 0;
+        for (; idx < fmt.size() && isdigit(fmt[idx]); ++idx)
+          ref_id = ref_id * 10 + (fmt[idx] - '0');
+        ss << capture[ref_id];
+      } else {
+        throw std::runtime_error("Unexpected format string.");
+      }
+    }
+  }
+  return ss.str();
+}
+
 };  // namespace Azuki
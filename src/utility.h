@@ -13,6 +13,12 @@ bool StartsWith(const string &s, const string &prefix);
 bool EndsWith(const string &s, char suffix);
 bool EndsWith(const string &s, const string &suffix);
 
+// Create new substring from format string fmt, where "$0", "$1", etc. are
+// replaced with capture groups and "$$" with a single '$' character.
+// Example:
+//    CreateNewSubs("$0c", {"aa"});   // "aac"
+string CreateNewSubs(const string &fmt, const vector<string> &capture);
+
 };  // namespace Azuki
 
 #endif  // __AZUKI_UTILITY__
@@ -0,0 +1,192 @@
+#ifndef __AZUKI_TEST_CASES__
+#define __AZUKI_TEST_CASES__
+
+#include "azuki.h"
+
+namespace Azuki {
+
+// A pattern built with the Create*Regexp functions, and inputs which a
+// machine anchored at the begin matches or not.
+struct MachineCase {
+  string pattern;  // for messages
+  RegexpPtr regexp;
+  vector<string> matched, unmatched;
+};
+
+// Cases of test_machine.cpp, which test_jit.cpp runs with the JIT too.
+inline vector<MachineCase> MachineCases() {
+  return {
+      {"a", CreateLitRegexp('a'), {"a", "abc"}, {"b", "bac"}},
+      {"ab", CreateCatRegexp(CreateLitRegexp('a'), CreateLitRegexp('b')),
+       {"ab", "abc"}, {"a", "bab"}},
+      {".b", CreateCatRegexp(CreateDotRegexp(), CreateLitRegexp('b')),
+       {"ab", "cba"}, {"b", "cab"}},
+      {"a|b", CreateAltRegexp(CreateLitRegexp('a'), CreateLitRegexp('b')),
+       {"a", "b"}, {"c"}},
+      {"a+", CreatePlusRegexp(CreateLitRegexp('a')), {"a", "aa"}, {"b"}},
+      {"a?b",
+       CreateCatRegexp(CreateQuestRegexp(CreateLitRegexp('a')),
+                       CreateLitRegexp('b')),
+       {"b", "ab"}, {"cab"}},
+      {"a*b",
+       CreateCatRegexp(CreateStarRegexp(CreateLitRegexp('a')),
+                       CreateLitRegexp('b')),
+       {"b", "ab", "aaab"}, {"cab"}},
+      {"(a+)", CreateParenRegexp(CreatePlusRegexp(CreateLitRegexp('a'))),
+       {"a", "aa"}, {"b", "baac"}},
+      {"\\w+", CreatePlusRegexp(CreateClassRegexp('w')), {"ab_12", "12_ab"},
+       {"\ta1", "?a1"}},
+      {"\\d+", CreatePlusRegexp(CreateClassRegexp('d')), {"1234", "023"},
+       {" 12", "a1"}},
+      {"\\s+", CreatePlusRegexp(CreateClassRegexp('s')), {"  a1", "\t\ra1"},
+       {"a1", "?a1"}},
+      {"[a-c]+", CreatePlusRegexp(CreateSquareRegexp('a', 'c')),
+       {"abc", "cabac"}, {"1a2", " ab"}},
+      {"a{3,5}", CreateCurlyRegexp(CreateLitRegexp('a'), 3, 5),
+       {"aaa", "aaaaa"}, {"aa", "ab"}},
+  };
+}
+
+// A match found by RegexSearch.
+struct Found {
+  unsigned int begin, end;
+  vector<string> capture;
+};
+
+// A pattern, compiled with CreateMachine, and the matches RegexSearch finds in
+// input one after another. After an empty match, the search goes on from the
+// next character.
+struct SearchCase {
+  string pattern;
+  int flags;  // see RegexOptions
+  MatchKind kind;
+  string input;
+  vector<Found> found;
+};
+
+inline Machine CreateCaseMachine(const SearchCase &c) {
+  RegexOptions options;
+  options.flags = c.flags;
+  options.match_kind = c.kind;
+  return CreateMachine(c.pattern, options);
+}
+
+// Cases of test_azuki.cpp, which test_jit.cpp runs with the JIT too.
+inline vector<SearchCase> SearchCases() {
+  return {
+      {"a+b", 0, LEFTMOST_LONGEST, "cabd", {{1, 3, {}}}},
+      {"a+b", 0, LEFTMOST_LONGEST, "aabcab", {{0, 3, {}}, {4, 6, {}}}},
+      {"a+b", 0, LEFTMOST_LONGEST, "b", {}},
+      {"a+b", 0, LEFTMOST_LONGEST, "cbaa", {}},
+      {"a+b", 0, LEFTMOST_LONGEST, "caabdabe", {{1, 4, {}}, {5, 7, {}}}},
+      {"a+b", 0, LEFTMOST_LONGEST, "alice", {}},
+      {"(ab)+", 0, LEFTMOST_LONGEST, "cabd", {{1, 3, {"ab"}}}},
+      {"(ab)+", 0, LEFTMOST_LONGEST, "cababad", {{1, 5, {"ab"}}}},
+      {"(ab)+", 0, LEFTMOST_LONGEST, "ba", {}},
+      {"(ab)+", 0, LEFTMOST_LONGEST, "a b", {}},
+      {"(ab)+", 0, LEFTMOST_LONGEST,
+       "dabcccababd", {{1, 3, {"ab"}}, {6, 10, {"ab"}}}},
+      {"^a+b", 0, LEFTMOST_LONGEST, "ab", {{0, 2, {}}}},
+      {"^a+b", 0, LEFTMOST_LONGEST, "aaabcc", {{0, 4, {}}}},
+      {"^a+b", 0, LEFTMOST_LONGEST, "cab", {}},
+      {"^a+b", 0, LEFTMOST_LONGEST, "aa", {}},
+      {"a+b$", 0, LEFTMOST_LONGEST, "ab", {{0, 2, {}}}},
+      {"a+b$", 0, LEFTMOST_LONGEST, "caab", {{1, 4, {}}}},
+      {"a+b$", 0, LEFTMOST_LONGEST, "abc", {}},
+      {"a+b$", 0, LEFTMOST_LONGEST, "aa", {}},
+      {"a+b$", 0, LEFTMOST_LONGEST, "abab", {{2, 4, {}}}},
+      {"^(ab)+c(ef)$", 0, LEFTMOST_LONGEST, "ababcef", {{0, 7, {"ab", "ef"}}}},
+      {"^(ab)+c(ef)$", 0, LEFTMOST_LONGEST, "abcefg", {}},
+      {"^(ab)+c(ef)$", 0, LEFTMOST_LONGEST, "cef", {}},
+      {"(ab+)", 0, LEFTMOST_LONGEST, "abbb", {{0, 4, {"abbb"}}}},
+      {"(ab+)", 0, LEFTMOST_LONGEST, "babb", {{1, 4, {"abb"}}}},
+      {"(a+)b", 0, LEFTMOST_LONGEST,
+       "caabdabe", {{1, 4, {"aa"}}, {5, 7, {"a"}}}},
+      {"(a+)b", 0, LEFTMOST_LONGEST,
+       "aab ab b aaab", {{0, 3, {"aa"}}, {4, 6, {"a"}}, {9, 13, {"aaa"}}}},
+      {"(a+)(b)|(c)", 0, LEFTMOST_LONGEST, "xaab", {{1, 4, {"aa", "b", ""}}}},
+      {"(a+)(b)|(c)", 0, LEFTMOST_LONGEST, "xc", {{1, 2, {"", "", "c"}}}},
+      {"(233+)", 0, LEFTMOST_LONGEST, "6662333QAQ", {{3, 7, {"2333"}}}},
+      {"www\\.(\\w+)\\.com", 0, LEFTMOST_LONGEST,
+       "https://www.google.com/search?q=Hello",
+       {{8, 22, {"google"}}}},
+      {"^(\\+\\d{1,2}\\s)?\\(?\\d{3}\\)?(\\s|-|.)\\d{3}(\\s|-|.)\\d{4}$",
+       0, LEFTMOST_LONGEST,
+       "123-456-7890", {{0, 12, {"", "-", "-"}}}},
+      {"^(\\+\\d{1,2}\\s)?\\(?\\d{3}\\)?(\\s|-|.)\\d{3}(\\s|-|.)\\d{4}$",
+       0, LEFTMOST_LONGEST,
+       "+1 (123) 456-7890", {{0, 17, {"+1 ", " ", "-"}}}},
+      // Counters.
+      {"a{2}", 0, LEFTMOST_LONGEST, "aaaaa", {{0, 2, {}}, {2, 4, {}}}},
+      {"a{3,5}", 0, LEFTMOST_LONGEST, "aaaaaaa", {{0, 5, {}}}},
+      {"a{3,5}", 0, LEFTMOST_LONGEST, "aab", {}},
+      {"(ab|cd){2,3}", 0, LEFTMOST_LONGEST,
+       "xabcdabcdab", {{1, 7, {"ab"}}, {7, 11, {"ab"}}}},
+      // UTF-8 code points.
+      {"[α-ω]+", UTF8, LEFTMOST_LONGEST, "abc αβγ def", {{4, 10, {}}}},
+      {"[α-ω]+", UTF8, LEFTMOST_LONGEST, "Ωmega", {}},
+      {"^(.)(.)$", UTF8, LEFTMOST_LONGEST, "日a", {{0, 4, {"日", "a"}}}},
+      {"^(.)(.)$", UTF8, LEFTMOST_LONGEST, "日本語", {}},
+      {"^(.)(.)$", UTF8, LEFTMOST_LONGEST, "\xFF\xFE", {}},
+      {"[😀-😎]", UTF8, LEFTMOST_LONGEST, "ok 😃!", {{3, 7, {}}}},
+      // Folded case.
+      {"^content-(type|length):\\s*([a-z]+)",
+       CASE_INSENSITIVE, LEFTMOST_LONGEST,
+       "Content-Type: TEXT/html", {{0, 18, {"Type", "TEXT"}}}},
+      {"^content-(type|length):\\s*([a-z]+)",
+       CASE_INSENSITIVE, LEFTMOST_LONGEST,
+       "CONTENT-LENGTH:abc", {{0, 18, {"LENGTH", "abc"}}}},
+      {"^content-(type|length):\\s*([a-z]+)",
+       CASE_INSENSITIVE, LEFTMOST_LONGEST,
+       "Content_Type: text", {}},
+      {"host:([a-c]+)", CASE_INSENSITIVE, LEFTMOST_LONGEST,
+       "x HOST:aBc", {{2, 10, {"aBc"}}}},
+      {"host:([a-c]+)", CASE_INSENSITIVE, LEFTMOST_LONGEST,
+       "Host:C", {{0, 6, {"C"}}}},
+      {"host:([a-c]+)", CASE_INSENSITIVE, LEFTMOST_LONGEST, "host:d", {}},
+      {"café", CASE_INSENSITIVE | UTF8, LEFTMOST_LONGEST,
+       "CAFé", {{0, 5, {}}}},
+      // Groups which don't capture.
+      {"(?:key|name)=(\\w+)", 0, LEFTMOST_LONGEST,
+       "x name=azuki", {{2, 12, {"azuki"}}}},
+      {"(?:ab)+(c)", 0, LEFTMOST_LONGEST, "xababcd", {{1, 6, {"c"}}}},
+      {"(key|name)=(\\w+)", NO_CAPTURE, LEFTMOST_LONGEST,
+       "x name=azuki", {{2, 12, {}}}},
+      // Lazy repetitions, which choose matches by priority.
+      {"<(.*?)>", 0, LEFTMOST_LONGEST,
+       "x<a><b>", {{1, 4, {"a"}}, {4, 7, {"b"}}}},
+      {"a+?", 0, LEFTMOST_LONGEST, "aaa", {{0, 1, {}}, {1, 2, {}}, {2, 3, {}}}},
+      {"a??b", 0, LEFTMOST_LONGEST, "ab", {{0, 2, {}}}},
+      {"(a{2,3}?)", 0, LEFTMOST_LONGEST,
+       "aaaa", {{0, 2, {"aa"}}, {2, 4, {"aa"}}}},
+      {"^a*?$", 0, LEFTMOST_LONGEST, "aaa", {{0, 3, {}}}},
+      // Perl-style leftmost-first matches.
+      {"(\\w+)=(.*)|(\\w+)", 0, LEFTMOST_FIRST,
+       "key=value", {{0, 9, {"key", "value", ""}}}},
+      {"(\\w+)=(.*)|(\\w+)", 0, LEFTMOST_FIRST,
+       "a b", {{0, 1, {"", "", "a"}}, {2, 3, {"", "", "b"}}}},
+      {"(a|ab)(c|bcd)(d*)", 0, LEFTMOST_FIRST,
+       "xabcd", {{1, 5, {"a", "bcd", ""}}}},
+      // Empty matches, at the end of the input too.
+      {"x*", 0, LEFTMOST_LONGEST, "ab", {{0, 0, {}}, {1, 1, {}}, {2, 2, {}}}},
+      {"a*", 0, LEFTMOST_LONGEST, "", {{0, 0, {}}}},
+      {"a*", 0, LEFTMOST_LONGEST, "baa", {{0, 0, {}}, {1, 3, {}}, {3, 3, {}}}},
+      {"^a*", 0, LEFTMOST_LONGEST, "ba", {{0, 0, {}}}},
+      {"x?.*", 0, LEFTMOST_LONGEST, "ab", {{0, 2, {}}, {2, 2, {}}}},
+      {"(bc)?$", 0, LEFTMOST_LONGEST, "bcc", {{3, 3, {""}}}},
+      // Ambiguous groups, which take the first thread to match (see
+      // MachineTest.SplitPriority).
+      {"((.{1,2})+)", 0, LEFTMOST_LONGEST, "cb", {{0, 2, {"cb", "cb"}}}},
+      {"((.{1,2})+).*", 0, LEFTMOST_LONGEST, "cb", {{0, 2, {"c", "c"}}}},
+      {"(a*)(a*)", 0, LEFTMOST_LONGEST,
+       "aa", {{0, 2, {"", "aa"}}, {2, 2, {"", ""}}}},
+      {"(a+)(a*)", 0, LEFTMOST_LONGEST, "aaa", {{0, 3, {"a", "aa"}}}},
+      {"(a?)(a?)", 0, LEFTMOST_LONGEST,
+       "a", {{0, 1, {"", "a"}}, {1, 1, {"", ""}}}},
+      {"(a|ab)(b*)", 0, LEFTMOST_LONGEST, "ab", {{0, 2, {"a", "b"}}}},
+  };
+}
+
+};  // namespace Azuki
+
+#endif  // __AZUKI_TEST_CASES__
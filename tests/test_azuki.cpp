@@ -1,108 +1,253 @@
 #include <iostream>
 #include "azuki.h"
+#include "cases.h"
 #include "gtest/gtest.h"
 
 namespace Azuki {
 
-TEST(AzukiTest, SimpleNoAnchor) {
+TEST(AzukiTest, Cases) {
+  for (auto &c : SearchCases()) {
+    Machine m = CreateCaseMachine(c);
+    MatchResult result;
+    for (auto &found : c.found) {
+      ASSERT_TRUE(RegexSearch(m, c.input, result)) << c.pattern << " on "
+                                                   << c.input;
+      EXPECT_EQ(result.begin, found.begin) << c.pattern << " on " << c.input;
+      EXPECT_EQ(result.end, found.end) << c.pattern << " on " << c.input;
+      EXPECT_EQ(result.capture, found.capture) << c.pattern << " on "
+                                               << c.input;
+      if (result.begin == result.end) ++result.end;
+    }
+    EXPECT_FALSE(RegexSearch(m, c.input, result)) << c.pattern << " on "
+                                                  << c.input;
+    EXPECT_EQ(RegexSearch(m, c.input), !c.found.empty()) << c.pattern;
+    EXPECT_EQ(RegexCount(m, c.input), c.found.size()) << c.pattern;
+  }
+}
+
+TEST(AzukiTest, SimpleReplace) {
   Machine m = CreateMachine("a+b");
-  MatchResult result1, result2;
-  EXPECT_TRUE(RegexSearch(m, "cabd", result1));
-  EXPECT_EQ(result1.begin, 1);
-  EXPECT_EQ(result1.end, 3);
-  EXPECT_TRUE(RegexSearch(m, "aabcab", result2));
-  EXPECT_EQ(result2.begin, 0);
-  EXPECT_EQ(result2.end, 3);
-  EXPECT_FALSE(RegexSearch(m, "b"));
-  EXPECT_FALSE(RegexSearch(m, "cbaa"));
+  string s1 = "caabdabe";
+  EXPECT_EQ(RegexReplace(m, s1, "ef"), "cefdabe");
+  EXPECT_EQ(RegexReplace(m, s1, "ef", true), "cefdefe");
+
+  string s2 = "alice";
+  EXPECT_EQ(RegexReplace(m, s2, "ef"), "alice");
 }
 
-TEST(AzukiTest, ComplexNoAnchor) {
-  Machine m = CreateMachine("(ab)+");
-  MatchResult result1, result2;
-  EXPECT_TRUE(RegexSearch(m, "cabd", result1));
-  EXPECT_EQ(result1.begin, 1);
-  EXPECT_EQ(result1.end, 3);
-  EXPECT_TRUE(RegexSearch(m, "cababad", result2));
-  EXPECT_EQ(result2.begin, 1);
-  EXPECT_EQ(result2.end, 5);
-  EXPECT_FALSE(RegexSearch(m, "ba"));
-  EXPECT_FALSE(RegexSearch(m, "a b"));
+TEST(AzukiTest, ReferenceReplace) {
+  Machine m = CreateMachine("(a+)b");
+  string s = "caabdabe";
+  EXPECT_EQ(RegexReplace(m, s, "$0ff"), "caaffdabe");
+  EXPECT_EQ(RegexReplace(m, s, "$0ff", true), "caaffdaffe");
 }
 
-TEST(AzukiTest, SimpleBeginAnchor) {
-  Machine m = CreateMachine("^a+b");
-  MatchResult result1, result2;
-  EXPECT_TRUE(RegexSearch(m, "ab", result1));
-  EXPECT_EQ(result1.begin, 0);
-  EXPECT_EQ(result1.end, 2);
-  EXPECT_TRUE(RegexSearch(m, "aaabcc", result2));
-  EXPECT_EQ(result2.begin, 0);
-  EXPECT_EQ(result2.end, 4);
-  EXPECT_FALSE(RegexSearch(m, "cab"));
-  EXPECT_FALSE(RegexSearch(m, "aa"));
+TEST(AzukiTest, Budget) {
+  EXPECT_THROW(CreateMachine("(ab|cd){2,3}", 10), std::runtime_error);
+  // Expanded counters beyond the limit fall back to the counters.
+  Machine m = CreateMachine("(((a{64}){64}){64}){64}b", 1024);
+  EXPECT_FALSE(RegexSearch(m, "aab"));
+
+  MatchBudget budget;
+  budget.max_steps = 100;
+  Machine slow = CreateMachine("(a+)b");
+  slow.SetBudget(budget);
+  MatchResult ms;
+  EXPECT_TRUE(RegexSearch(slow, "aab", ms));
+  EXPECT_FALSE(RegexSearch(slow, "aab" + string(100, 'a') + "b", ms));
+  EXPECT_TRUE(ms.budget_exceeded);
 }
 
-TEST(AzukiTest, SimpleEndAnchor) {
-  Machine m = CreateMachine("a+b$");
-  MatchResult result1, result2;
-  EXPECT_TRUE(RegexSearch(m, "ab", result1));
-  EXPECT_EQ(result1.begin, 0);
-  EXPECT_EQ(result1.end, 2);
-  EXPECT_TRUE(RegexSearch(m, "caab", result2));
-  EXPECT_EQ(result2.begin, 1);
-  EXPECT_EQ(result2.end, 4);
-  EXPECT_FALSE(RegexSearch(m, "abc"));
-  EXPECT_FALSE(RegexSearch(m, "aa"));
+TEST(AzukiTest, Spans) {
+  Machine m = CreateMachine("(a+)(b)|(c)");
+  MatchResult ms;
+  EXPECT_TRUE(RegexSearch(m, "xaab", ms));
+  EXPECT_EQ(ms.spans, (vector<pair<unsigned int, unsigned int>>(
+                          {{1, 3}, {3, 4}, {UINT_MAX, UINT_MAX}})));
+  EXPECT_EQ(m.NumGroups(), 3);
+
+  // Unmatched groups have empty captures.
+  ms = MatchResult();
+  EXPECT_TRUE(RegexSearch(m, "xc", ms));
+  ASSERT_EQ(ms.spans.size(), 3);
+  EXPECT_EQ(ms.spans[0].first, UINT_MAX);
+  EXPECT_EQ(ms.capture[0], "");
+  EXPECT_EQ(ms.spans[2], std::make_pair(1u, 2u));
 }
 
-TEST(AzukiTest, SimpleIterator) {
-  Machine m = CreateMachine("(ab)+");
-  MatchResult result;
-  string s = "dabcccababd";
-  EXPECT_TRUE(RegexSearch(m, s, result));
-  EXPECT_EQ(result.begin, 1);
-  EXPECT_EQ(result.end, 3);
-  EXPECT_TRUE(RegexSearch(m, s, result));
-  EXPECT_EQ(result.begin, 6);
-  EXPECT_EQ(result.end, 10);
-  EXPECT_FALSE(RegexSearch(m, s, result));
+TEST(AzukiTest, NonCapturing) {
+  EXPECT_EQ(CompileRegexp(ParseRegexp("(?:ab)+")).size(),
+            CompileRegexp(ParseRegexp("(ab)+")).size() - 2);
+
+  RegexOptions options;
+  options.flags = NO_CAPTURE;
+  EXPECT_EQ(CreateMachine("(key|name)=(\\w+)", options).NumGroups(), 0);
 }
 
-TEST(AzukiTest, SimpleCapture) {
-  Machine m = CreateMachine("^(ab)+c(ef)$");
-  MatchResult result;
-  std::vector<std::string> v;
-  EXPECT_TRUE(RegexSearch(m, "ababcef", result));
-  EXPECT_EQ(result.capture.size(), 2);
-  EXPECT_EQ(result.capture[0], "ab");
-  EXPECT_EQ(result.capture[1], "ef");
+TEST(AzukiTest, Lazy) {
+  // Matches of lazy repetitions are in SearchCases. Runs without capture
+  // groups choose the same ones.
+  EXPECT_EQ(CreateMachine("<(.*?)>").Run("<a><b>", false).end, 3);
+
+  // Machines from compiled regexps keep the match kind.
+  EXPECT_EQ(Machine(CreateCompiledRegexp("<.*?>")).Run("<a><b>").end, 3);
+  EXPECT_EQ(Machine(ParseRegexp("<.*?>")).Run("<a><b>").end, 3);
+  RegexOptions options;
+  options.match_kind = LEFTMOST_FIRST;
+  EXPECT_EQ(Machine(CreateCompiledRegexp("a|ab", options)).Run("ab").end, 1);
 }
 
-TEST(AzukiTest, GreedyCapture) {
-  Machine m = CreateMachine("(ab+)");
-  MatchResult result;
-  std::vector<std::string> v;
-  EXPECT_TRUE(RegexSearch(m, "abbb", result));
-  EXPECT_EQ(result.capture.size(), 1);
-  EXPECT_EQ(result.capture[0], "abbb");
+TEST(AzukiTest, Split) {
+  Machine m = CreateMachine("\\s*(,|;)\\s*");
+  string s = "a, b;c ;";
+  EXPECT_EQ(RegexSplit(m, s), vector<string_view>({"a", "b", "c", ""}));
+  EXPECT_EQ(RegexSplit(m, s, 1), vector<string_view>({"a", "b;c ;"}));
+  EXPECT_EQ(RegexSplit(m, s, 2, true),
+            vector<string_view>({"a", ",", "b", ";", "c ;"}));
+  // Groups which don't match give empty pieces.
+  EXPECT_EQ(RegexSplit(CreateMachine("(,)|(;)"), "x,y;z", 0, true),
+            vector<string_view>({"x", ",", "", "y", "", ";", "z"}));
+
+  // Pieces point into the input.
+  vector<string_view> pieces;
+  RegexSplit(m, s, pieces);
+  EXPECT_EQ(pieces[1].data(), s.data() + 3);
+
+  // Pieces are appended, and empty matches don't split.
+  RegexSplit(CreateMachine("x*"), "ab", pieces);
+  EXPECT_EQ(pieces.size(), 5);
+  EXPECT_EQ(pieces.back(), "ab");
 }
 
-TEST(AzukiTest, SimpleReplace) {
-  Machine m = CreateMachine("a+b");
-  string s1 = "caabdabe";
-  EXPECT_EQ(RegexReplace(m, s1, "ef"), "cefdabe");
-  EXPECT_EQ(RegexReplace(m, s1, "ef", true), "cefdefe");
+TEST(AzukiTest, LeftmostFirst) {
+  RegexOptions options;
+  options.match_kind = LEFTMOST_FIRST;
+  Machine m = CreateMachine("(\\w+)=(.*)|(\\w+)", options);
+  EXPECT_EQ(RegexReplace(m, "a b", "<$2>", true), "<a> <b>");
+}
 
-  string s2 = "alice";
-  EXPECT_EQ(RegexReplace(m, s2, "ef"), "alice");
+TEST(AzukiTest, Count) {
+  Machine m = CreateMachine("(a+)b");
+  EXPECT_EQ(RegexCount(m, "aab ab b aaab"), 3);
+  EXPECT_EQ(RegexCount(CreateMachine("^a"), "aaa"), 1);
+  EXPECT_EQ(RegexCount(CreateMachine("a{2}"), "aaaaa"), 2);
+  EXPECT_EQ(RegexCount(CreateMachine("^a*$"), ""), 1);
+  EXPECT_EQ(RegexCount(CreateMachine("a*"), ""), 1);
+  EXPECT_EQ(RegexCount(CreateMachine("a*"), "baa"), 3);
+  // An empty match after the search position is counted once, and one after a
+  // trailing ".*" match too (like Python re.findall).
+  EXPECT_EQ(RegexCount(CreateMachine("x*$"), "ab"), 1);
+  EXPECT_EQ(RegexCount(CreateMachine("([a-b])?$"), "ac"), 1);
+  EXPECT_EQ(RegexCount(CreateMachine("(bc)?$"), "bcc"), 1);
+  EXPECT_EQ(RegexCount(CreateMachine("x?.*"), "ab"), 2);
+  EXPECT_EQ(RegexCount(CreateMachine(".*a.*"), "ab"), 1);
 }
 
-TEST(AzukiTest, ReferenceReplace) {
+// Count matches with a RegexSearch loop, which goes on from the next
+// character after an empty match like the loops of pyazuki.
+unsigned long SearchCount(const Machine &m, string_view s) {
+  unsigned long count = 0;
+  MatchResult ms;
+  while (RegexSearch(m, s, ms, false)) {
+    ++count;
+    if (ms.begin == ms.end) ++ms.end;
+  }
+  return count;
+}
+
+TEST(AzukiTest, EmptyMatch) {
+  // The search goes on at the end of s, where an empty match may be found
+  // (like Python re.findall).
+  Machine m = CreateMachine("x*");
+  MatchResult ms;
+  ms.end = 2;
+  EXPECT_TRUE(RegexSearch(m, "ab", ms));
+  EXPECT_EQ(ms.begin, 2);
+  EXPECT_EQ(ms.end, 2);
+  ++ms.end;
+  EXPECT_FALSE(RegexSearch(m, "ab", ms));
+  EXPECT_EQ(SearchCount(m, "ab"), 3);
+  EXPECT_EQ(RegexReplace(m, "ab", "-", true), "-a-b-");
+  EXPECT_EQ(RegexReplace(CreateMachine("a*"), "baa", "-", true), "-b--");
+  // '^' only matches at the begin of s.
+  EXPECT_EQ(SearchCount(CreateMachine("^a*"), "ba"), 1);
+
+  for (auto e : {"x*", "a*", "x*$", "([a-b])?$", "(bc)?$", "x?.*", ".*a.*",
+                 "^a*", "a*$", "(ab)*"}) {
+    Machine m = CreateMachine(e);
+    for (auto s : {"", "ab", "ac", "bcc", "baa", "abab"})
+      EXPECT_EQ(RegexCount(m, s), SearchCount(m, s)) << e << " on " << s;
+  }
+}
+
+TEST(AzukiTest, SearchAtEnd) {
+  // A search may begin at s.size(), where only an empty match is found.
+  Machine m = CreateMachine("(a*)");
+  MatchResult ms;
+  ms.end = 3;
+  EXPECT_TRUE(RegexSearch(m, "baa", ms));
+  EXPECT_EQ(ms.begin, 3);
+  EXPECT_EQ(ms.end, 3);
+  EXPECT_EQ(ms.capture, vector<string>({""}));
+  // Past the end of s, nothing is found and result is kept.
+  ms.end = 4;
+  EXPECT_FALSE(RegexSearch(m, "baa", ms));
+  EXPECT_EQ(ms.begin, 3);
+  EXPECT_EQ(ms.end, 4);
+
+  // A pattern which can't be empty has no match at the end.
+  Machine nonempty = CreateMachine("a+");
+  ms = MatchResult();
+  ms.end = 3;
+  EXPECT_FALSE(RegexSearch(nonempty, "baa", ms));
+  EXPECT_EQ(ms.end, 3);
+  EXPECT_EQ(RegexReplace(nonempty, "baa", "-", true), "b-");
+}
+
+TEST(AzukiTest, SearchAfterBegin) {
+  // '^' matches only at the begin of s, not where a later search begins.
+  Machine m = CreateMachine("^a");
+  MatchResult ms;
+  EXPECT_TRUE(RegexSearch(m, "aaa", ms));
+  EXPECT_EQ(ms.begin, 0);
+  EXPECT_EQ(ms.end, 1);
+  EXPECT_FALSE(RegexSearch(m, "aaa", ms));
+  EXPECT_EQ(ms.begin, 0);
+  EXPECT_EQ(ms.end, 1);
+  EXPECT_EQ(RegexReplace(m, "aaa", "-", true), "-aa");
+  EXPECT_EQ(RegexReplace(CreateMachine("^b*"), "ab", "-", true), "-ab");
+}
+
+TEST(AzukiTest, Match) {
   Machine m = CreateMachine("(a+)b");
-  string s = "caabdabe";
-  EXPECT_EQ(RegexReplace(m, s, "$0ff"), "caaffdabe");
-  EXPECT_EQ(RegexReplace(m, s, "$0ff", true), "caaffdaffe");
+  MatchResult result;
+  EXPECT_TRUE(RegexMatch(m, "aab", result));
+  EXPECT_EQ(result.capture, vector<string>({"aa"}));
+  EXPECT_FALSE(RegexMatch(m, "aabc"));
+  EXPECT_FALSE(RegexMatch(m, "caab"));
+  EXPECT_TRUE(RegexSearch(m, "caab"));
+
+  EXPECT_TRUE(RegexMatchPrefix(m, "aabc", result));
+  EXPECT_EQ(result.begin, 0);
+  EXPECT_EQ(result.end, 3);
+  EXPECT_FALSE(RegexMatchPrefix(m, "caab"));
+
+  // Anchors of the pattern still apply.
+  Machine m2 = CreateMachine("a+$");
+  EXPECT_FALSE(RegexMatchPrefix(m2, "aab"));
+  EXPECT_TRUE(RegexMatchPrefix(m2, "aa"));
+
+  // The prefix follows the match kind.
+  EXPECT_TRUE(RegexMatchPrefix(CreateMachine("(a+?)"), "aab", result));
+  EXPECT_EQ(result.end, 1);
+  EXPECT_EQ(result.capture, vector<string>({"a"}));
+  RegexOptions options;
+  options.match_kind = LEFTMOST_FIRST;
+  Machine first = CreateMachine("a|ab", options);
+  EXPECT_TRUE(RegexMatchPrefix(first, "abc", result));
+  EXPECT_EQ(result.end, 1);
+  EXPECT_TRUE(RegexMatchPrefix(CreateMachine("a|ab"), "abc", result));
+  EXPECT_EQ(result.end, 2);
 }
 
 };  // namespace Azuki
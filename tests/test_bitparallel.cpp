@@ -0,0 +1,98 @@
+#include "bitparallel.h"
+#include "gtest/gtest.h"
+#include "machine.h"
+
+namespace Azuki {
+
+namespace {
+
+BitParallelPtr CreateExpandedBitParallel(const string &e) {
+  return CreateBitParallel(CompileRegexp(ExpandRegexp(ParseRegexp(e))));
+}
+
+};  // namespace
+
+TEST(BitParallelTest, Create) {
+  EXPECT_EQ(CreateBitParallel(CompileRegexp(ParseRegexp("a{2,3}"))), nullptr);
+  EXPECT_NE(CreateExpandedBitParallel("a{2,3}"), nullptr);
+  EXPECT_NE(CreateExpandedBitParallel(string(64, 'a')), nullptr);
+  EXPECT_EQ(CreateExpandedBitParallel(string(65, 'a')), nullptr);
+}
+
+TEST(BitParallelTest, Search) {
+  BitParallelPtr bp = CreateExpandedBitParallel("(a|bc)+d");
+  EXPECT_TRUE(bp->Search("xxabcad", false));
+  EXPECT_TRUE(bp->Search("xxabcad", true));
+  EXPECT_FALSE(bp->Search("xxabcadx", true));
+  EXPECT_FALSE(bp->Search("xxbd", false));
+  EXPECT_FALSE(bp->Search("", false));
+
+  // Positions of the literal are only followed by the next one.
+  bp = CreateExpandedBitParallel("ERROR");
+  EXPECT_TRUE(bp->Search("an ERRORERR", false));
+  EXPECT_FALSE(bp->Search("ERRO ERR", false));
+
+  // Empty matches are everywhere.
+  bp = CreateExpandedBitParallel("a*");
+  EXPECT_TRUE(bp->Search("", true));
+  EXPECT_TRUE(bp->Search("b", true));
+}
+
+TEST(BitParallelTest, SearchAnchored) {
+  BitParallelPtr bp = CreateExpandedBitParallel("\\d+(\\.\\d+)?");
+  unsigned int end = 0;
+  EXPECT_TRUE(bp->SearchAnchored("12.5x", false, end));
+  EXPECT_EQ(end, 4);
+  EXPECT_TRUE(bp->SearchAnchored("12.x", false, end));
+  EXPECT_EQ(end, 2);
+  EXPECT_FALSE(bp->SearchAnchored("12.x", true, end));
+  EXPECT_FALSE(bp->SearchAnchored("x12", false, end));
+
+  bp = CreateExpandedBitParallel("a?");
+  EXPECT_TRUE(bp->SearchAnchored("b", false, end));
+  EXPECT_EQ(end, 0);
+  EXPECT_FALSE(bp->SearchAnchored("b", true, end));
+}
+
+TEST(BitParallelTest, Machine) {
+  Machine m(ParseRegexp("a+b"));
+  EXPECT_TRUE(m.HasMatch("xxaab"));
+  EXPECT_FALSE(m.HasMatch("xxaa"));
+  EXPECT_FALSE(m.Run("xxaa", false).success);
+  MatchResult ms = m.Run("xxaabab", false);
+  EXPECT_TRUE(ms.success);
+  EXPECT_EQ(ms.begin, 2);
+  EXPECT_EQ(ms.end, 5);
+
+  // With match_end, the match ends at s.size() and the reverse Dfa finds its
+  // begin.
+  Machine end = m;
+  end.SetMatchEnd(true);
+  ms = end.Run("xxaabaab", false);
+  EXPECT_TRUE(ms.success);
+  EXPECT_EQ(ms.begin, 5);
+  EXPECT_EQ(ms.end, 8);
+  EXPECT_FALSE(end.Run("xxaaba", false).success);
+
+  ms = m.RunAnchored("aabab", false, false);
+  EXPECT_TRUE(ms.success);
+  EXPECT_EQ(ms.end, 3);
+  EXPECT_FALSE(m.RunAnchored("aabab", true, false).success);
+
+  // Leftmost first anchored runs need the priority of threads.
+  Machine first(ParseRegexp("a|ab"));
+  first.SetMatchKind(LEFTMOST_FIRST);
+  EXPECT_EQ(first.RunAnchored("ab", false, false).end, 1);
+  EXPECT_EQ(first.RunAnchored("ab", true, false).end, 2);
+
+  // They stay anchored, so a match later in s is not scanned for.
+  first.SetMatchBegin(true);
+  MatchStats stats;
+  EXPECT_FALSE(first.Run("x" + string(1000, 'y') + "a", false, stats).success);
+  EXPECT_EQ(first.Run("ab" + string(1000, 'y'), false, stats).end, 1);
+#ifdef AZUKI_ENABLE_STATS
+  EXPECT_LT(stats.bytes_scanned, 10);
+#endif
+}
+
+};  // namespace Azuki
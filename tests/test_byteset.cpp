@@ -0,0 +1,106 @@
+#include <random>
+#include "byteset.h"
+#include "gtest/gtest.h"
+#include "machine.h"
+
+namespace Azuki {
+
+namespace {
+
+std::bitset<256> Bytes(const string &chars) {
+  std::bitset<256> bytes;
+  for (unsigned char ch : chars) bytes.set(ch);
+  return bytes;
+}
+
+ByteSet FirstBytesOf(const string &e) {
+  return FirstBytes(CompileRegexp(ParseRegexp(e)));
+}
+
+};  // namespace
+
+TEST(ByteSetTest, Find) {
+  ByteSet digits(Bytes("0123456789"));
+  EXPECT_EQ(digits.str(), "[0-9]");
+  EXPECT_EQ(digits.Find("abc1", 0), 3);
+  EXPECT_EQ(digits.Find("1bc1", 1), 3);
+  EXPECT_EQ(digits.Find("abc", 0), string_view::npos);
+  EXPECT_EQ(digits.Find("", 0), string_view::npos);
+
+  // Long inputs are scanned by blocks, and the rest byte by byte.
+  string s(100, 'x');
+  EXPECT_EQ(digits.Find(s, 0), string_view::npos);
+  s[70] = '5';
+  EXPECT_EQ(digits.Find(s, 0), 70);
+  EXPECT_EQ(digits.Find(s, 71), string_view::npos);
+  s[99] = '0';
+  EXPECT_EQ(digits.Find(s, 71), 99);
+
+  ByteSet empty((std::bitset<256>()));
+  EXPECT_EQ(empty.str(), "[]");
+  EXPECT_EQ(empty.Find(s, 0), string_view::npos);
+  EXPECT_TRUE(ByteSet(std::bitset<256>().set()).Full());
+}
+
+TEST(ByteSetTest, SameAsScalar) {
+  // Sets of few and many ranges, with bytes above 0x7F.
+  std::mt19937 rng(1);
+  for (auto chars : {string("a"), string("\\w"), string("\x80\xff"),
+                     string("acegikmoqsuwy"), string("\x01\x7f\x80")}) {
+    std::bitset<256> bytes = Bytes(chars);
+    if (chars == "\\w") {
+      for (int ch = 0; ch < 256; ++ch)
+        if (isalnum(ch) || ch == '_') bytes.set(ch);
+    }
+    ByteSet set(bytes);
+    for (int i = 0; i < 100; ++i) {
+      string s(rng() % 200, ' ');
+      for (auto &ch : s) {
+        ch = rng() % 8 ? ' ' + rng() % 8 : rng() % 256;
+      }
+      size_t pos = s.empty() ? 0 : rng() % s.size();
+      size_t expected = pos;
+      while (expected < s.size() && !bytes[(unsigned char)s[expected]])
+        ++expected;
+      if (expected == s.size()) expected = string_view::npos;
+      EXPECT_EQ(set.Find(s, pos), expected) << set.str();
+    }
+  }
+}
+
+TEST(ByteSetTest, FirstBytes) {
+  EXPECT_EQ(FirstBytesOf("\\d+|x").str(), "[0-9x]");
+  EXPECT_EQ(FirstBytesOf("(a|b)?c").str(), "[a-c]");
+  EXPECT_EQ(FirstBytesOf("a{2,3}").str(), "[a]");
+  EXPECT_EQ(FirstBytesOf("\\s").str(), "[\\x09-\\x0D\\x20]");
+  // An empty match may begin anywhere.
+  EXPECT_TRUE(FirstBytesOf("a*").Full());
+  EXPECT_EQ(FirstBytesOf("(a|b*)c").str(), "[a-c]");
+}
+
+TEST(ByteSetTest, Machine) {
+  Machine m(ParseRegexp("(\\d+)x"));
+  EXPECT_EQ(m.GetPlan().first_bytes.str(), "[0-9]");
+  string s = string(1000, 'y') + "12x";
+  MatchStats stats;
+  MatchResult ms = m.Run(s, true, stats);
+  EXPECT_TRUE(ms.success);
+  EXPECT_EQ(ms.begin, 1000);
+  EXPECT_EQ(ms.capture, vector<string>({"12"}));
+  EXPECT_TRUE(m.HasMatch(s));
+  EXPECT_EQ(m.Count(s + s), 2);
+  EXPECT_FALSE(m.Run(string(1000, 'y')).success);
+#ifdef AZUKI_ENABLE_STATS
+  EXPECT_GE(stats.bytes_skipped, 1000);
+#endif
+
+  // The interpreter skips between threads too.
+  MatchPlan plan = m.GetPlan();
+  plan.existence = plan.anchored = plan.search = plan.capture = INTERPRETER;
+  m.SetPlan(plan);
+  ms = m.Run("1y" + s, true);
+  EXPECT_EQ(ms.begin, 1002);
+  EXPECT_EQ(ms.capture, vector<string>({"12"}));
+}
+
+};  // namespace Azuki
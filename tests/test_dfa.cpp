@@ -0,0 +1,202 @@
+#include "gtest/gtest.h"
+#include "machine.h"
+
+namespace Azuki {
+
+namespace {
+
+DfaPtr CreateForwardDfa(const string &e) {
+  return CreateDfa(CompileRegexp(ExpandRegexp(ParseRegexp(e))));
+}
+
+DfaPtr CreateReverseDfa(const string &e) {
+  return CreateDfa(CompileReversedRegexp(ParseRegexp(e)));
+}
+
+};  // namespace
+
+TEST(DfaTest, Counter) {
+  EXPECT_EQ(CreateDfa(CompileRegexp(ParseRegexp("a{2,3}"))), nullptr);
+  EXPECT_NE(CreateForwardDfa("a{2,3}"), nullptr);
+}
+
+TEST(DfaTest, SearchForward) {
+  DfaPtr dfa = CreateForwardDfa("a+b");
+  unsigned int end = 0;
+  EXPECT_TRUE(dfa->SearchForward("caabdab", false, false,
+                                 LEFTMOST_LONGEST, end));
+  EXPECT_EQ(end, 4);
+  EXPECT_TRUE(dfa->SearchForward("caabdab", false, true,
+                                 LEFTMOST_LONGEST, end));
+  EXPECT_EQ(end, 7);
+  EXPECT_FALSE(dfa->SearchForward("caabdab", true, false,
+                                  LEFTMOST_LONGEST, end));
+  EXPECT_FALSE(dfa->SearchForward("cbaa", false, false,
+                                  LEFTMOST_LONGEST, end));
+}
+
+TEST(DfaTest, LeftmostLongest) {
+  // "c" ends first, but "abcd" begins first.
+  DfaPtr dfa = CreateForwardDfa("abcd|c");
+  unsigned int end = 0;
+  EXPECT_TRUE(dfa->SearchForward("xabcd", false, false,
+                                 LEFTMOST_LONGEST, end));
+  EXPECT_EQ(end, 5);
+
+  // "a" begins first, "bcd" ends last.
+  dfa = CreateForwardDfa("a|bcd");
+  EXPECT_TRUE(dfa->SearchForward("abcd", false, false,
+                                 LEFTMOST_LONGEST, end));
+  EXPECT_EQ(end, 1);
+}
+
+TEST(DfaTest, LeftmostFirst) {
+  DfaPtr dfa = CreateForwardDfa("ab|abcd");
+  unsigned int end = 0;
+  EXPECT_TRUE(dfa->SearchForward("xabcd", false, false, LEFTMOST_FIRST, end));
+  EXPECT_EQ(end, 3);
+  EXPECT_TRUE(dfa->SearchForward("xabcd", false, true, LEFTMOST_FIRST, end));
+  EXPECT_EQ(end, 5);
+
+  // Quantifiers prefer one more iteration.
+  dfa = CreateForwardDfa("a+");
+  EXPECT_TRUE(dfa->SearchForward("baaa", false, false, LEFTMOST_FIRST, end));
+  EXPECT_EQ(end, 4);
+}
+
+TEST(DfaTest, SearchBackward) {
+  DfaPtr dfa = CreateReverseDfa("a+b");
+  unsigned int begin = 0;
+  EXPECT_TRUE(dfa->SearchBackward("caabdab", 4, begin));
+  EXPECT_EQ(begin, 1);
+  EXPECT_FALSE(dfa->SearchBackward("caabdab", 3, begin));
+}
+
+TEST(DfaTest, TwoPhaseMachine) {
+  RegexpPtr rp = ParseRegexp("(a+)(b)");
+  Machine m(rp);
+  MatchResult ms = m.Run("ccaabdab");
+  EXPECT_TRUE(ms.success);
+  EXPECT_EQ(ms.begin, 2);
+  EXPECT_EQ(ms.end, 5);
+  EXPECT_EQ(ms.capture, vector<string>({"aa", "b"}));
+  EXPECT_FALSE(m.Run("ccaa").success);
+}
+
+TEST(DfaTest, LongInput) {
+  // Capture groups are tracked only inside the match.
+  Machine m(ParseRegexp("(\\d+)-(\\d+)"));
+  string s(1 << 20, 'x');
+  s.replace(s.size() / 2, 7, "123-456");
+  MatchResult ms = m.Run(s);
+  EXPECT_TRUE(ms.success);
+  EXPECT_EQ(ms.begin, s.size() / 2);
+  EXPECT_EQ(ms.end, s.size() / 2 + 7);
+  EXPECT_EQ(ms.capture, vector<string>({"123", "456"}));
+  unsigned int begin = s.size() / 2;
+  EXPECT_EQ(ms.spans, (vector<pair<unsigned int, unsigned int>>(
+                          {{begin, begin + 3}, {begin + 4, begin + 7}})));
+}
+
+TEST(DfaTest, SearchParallel) {
+  DfaPtr dfa = CreateForwardDfa("ax*b");
+  // Four segments of 1 << 16 characters.
+  string s(1 << 18, 'y');
+  unsigned int end = 0;
+  EXPECT_FALSE(dfa->SearchParallel(s, 4, false, LEFTMOST_LONGEST, end));
+
+  // The match crosses the end of its segment.
+  s.replace((1 << 17) - 1, 3, "axb");
+  s.replace(3 << 16, 2, "ab");
+  EXPECT_TRUE(dfa->SearchParallel(s, 4, false, LEFTMOST_LONGEST, end));
+  EXPECT_EQ(end, (1 << 17) + 2);
+
+  // A match from the first segment runs through all others, which are
+  // scanned again from the state the first one ends in.
+  string x(1 << 18, 'x');
+  x[10] = 'a';
+  x.back() = 'b';
+  EXPECT_TRUE(dfa->SearchParallel(x, 4, true, LEFTMOST_LONGEST, end));
+  EXPECT_EQ(end, x.size());
+
+  // Scans from the start state skip to the next candidate.
+  s.assign(1 << 18, 'y');
+  s.replace((5 << 15) + 7, 2, "ab");
+  auto skip = [&](size_t pos) { return s.find('a', pos); };
+  unsigned long scanned = 0;
+  EXPECT_TRUE(dfa->SearchParallel(s, 4, false, LEFTMOST_LONGEST, end,
+                                  &scanned, skip));
+  EXPECT_EQ(end, (5 << 15) + 9);
+  EXPECT_LT(scanned, 1u << 16);
+
+  // Short inputs are not split.
+  EXPECT_TRUE(dfa->SearchParallel("cab", 4, false, LEFTMOST_FIRST, end));
+  EXPECT_EQ(end, 3);
+}
+
+TEST(DfaTest, SearchParallelOutlived) {
+  // Threads of "a.*b" live through every segment, but a scan from the start
+  // state is in the same state once it reads an 'a' and a 'b', so each
+  // segment is only scanned again up to there, never to the end of s.
+  string s;
+  while (s.size() < (1 << 20))
+    s += "a" + string(49, 'x') + "b" + string(49, 'x');
+  for (MatchKind kind : {LEFTMOST_LONGEST, LEFTMOST_FIRST}) {
+    for (string e : {"a.*b", "a.*b.*x", "(a|xb)x*"}) {
+      DfaPtr dfa = CreateForwardDfa(e);
+      unsigned int expected = 0, end = 0;
+      unsigned long scanned = 0;
+      bool found = dfa->SearchForward(s, false, false, kind, expected);
+      EXPECT_EQ(dfa->SearchParallel(s, 8, false, kind, end, &scanned), found)
+          << e;
+      EXPECT_EQ(end, expected) << e;
+      EXPECT_LT(scanned, s.size() + 8 * 2048) << e;
+    }
+  }
+
+  // A state which the scans from the start state never reach is guessed for
+  // the segments after it, which are scanned again in parallel.
+  string x(1 << 20, 'x');
+  x[3] = 'a';
+  x[x.size() - 5] = 'b';
+  DfaPtr dfa = CreateForwardDfa("ax*bx*");
+  unsigned int end = 0;
+  unsigned long scanned = 0;
+  EXPECT_TRUE(dfa->SearchParallel(x, 8, false, LEFTMOST_LONGEST, end,
+                                  &scanned));
+  EXPECT_EQ(end, x.size());
+  EXPECT_LT(scanned, 2 * x.size());
+}
+
+TEST(DfaTest, RunParallel) {
+  Machine m(ParseRegexp("(\\d+)-(\\d+)"));
+  string s(1 << 20, 'x');
+  for (unsigned int pos : {100000u, 1u << 18, (1u << 19) - 4, 900000u}) {
+    string t = s;
+    t.replace(pos, 7, "123-456");
+    t.replace(pos + 100, 3, "9-9");
+    MatchResult expected = m.Run(t);
+    MatchResult ms = m.RunParallel(t, 8);
+    EXPECT_TRUE(ms.success);
+    EXPECT_EQ(ms.begin, expected.begin);
+    EXPECT_EQ(ms.end, expected.end);
+    EXPECT_EQ(ms.capture, expected.capture);
+    EXPECT_EQ(ms.spans, expected.spans);
+  }
+  EXPECT_FALSE(m.RunParallel(s, 8).success);
+
+  // A literal prefix, and threads which live through every segment.
+  // Capture groups of long matches take long, so they are not tracked.
+  for (string e : {"FATAL \\w+", "ax*b", "a.*b$"}) {
+    Machine m(ParseRegexp(e));
+    string t = "a" + s + "FATAL disk";
+    t[t.size() / 2] = 'b';
+    MatchResult expected = m.Run(t, false);
+    MatchResult ms = m.RunParallel(t, 4, false);
+    EXPECT_EQ(ms.success, expected.success) << e;
+    EXPECT_EQ(ms.begin, expected.begin) << e;
+    EXPECT_EQ(ms.end, expected.end) << e;
+  }
+}
+
+};  // namespace Azuki
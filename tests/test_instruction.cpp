@@ -79,6 +79,20 @@ TEST(InstructionTest, SimpleStar) {
 #endif
 }
 
+TEST(InstructionTest, LazyStar) {
+  // "a*?"
+  RegexpPtr rp = CreateLazyRegexp(CreateStarRegexp(CreateLitRegexp('a')));
+  Program program = CompileRegexp(rp);
+  EXPECT_EQ(program.size(), 4);
+  EXPECT_EQ(program[0]->opcode, SPLIT);
+  EXPECT_TRUE(program[0]->greedy);
+  EXPECT_EQ(program[0]->str(), "I0 SPLIT I3 I1");
+  EXPECT_FALSE(CompileRegexp(ParseRegexp("a*"))[0]->greedy);
+#ifdef DEBUG
+  PrintProgram(program);
+#endif
+}
+
 TEST(InstructionTest, SimpleParen) {
   // "(b)"
   RegexpPtr rp = CreateParenRegexp(CreateLitRegexp('a'));
@@ -109,6 +123,19 @@ TEST(InstructionTest, SimpleSquare) {
 #endif
 }
 
+TEST(InstructionTest, FoldCase) {
+  // Each letter is a single instruction matching both cases.
+  RegexpPtr rp = ParseRegexp("host:[a-c]", CASE_INSENSITIVE);
+  Program program = CompileRegexp(rp);
+  EXPECT_EQ(program.size(), 7);
+  EXPECT_EQ(program[0]->opcode, CHAR);
+  EXPECT_TRUE(program[0]->fold);
+  EXPECT_FALSE(program[4]->fold);
+  EXPECT_EQ(program[5]->opcode, RANGE);
+  EXPECT_TRUE(program[5]->fold);
+  EXPECT_EQ(program[5]->str(), "I5 RANGE a c FOLD");
+}
+
 TEST(InstructionTest, SimpleCurly) {
   // "a{3,5}"
   RegexpPtr rp = ParseRegexp("a{3,5}");
@@ -119,4 +146,60 @@ TEST(InstructionTest, SimpleCurly) {
 #endif
 }
 
+TEST(InstructionTest, Reversed) {
+  // "ab+" reversed to "b+a"
+  RegexpPtr rp = ParseRegexp("ab+");
+  Program program = CompileReversedRegexp(rp);
+  EXPECT_EQ(program.size(), 5);
+  EXPECT_EQ(program[0]->opcode, CHAR);
+  EXPECT_EQ(program[0]->c, 'b');
+  EXPECT_EQ(program[3]->c, 'a');
+#ifdef DEBUG
+  PrintProgram(program);
+#endif
+}
+
+TEST(InstructionTest, Source) {
+  // "x(a|b)*" compiles each instruction from the innermost node.
+  RegexpPtr rp = ParseRegexp("x(a|b)*");
+  vector<RegexpPtr> sources;
+  Program program = CompileRegexp(rp, UINT_MAX, &sources);
+  ASSERT_EQ(sources.size(), program.size());
+  EXPECT_EQ(FormatRegexp(sources[0]), "x");
+  EXPECT_EQ(FormatRegexp(sources[1]), "(a|b)*");
+  EXPECT_EQ(FormatRegexp(sources[2]), "(a|b)");
+  EXPECT_EQ(FormatRegexp(sources[3]), "a|b");
+  EXPECT_EQ(FormatRegexp(sources[4]), "a");
+  EXPECT_EQ(sources.back(), nullptr);
+}
+
+TEST(InstructionTest, Accepts) {
+  Program program = CompileRegexp(ParseRegexp("a[b-d]\\w.", CASE_INSENSITIVE));
+  EXPECT_TRUE(program[0]->Accepts('A'));
+  EXPECT_FALSE(program[0]->Accepts('b'));
+  EXPECT_TRUE(program[1]->Accepts('C'));
+  EXPECT_FALSE(program[1]->Accepts('e'));
+  EXPECT_TRUE(program[2]->Accepts('_'));
+  EXPECT_FALSE(program[2]->Accepts('-'));
+  EXPECT_TRUE(program[3]->Accepts('\xFF'));
+  // Bytes from 0x80 are in no class.
+  for (int b = 0x80; b < 0x100; ++b) {
+    EXPECT_FALSE(program[2]->Accepts(b));
+    EXPECT_FALSE(InClass(ANY_SPACE, b));
+    EXPECT_FALSE(InClass(ANY_DIGIT, b));
+  }
+  // Control instructions accept no byte.
+  EXPECT_FALSE(program.back()->Accepts('a'));
+}
+
+TEST(InstructionTest, MaxSize) {
+  // "a{2,3}b" takes 8 instructions.
+  RegexpPtr rp = ParseRegexp("a{2,3}b");
+  EXPECT_EQ(CompileRegexp(rp, 8).size(), 8);
+  EXPECT_THROW(CompileRegexp(rp, 7), std::runtime_error);
+  // Expanded counters are not walked through completely.
+  rp = ExpandRegexp(ParseRegexp("(((a{64}){64}){64}){64}"));
+  EXPECT_THROW(CompileRegexp(rp, 1000), std::runtime_error);
+}
+
 };  // namespace Azuki
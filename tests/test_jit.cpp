@@ -0,0 +1,124 @@
+#include "azuki.h"
+#include "cases.h"
+#include "gtest/gtest.h"
+#include "jit.h"
+
+namespace Azuki {
+
+namespace {
+
+// Return a copy of m which runs engine wherever it can, and the interpreter
+// otherwise. Programs the JIT can't compile, like ones with counters, and
+// LEFTMOST_FIRST runs fall back to the interpreter.
+Machine WithPlan(const Machine &m, Engine engine) {
+  Machine copy = m;
+  if (engine == JIT && !copy.EnableJit()) engine = INTERPRETER;
+  MatchPlan plan = copy.GetPlan();
+  plan.existence = plan.anchored = plan.search = plan.capture = engine;
+  copy.SetPlan(plan);
+  return copy;
+}
+
+// Run input on machine m with the JIT and with the interpreter and compare
+// the results.
+void ExpectSameRun(const Machine &m, const string &s) {
+  Machine interpreter = WithPlan(m, INTERPRETER);
+  Machine jm = WithPlan(m, JIT);
+  for (bool save_capture : {false, true}) {
+    MatchResult expected = interpreter.Run(s, save_capture);
+    MatchResult actual = jm.Run(s, save_capture);
+    EXPECT_EQ(actual.success, expected.success) << s;
+    if (expected.success) {
+      EXPECT_EQ(actual.begin, expected.begin) << s;
+      EXPECT_EQ(actual.end, expected.end) << s;
+      EXPECT_EQ(actual.capture, expected.capture) << s;
+    }
+  }
+}
+
+// Iterate RegexSearch through input with the JIT and with the interpreter and
+// compare results.
+void ExpectSameSearch(const Machine &m, const string &e, const string &s) {
+  Machine interpreter = WithPlan(m, INTERPRETER);
+  Machine jm = WithPlan(m, JIT);
+  ExpectSameRun(m, s);
+  MatchResult expected, actual;
+  while (true) {
+    bool found = RegexSearch(interpreter, s, expected);
+    EXPECT_EQ(RegexSearch(jm, s, actual), found) << e << " " << s;
+    if (!found) break;
+    EXPECT_EQ(actual.begin, expected.begin) << e << " " << s;
+    EXPECT_EQ(actual.end, expected.end) << e << " " << s;
+    EXPECT_EQ(actual.capture, expected.capture) << e << " " << s;
+    // After an empty match, search again from the next character.
+    if (expected.begin == expected.end) actual.end = ++expected.end;
+  }
+  EXPECT_EQ(RegexCount(jm, s), RegexCount(interpreter, s)) << e << " " << s;
+  EXPECT_EQ(RegexReplace(jm, s, "$$", true),
+            RegexReplace(interpreter, s, "$$", true));
+}
+
+void ExpectSameSearch(const string &e, const string &s) {
+  ExpectSameSearch(CreateMachine(e), e, s);
+}
+
+Machine CreateMachineFromRegexp(RegexpPtr r) {
+  Program program = CompileRegexp(r);
+  Machine m(program);
+  m.SetMatchBegin(true);
+  return m;
+}
+
+};  // namespace
+
+TEST(JitTest, MachineCases) {
+  for (auto &c : MachineCases()) {
+    Machine m = CreateMachineFromRegexp(c.regexp);
+    for (bool match_begin : {true, false}) {
+      m.SetMatchBegin(match_begin);
+      for (auto &s : c.matched) ExpectSameRun(m, s);
+      for (auto &s : c.unmatched) ExpectSameRun(m, s);
+    }
+  }
+}
+
+TEST(JitTest, SearchCases) {
+  // Patterns with counters are compared too, and run the interpreter (see
+  // Fallback).
+  for (auto &c : SearchCases())
+    ExpectSameSearch(CreateCaseMachine(c), c.pattern, c.input);
+}
+
+TEST(JitTest, FoldCase) {
+  Machine m(ParseRegexp("host:[a-c]+|[0-C]", CASE_INSENSITIVE));
+  for (string s : {"x HOST:aBc", "Host:C", "host:d", "`@[{", "xyz c"})
+    ExpectSameRun(m, s);
+}
+
+TEST(JitTest, Fallback) {
+  // "a{3,5}" uses counters.
+  RegexpPtr rp = CreateCurlyRegexp(CreateLitRegexp('a'), 3, 5);
+  Machine m = CreateMachineFromRegexp(rp);
+  EXPECT_FALSE(m.EnableJit());
+  EXPECT_TRUE(m.Run("aaa").success);
+  EXPECT_FALSE(m.Run("aa").success);
+  EXPECT_EQ(CompileJit(CompileRegexp(ParseRegexp("a{2}"))), nullptr);
+  EXPECT_NE(CompileJit(CompileRegexp(ParseRegexp("a+b"))), nullptr);
+}
+
+TEST(JitTest, Count) {
+  Machine m = CreateMachine("(a|b)+c");
+  Machine interpreter = WithPlan(m, INTERPRETER);
+  Machine jit = WithPlan(m, JIT);
+  for (string s : {"abcxacbc", "", "ccc", "abab"})
+    EXPECT_EQ(RegexCount(jit, s), RegexCount(interpreter, s)) << s;
+}
+
+TEST(JitTest, Alternation) {
+  ExpectSameSearch("ab|abcd|b", "xxabcdabxb");
+  ExpectSameSearch("(a|b)*c", "abacbbcc");
+  ExpectSameSearch("a.c|\\d\\s", "abcx1 a\tc");
+  ExpectSameSearch("[0-9]+|[a-f]+", "zz12ab3f");
+}
+
+};  // namespace Azuki
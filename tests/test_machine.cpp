@@ -1,3 +1,6 @@
+#include <sstream>
+#include <thread>
+#include "cases.h"
 #include "gtest/gtest.h"
 #include "machine.h"
 
@@ -14,133 +17,509 @@ Machine CreateMachineFromRegexp(RegexpPtr r) {
 
 };  // namespace
 
-TEST(MachineTest, SingleChar) {
-  // match "a"
-  RegexpPtr rp = CreateLitRegexp('a');
-  Machine m = CreateMachineFromRegexp(rp);
-  EXPECT_TRUE(m.Run("a").success);
-  EXPECT_TRUE(m.Run("abc").success);
-  EXPECT_FALSE(m.Run("b").success);
-  EXPECT_FALSE(m.Run("bac").success);
+TEST(MachineTest, Cases) {
+  for (auto &c : MachineCases()) {
+    Machine m = CreateMachineFromRegexp(c.regexp);
+    for (auto &s : c.matched)
+      EXPECT_TRUE(m.Run(s).success) << c.pattern << " on " << s;
+    for (auto &s : c.unmatched)
+      EXPECT_FALSE(m.Run(s).success) << c.pattern << " on " << s;
+  }
 }
 
-TEST(MachineTest, SimpleCat) {
-  // match "ab"
-  RegexpPtr rp = CreateCatRegexp(CreateLitRegexp('a'), CreateLitRegexp('b'));
-  Machine m = CreateMachineFromRegexp(rp);
-  EXPECT_TRUE(m.Run("ab").success);
-  EXPECT_TRUE(m.Run("abc").success);
-  EXPECT_FALSE(m.Run("a").success);
-  EXPECT_FALSE(m.Run("bab").success);
+TEST(MachineTest, RunAnchored) {
+  Machine m(CompileRegexp(ParseRegexp("(a+)b")));
+  MatchResult ms = m.RunAnchored("aabab", false);
+  EXPECT_TRUE(ms.success);
+  EXPECT_EQ(ms.end, 3);
+  EXPECT_EQ(ms.capture, vector<string>({"aa"}));
+  EXPECT_FALSE(m.RunAnchored("aabab", true).success);
+  EXPECT_FALSE(m.RunAnchored("caab", false).success);
+  EXPECT_TRUE(m.RunAnchored("aab", true).success);
+
+  // Same with Dfa and OnePass.
+  Machine two_phase(ParseRegexp("(a+)b"));
+  ms = two_phase.RunAnchored("aabab", false);
+  EXPECT_TRUE(ms.success);
+  EXPECT_EQ(ms.end, 3);
+  EXPECT_EQ(ms.capture, vector<string>({"aa"}));
+  EXPECT_FALSE(two_phase.RunAnchored("aabab", true).success);
+  EXPECT_FALSE(two_phase.RunAnchored("caab", false, false).success);
+
+  // The machine is not changed.
+  EXPECT_TRUE(m.Run("caab").success);
 }
 
-TEST(MachineTest, SimpleDot) {
-  // match ".b"
-  RegexpPtr rp = CreateCatRegexp(CreateDotRegexp(), CreateLitRegexp('b'));
-  Machine m = CreateMachineFromRegexp(rp);
-  EXPECT_TRUE(m.Run("ab").success);
-  EXPECT_TRUE(m.Run("cba").success);
-  EXPECT_FALSE(m.Run("b").success);
-  EXPECT_FALSE(m.Run("cab").success);
+TEST(MachineTest, LeftmostFirst) {
+  const char *e = "(a|ab)(c|bcd)(d*)";
+  Machine m(CompileRegexp(ParseRegexp(e)));
+  MatchResult ms = m.Run("xabcd");
+  EXPECT_EQ(ms.end, 5);
+
+  m.SetMatchKind(LEFTMOST_FIRST);
+  ms = m.Run("xabcd");
+  EXPECT_TRUE(ms.success);
+  EXPECT_EQ(ms.begin, 1);
+  EXPECT_EQ(ms.end, 5);
+  EXPECT_EQ(ms.capture, vector<string>({"a", "bcd", ""}));
+
+  // Same with two-phase matching.
+  Machine two_phase(ParseRegexp(e));
+  two_phase.SetMatchKind(LEFTMOST_FIRST);
+  ms = two_phase.Run("xabcd");
+  EXPECT_EQ(ms.end, 5);
+  EXPECT_EQ(ms.capture, vector<string>({"a", "bcd", ""}));
+
+  // Lower priority alternatives are dropped on a match.
+  Machine alt(CompileRegexp(ParseRegexp("ab|abcd")));
+  alt.SetMatchKind(LEFTMOST_FIRST);
+  ms = alt.Run("abcd");
+  EXPECT_EQ(ms.end, 2);
+  alt.SetMatchEnd(true);
+  EXPECT_EQ(alt.Run("abcd").end, 4);
+
+  Machine greedy(CompileRegexp(ParseRegexp("(a+)(a*)")));
+  greedy.SetMatchKind(LEFTMOST_FIRST);
+  EXPECT_EQ(greedy.Run("aaa").capture, vector<string>({"aaa", ""}));
+  EXPECT_TRUE(greedy.RunAnchored("aaa", true).success);
 }
 
-TEST(MachineTest, SimpleSplit) {
-  // match "a|b"
-  RegexpPtr rp = CreateAltRegexp(CreateLitRegexp('a'), CreateLitRegexp('b'));
-  Machine m = CreateMachineFromRegexp(rp);
-  EXPECT_TRUE(m.Run("a").success);
-  EXPECT_TRUE(m.Run("b").success);
-  EXPECT_FALSE(m.Run("c").success);
+TEST(MachineTest, SplitPriority) {
+  // Greedy repetitions try one more time first, but with LEFTMOST_LONGEST
+  // the priority of SPLIT doesn't change the match or capture groups.
+  const vector<pair<string, string>> cases = {{"((.{1,2})+)", "cb"},
+                                              {"((.{1,2})+).*", "cb"},
+                                              {"(a*)(a*)", "aa"},
+                                              {"(a+)(a*)", "aaa"},
+                                              {"(a?)(a?)", "a"}};
+  const vector<vector<string>> expected = {
+      {"cb", "cb"}, {"c", "c"}, {"", "aa"}, {"a", "aa"}, {"", "a"}};
+  for (unsigned int i = 0; i < cases.size(); ++i) {
+    Program program = CompileRegexp(ParseRegexp(cases[i].first));
+    MatchResult ms = Machine(program).Run(cases[i].second);
+    EXPECT_EQ(ms.capture, expected[i]) << cases[i].first;
+    EXPECT_EQ(Machine(ParseRegexp(cases[i].first)).Run(cases[i].second).capture,
+              expected[i])
+        << cases[i].first;
+    for (auto &instr : program)
+      if (instr->opcode == SPLIT) instr->greedy = !instr->greedy;
+    MatchResult reversed = Machine(program).Run(cases[i].second);
+    EXPECT_EQ(reversed.end, ms.end) << cases[i].first;
+    EXPECT_EQ(reversed.spans, ms.spans) << cases[i].first;
+  }
 }
 
-TEST(MachineTest, SimplePlus) {
-  // match "a+"
-  RegexpPtr rp = CreatePlusRegexp(CreateLitRegexp('a'));
-  Machine m = CreateMachineFromRegexp(rp);
-  EXPECT_TRUE(m.Run("a").success);
-  EXPECT_TRUE(m.Run("aa").success);
-  EXPECT_FALSE(m.Run("b").success);
+TEST(MachineTest, Count) {
+  Machine m(CompileRegexp(ParseRegexp("a+")));
+  EXPECT_EQ(m.Count("aabaca"), 3);
+  EXPECT_EQ(m.Count("bcd"), 0);
+  EXPECT_EQ(m.Count(""), 0);
+
+  // Empty matches skip a character, and may end the input.
+  Machine star(CompileRegexp(ParseRegexp("a*")));
+  EXPECT_EQ(star.Count("aabc"), 4);
+  EXPECT_EQ(star.Count(""), 1);
+
+  Machine anchored(CompileRegexp(ParseRegexp("a+")));
+  anchored.SetMatchBegin(true);
+  EXPECT_EQ(anchored.Count("aabaca"), 1);
+  EXPECT_EQ(anchored.Count("baca"), 0);
+
+  // Same with Dfa.
+  Machine two_phase(ParseRegexp("a+"));
+  EXPECT_EQ(two_phase.Count("aabaca"), 3);
+  two_phase.SetMatchEnd(true);
+  EXPECT_EQ(two_phase.Count("aabaca"), 1);
+  EXPECT_EQ(two_phase.Count("aabac"), 0);
+  Machine two_phase_star(ParseRegexp("a*"));
+  EXPECT_EQ(two_phase_star.Count("aabc"), 4);
+  EXPECT_EQ(two_phase_star.Count(""), 1);
+  // The reverse Dfa tells an empty match after pos from a longer one.
+  Machine empty_end(ParseRegexp("(bc)?"));
+  empty_end.SetMatchEnd(true);
+  EXPECT_EQ(empty_end.Count("bcc"), 1);
+  EXPECT_EQ(empty_end.Count("abc"), 2);
 }
 
-TEST(MachineTest, SimpleQuest) {
-  // match "a?b"
-  auto left = CreateQuestRegexp(CreateLitRegexp('a'));
-  RegexpPtr rp = CreateCatRegexp(left, CreateLitRegexp('b'));
-  Machine m = CreateMachineFromRegexp(rp);
-  EXPECT_TRUE(m.Run("b").success);
-  EXPECT_TRUE(m.Run("ab").success);
-  EXPECT_FALSE(m.Run("cab").success);
+TEST(MachineTest, ForEachMatch) {
+  Machine m(ParseRegexp("(a+)|b?"));
+  vector<pair<unsigned int, unsigned int>> matches;
+  vector<string> groups;
+  string s = "aacab";
+  m.ForEachMatch(s, true, [&](const MatchResult &ms) {
+    matches.push_back(std::make_pair(ms.begin, ms.end));
+    groups.push_back(ms.capture[0]);
+    return true;
+  });
+  // Empty matches move on from the next character, and one ends s.
+  EXPECT_EQ(matches, (vector<pair<unsigned int, unsigned int>>(
+                         {{0, 2}, {2, 2}, {3, 4}, {4, 5}, {5, 5}})));
+  EXPECT_EQ(groups, vector<string>({"aa", "", "a", "", ""}));
+  EXPECT_EQ(matches.size(), m.Count(s));
+
+  // The scan stops when f returns false.
+  unsigned int calls = 0;
+  m.ForEachMatch(s, false, [&](const MatchResult &) { return ++calls < 2; });
+  EXPECT_EQ(calls, 2);
+
+  // Removed ".*" begin where the search does and end at the end of s.
+  Machine dot_star(ParseRegexp(".*b.*"));
+  matches.clear();
+  dot_star.ForEachMatch("xab\nb", false, [&](const MatchResult &ms) {
+    matches.push_back(std::make_pair(ms.begin, ms.end));
+    return true;
+  });
+  EXPECT_EQ(matches, (vector<pair<unsigned int, unsigned int>>({{0, 5}})));
+
+  Machine begin(ParseRegexp("a"));
+  begin.SetMatchBegin(true);
+  calls = 0;
+  begin.ForEachMatch("aaa", false, [&](const MatchResult &) {
+    ++calls;
+    return true;
+  });
+  EXPECT_EQ(calls, 1);
 }
 
-TEST(MachineTest, SimpleStar) {
-  // match "a*b"
-  auto left = CreateStarRegexp(CreateLitRegexp('a'));
-  RegexpPtr rp = CreateCatRegexp(left, CreateLitRegexp('b'));
-  Machine m = CreateMachineFromRegexp(rp);
-  EXPECT_TRUE(m.Run("b").success);
-  EXPECT_TRUE(m.Run("ab").success);
-  EXPECT_TRUE(m.Run("aaab").success);
-  EXPECT_FALSE(m.Run("cab").success);
+TEST(MachineTest, DotStar) {
+  CompiledRegexp cr = CreateCompiledRegexp(ParseRegexp(".*err.*"));
+  EXPECT_TRUE(cr.dot_star_begin);
+  EXPECT_TRUE(cr.dot_star_end);
+  EXPECT_EQ(cr.program.size(), 4);
+  MatchResult ms = Machine(cr).Run("an\nerror here");
+  EXPECT_TRUE(ms.success);
+  EXPECT_EQ(ms.begin, 0);
+  EXPECT_EQ(ms.end, 13);
+
+  // The leading ".*" decides which "e" the group holds.
+  cr = CreateCompiledRegexp(ParseRegexp(".*(e)rr.*"));
+  EXPECT_FALSE(cr.dot_star_begin);
+  EXPECT_FALSE(cr.dot_star_end);
+  Machine m(cr);
+  ms = m.Run("an\nerror here");
+  EXPECT_TRUE(ms.success);
+  EXPECT_EQ(ms.begin, 0);
+  EXPECT_EQ(ms.end, 13);
+  EXPECT_EQ(ms.capture, vector<string>({"e"}));
+  EXPECT_EQ(ms.spans[0], std::make_pair(3u, 4u));
+  EXPECT_FALSE(m.Run("no match").success);
+  EXPECT_TRUE(m.RunAnchored("an error", true).success);
+  EXPECT_EQ(m.Count("error error"), 1);
+
+  // Only the trailing ".*" is removed, the match begins where "a+" begins.
+  cr = CreateCompiledRegexp(ParseRegexp("a+.*"));
+  EXPECT_FALSE(cr.dot_star_begin);
+  EXPECT_TRUE(cr.dot_star_end);
+  Machine trailing(cr);
+  ms = trailing.Run("xaaby");
+  EXPECT_EQ(ms.begin, 1);
+  EXPECT_EQ(ms.end, 5);
+  trailing.SetMatchEnd(true);
+  EXPECT_EQ(trailing.Run("xaaby").end, 5);
+  trailing.SetMatchBegin(true);
+  EXPECT_FALSE(trailing.Run("xaaby").success);
+  EXPECT_EQ(trailing.Count("aa"), 1);
+
+  // A leading ".*" alone decides where the match ends, and ".*" in a capture
+  // group is saved.
+  EXPECT_FALSE(CreateCompiledRegexp(ParseRegexp(".*a")).dot_star_begin);
+  EXPECT_FALSE(CreateCompiledRegexp(ParseRegexp("a(.*)")).dot_star_end);
+
+  // The trailing ".*" decides how long the groups before it are.
+  Machine groups(CreateCompiledRegexp(ParseRegexp("(a*)(a*).*")));
+  Machine expected_groups(CompileRegexp(ParseRegexp("(a*)(a*).*")));
+  ms = groups.Run("aaa");
+  EXPECT_EQ(ms.capture, vector<string>({"", ""}));
+  EXPECT_EQ(ms.spans, expected_groups.Run("aaa").spans);
+  Machine alt(CreateCompiledRegexp(ParseRegexp("(x*)(ab|a)(bc|c)?.*")));
+  Machine expected_alt(CompileRegexp(ParseRegexp("(x*)(ab|a)(bc|c)?.*")));
+  ms = alt.Run("abcz");
+  EXPECT_EQ(ms.capture[1], "a");
+  EXPECT_EQ(ms.spans, expected_alt.Run("abcz").spans);
+
+  // With LEFTMOST_FIRST, the leading ".*" takes the last occurrence it can.
+  cr = CreateCompiledRegexp(ParseRegexp(".*(a).*"), UINT_MAX, LEFTMOST_FIRST);
+  EXPECT_FALSE(cr.dot_star_begin);
+  Machine first(cr);
+  Machine expected(CompileRegexp(ParseRegexp(".*(a).*")));
+  expected.SetMatchKind(LEFTMOST_FIRST);
+  ms = first.Run("cacacb");
+  EXPECT_EQ(ms.spans[0], std::make_pair(3u, 4u));
+  EXPECT_EQ(ms.spans, expected.Run("cacacb").spans);
+  EXPECT_TRUE(CreateCompiledRegexp(ParseRegexp(".*a.*"), UINT_MAX,
+                                   LEFTMOST_FIRST)
+                  .dot_star_begin);
 }
 
-TEST(MachineTest, SimpleParen) {
-  // match "(a+)"
-  RegexpPtr rp = CreateParenRegexp(CreatePlusRegexp(CreateLitRegexp('a')));
-  Machine m = CreateMachineFromRegexp(rp);
-  EXPECT_TRUE(m.Run("a").success);
-  EXPECT_TRUE(m.Run("aa").success);
-  EXPECT_FALSE(m.Run("b").success);
-  EXPECT_FALSE(m.Run("baac").success);
+TEST(MachineTest, Plan) {
+  Machine m(ParseRegexp("ab(c|d)+"));
+  MatchPlan plan = m.GetPlan();
+  EXPECT_EQ(plan.prefix, "ab");
+  EXPECT_EQ(plan.first_bytes.str(), "[a]");
+  EXPECT_EQ(plan.existence, BIT_PARALLEL);
+  EXPECT_EQ(plan.anchored, ONE_PASS);
+  EXPECT_EQ(plan.search, TWO_PHASE);
+  EXPECT_EQ(plan.capture, TWO_PHASE);
+  MatchResult ms = m.Run("xxabcdab");
+  EXPECT_EQ(ms.begin, 2);
+  EXPECT_EQ(ms.end, 6);
+  EXPECT_EQ(ms.capture, vector<string>({"d"}));
+  EXPECT_FALSE(m.Run("xxacd").success);
+  EXPECT_EQ(m.Count("abcxabd"), 2);
+
+  // Any plan gives the same results.
+  plan.prefix = "a";
+  plan.existence = plan.anchored = plan.search = plan.capture = INTERPRETER;
+  m.SetPlan(plan);
+  ms = m.Run("xxabcdab");
+  EXPECT_EQ(ms.begin, 2);
+  EXPECT_EQ(ms.end, 6);
+  EXPECT_EQ(ms.capture, vector<string>({"d"}));
+  EXPECT_TRUE(m.HasMatch("abd"));
+
+  plan.prefix = "abc";
+  EXPECT_THROW(m.SetPlan(plan), std::runtime_error);
+  plan.prefix = "";
+  plan.first_bytes = ByteSet(std::bitset<256>().set('b'));
+  EXPECT_THROW(m.SetPlan(plan), std::runtime_error);
+  plan.first_bytes = ByteSet(std::bitset<256>().set());
+  plan.search = JIT;
+  EXPECT_THROW(m.SetPlan(plan), std::runtime_error);
+
+  // Machines from programs only run the interpreter.
+  Machine interpreter(CompileRegexp(ParseRegexp("ab")));
+  EXPECT_EQ(interpreter.GetPlan().prefix, "");
+  EXPECT_EQ(interpreter.GetPlan().search, INTERPRETER);
 }
 
-TEST(MachineTest, SimpleWordClass) {
-  // match "\w+"
-  RegexpPtr rp = CreatePlusRegexp(CreateClassRegexp('w'));
-  Machine m = CreateMachineFromRegexp(rp);
-  EXPECT_TRUE(m.Run("ab_12").success);
-  EXPECT_TRUE(m.Run("12_ab").success);
-  EXPECT_FALSE(m.Run("\ta1").success);
-  EXPECT_FALSE(m.Run("?a1").success);
+TEST(MachineTest, FoldCase) {
+  Machine m(ParseRegexp("host:([a-c]+)", CASE_INSENSITIVE));
+  MatchPlan plan = m.GetPlan();
+  // Folded letters are not a literal prefix, first bytes skip instead.
+  EXPECT_EQ(plan.prefix, "");
+  EXPECT_EQ(plan.first_bytes.str(), "[Hh]");
+  EXPECT_EQ(plan.anchored, ONE_PASS);
+  EXPECT_EQ(plan.search, TWO_PHASE);
+
+  Machine interpreter = m;
+  plan.existence = plan.anchored = plan.search = plan.capture = INTERPRETER;
+  interpreter.SetPlan(plan);
+  for (string s : {"x HOST:aBc", "Host:C", "host:d", "hosT:[", "HOST:@"}) {
+    MatchResult expected = interpreter.Run(s), actual = m.Run(s);
+    EXPECT_EQ(actual.success, expected.success) << s;
+    if (expected.success) {
+      EXPECT_EQ(actual.begin, expected.begin) << s;
+      EXPECT_EQ(actual.end, expected.end) << s;
+      EXPECT_EQ(actual.capture, expected.capture) << s;
+    }
+    EXPECT_EQ(m.RunAnchored(s, true).success,
+              interpreter.RunAnchored(s, true).success)
+        << s;
+    EXPECT_EQ(m.HasMatch(s), expected.success) << s;
+  }
+  EXPECT_EQ(m.Run("x HOST:aBc").capture, vector<string>({"aBc"}));
+  EXPECT_FALSE(m.HasMatch("HOST:@"));
 }
 
-TEST(MachineTest, SimpleDigitClass) {
-  // match "\d+"
-  RegexpPtr rp = CreatePlusRegexp(CreateClassRegexp('d'));
-  Machine m = CreateMachineFromRegexp(rp);
-  EXPECT_TRUE(m.Run("1234").success);
-  EXPECT_TRUE(m.Run("023").success);
-  EXPECT_FALSE(m.Run(" 12").success);
-  EXPECT_FALSE(m.Run("a1").success);
+TEST(MachineTest, Capture) {
+  Machine m(ParseRegexp("(a+)(c)?(b)"));
+  string s = "xaab";
+  MatchResult ms = m.Run(s);
+  ASSERT_TRUE(ms.success);
+  EXPECT_EQ(ms.capture.size(), 3);
+  EXPECT_EQ(ms.capture.View(0), "aa");
+  // Views point into the input.
+  EXPECT_EQ(ms.capture.View(0).data(), s.data() + 1);
+  EXPECT_TRUE(ms.capture.View(1).empty());
+  EXPECT_EQ(ms.capture[2], "b");
+
+  // Copies read the same input.
+  MatchResult copied = ms;
+  ms = MatchResult();
+  EXPECT_TRUE(ms.capture.empty());
+  EXPECT_EQ(copied.capture, vector<string>({"aa", "", "b"}));
+  vector<string> groups;
+  for (auto &group : copied.capture) groups.push_back(group);
+  EXPECT_EQ(groups, vector<string>(copied.capture));
+
+  EXPECT_TRUE(m.Run(s, false).capture.empty());
+
+  // Every group has a span, even if a trailing group doesn't match.
+  Machine alt(ParseRegexp("(a)|(b)"));
+  Machine alt_interpreter(CompileRegexp(ParseRegexp("(a)|(b)")));
+  for (auto *machine : {&alt, &alt_interpreter}) {
+    EXPECT_EQ(machine->Run("a").capture, vector<string>({"a", ""}));
+    EXPECT_EQ(machine->Run("b").capture, vector<string>({"", "b"}));
+    EXPECT_EQ(machine->RunAnchored("a", true).capture,
+              vector<string>({"a", ""}));
+  }
+}
+
+TEST(MachineTest, Stats) {
+  Machine m(CompileRegexp(ParseRegexp("a(b|c)+")));
+  MatchStats stats;
+  EXPECT_TRUE(m.Run("xabcb", true, stats).success);
+  EXPECT_FALSE(m.Run("xa", true, stats).success);
+#ifdef AZUKI_ENABLE_STATS
+  EXPECT_EQ(stats.runs[INTERPRETER], 2);
+  EXPECT_EQ(stats.engine, INTERPRETER);
+  EXPECT_EQ(stats.bytes_scanned, 7);
+  EXPECT_GT(stats.instructions, 0);
+  EXPECT_GT(stats.threads, 0);
+  EXPECT_GT(stats.peak_threads, 1);
+
+  // Two-phase matching reads the input with Dfa first.
+  Machine two_phase(ParseRegexp("a(b|c)+"));
+  MatchStats dfa_stats;
+  EXPECT_TRUE(two_phase.Run("xabcb", false, dfa_stats).success);
+  EXPECT_EQ(dfa_stats.engine, TWO_PHASE);
+  EXPECT_EQ(dfa_stats.instructions, 0);
+  stats += dfa_stats;
+  EXPECT_EQ(stats.runs[TWO_PHASE], 1);
+  EXPECT_EQ(stats.engine, TWO_PHASE);
+
+  // Lazy repetitions stop reading at the first match they prefer.
+  Machine lazy(ParseRegexp("<.*?>"));
+  lazy.SetMatchKind(LEFTMOST_FIRST);
+  MatchStats lazy_stats;
+  string tags = "<a>" + string(1000, 'x') + ">";
+  EXPECT_EQ(lazy.Run(tags, false, lazy_stats).end, 3);
+  EXPECT_LT(lazy_stats.bytes_scanned, 20);
+#else
+  EXPECT_EQ(stats.runs[INTERPRETER], 0);
+  EXPECT_EQ(stats.instructions, 0);
+  EXPECT_EQ(stats.bytes_scanned, 0);
+#endif
 }
 
-TEST(MachineTest, SimpleSpaceClass) {
-  // match "\s+"
-  RegexpPtr rp = CreatePlusRegexp(CreateClassRegexp('s'));
-  Machine m = CreateMachineFromRegexp(rp);
-  EXPECT_TRUE(m.Run("  a1").success);
-  EXPECT_TRUE(m.Run("\t\ra1").success);
-  EXPECT_FALSE(m.Run("a1").success);
-  EXPECT_FALSE(m.Run("?a1").success);
+TEST(MachineTest, Profile) {
+  Machine m(CreateCompiledRegexp(ParseRegexp("a(b|c)+"), UINT_MAX,
+                                 LEFTMOST_LONGEST, true));
+  EXPECT_TRUE(m.GetProfile().executions.empty());
+
+  // Every engine is replaced by the interpreter, with the same results.
+  m.EnableProfiling();
+  MatchStats stats;
+  MatchResult ms = m.Run("xabcb", true, stats);
+  EXPECT_EQ(ms.begin, 1);
+  EXPECT_EQ(ms.end, 5);
+  EXPECT_EQ(ms.capture, vector<string>({"b"}));
+  EXPECT_TRUE(m.HasMatch("xab"));
+  EXPECT_EQ(m.Count("abxac"), 2);
+#ifdef AZUKI_ENABLE_STATS
+  EXPECT_EQ(stats.engine, INTERPRETER);
+#endif
+
+  MatchProfile profile = m.GetProfile();
+  const Program &program = m.GetProgram();
+  ASSERT_EQ(profile.executions.size(), program.size());
+  EXPECT_GT(profile.executions[0], 0);
+  for (unsigned int idx = 0; idx < program.size(); ++idx) {
+    if (program[idx]->opcode == SPLIT)
+      EXPECT_GT(profile.spawns[idx], 0);
+    else
+      EXPECT_EQ(profile.spawns[idx], 0);
+  }
+  std::stringstream ss;
+  PrintProgram(program, profile, ss);
+  EXPECT_NE(ss.str().find("I0 CHAR 'a'"), string::npos);
+  EXPECT_NE(ss.str().find("spawns  <- (b|c)+"), string::npos);
+
+  // Without sources, instructions are not annotated with the pattern.
+  Machine plain(ParseRegexp("a(b|c)+"));
+  plain.EnableProfiling();
+  EXPECT_TRUE(plain.Run("xabcb").success);
+  std::stringstream plain_ss;
+  PrintProgram(plain.GetProgram(), plain.GetProfile(), plain_ss);
+  EXPECT_NE(plain_ss.str().find("spawns"), string::npos);
+  EXPECT_EQ(plain_ss.str().find("<-"), string::npos);
+
+  // Counts stop when profiling is disabled, and restart from zero.
+  unsigned long executions = profile.executions[0];
+  m.EnableProfiling(false);
+  EXPECT_TRUE(m.Run("xabcb").success);
+  EXPECT_EQ(m.GetProfile().executions[0], executions);
+  m.EnableProfiling();
+  EXPECT_EQ(m.GetProfile().executions[0], 0);
 }
 
-TEST(MachineTest, SimpleRange) {
-  // match "[a-c]+"
-  RegexpPtr rp = CreatePlusRegexp(CreateSquareRegexp('a', 'c'));
-  Machine m = CreateMachineFromRegexp(rp);
-  EXPECT_TRUE(m.Run("abc").success);
-  EXPECT_TRUE(m.Run("cabac").success);
-  EXPECT_FALSE(m.Run("1a2").success);
-  EXPECT_FALSE(m.Run(" ab").success);
+TEST(MachineTest, SharedByThreads) {
+  // Runs keep their own state, so threads can run the same machine.
+  Machine m(ParseRegexp("(\\w+)@(\\w+)\\.com"));
+  ASSERT_EQ(m.GetPlan().capture, TWO_PHASE);
+  vector<unsigned int> ends(4);
+  vector<string> users(ends.size());
+  vector<std::thread> threads;
+  for (unsigned int i = 0; i < ends.size(); ++i) {
+    threads.emplace_back([&, i] {
+      for (int j = 0; j < 100; ++j) {
+        string s = string(j, 'x') + " bob" + std::to_string(i) + "@mail.com";
+        MatchResult ms = m.Run(s);
+        ends[i] = ms.end;
+        users[i] = ms.capture[0];
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  for (unsigned int i = 0; i < ends.size(); ++i) {
+    EXPECT_EQ(ends[i], 113);
+    EXPECT_EQ(users[i], "bob" + std::to_string(i));
+  }
+
+  // Counts of every run are added to the profile.
+  Machine p(ParseRegexp("a+b"));
+  p.EnableProfiling();
+  threads.clear();
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < 100; ++j) p.Run("aab");
+    });
+  }
+  // The profile may be read while runs add to it.
+  unsigned long first = 0;
+  for (int j = 0; j < 100; ++j) {
+    MatchProfile profile = p.GetProfile();
+    EXPECT_GE(profile.executions[0], first);
+    first = profile.executions[0];
+  }
+  for (auto &t : threads) t.join();
+  Machine q(ParseRegexp("a+b"));
+  q.EnableProfiling();
+  for (int j = 0; j < 400; ++j) q.Run("aab");
+  EXPECT_EQ(p.GetProfile().executions, q.GetProfile().executions);
+  EXPECT_EQ(p.GetProfile().spawns, q.GetProfile().spawns);
 }
 
-TEST(MachineTest, SimpleCurly) {
-  // match "a{3, 5}"
-  RegexpPtr rp = CreateCurlyRegexp(CreateLitRegexp('a'), 3, 5);
-  Machine m = CreateMachineFromRegexp(rp);
-  EXPECT_TRUE(m.Run("aaa").success);
-  EXPECT_TRUE(m.Run("aaaaa").success);
-  EXPECT_FALSE(m.Run("aa").success);
-  EXPECT_FALSE(m.Run("ab").success);
+TEST(MachineTest, Budget) {
+  // Threads of the virtual machine are not merged, so nested repetition makes
+  // lots of them.
+  Machine m(CompileRegexp(ParseRegexp("(x+x+)+y")));
+  string s(16, 'x');
+  MatchResult ms = m.Run(s);
+  EXPECT_FALSE(ms.success);
+  EXPECT_FALSE(ms.budget_exceeded);
+
+  MatchBudget budget;
+  budget.max_threads = 1000;
+  m.SetBudget(budget);
+  ms = m.Run(s);
+  EXPECT_FALSE(ms.success);
+  EXPECT_TRUE(ms.budget_exceeded);
+
+  budget.max_threads = 0;
+  budget.max_steps = 1000;
+  m.SetBudget(budget);
+  EXPECT_TRUE(m.Run(s).budget_exceeded);
+
+  budget.max_steps = 0;
+  budget.max_memory = 4096;
+  m.SetBudget(budget);
+  EXPECT_TRUE(m.Run(s).budget_exceeded);
+
+  // Small inputs stay within the budget.
+  ms = m.Run("xxy");
+  EXPECT_TRUE(ms.success);
+  EXPECT_FALSE(ms.budget_exceeded);
 }
 
 };  // namespace Azuki
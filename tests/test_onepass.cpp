@@ -0,0 +1,90 @@
+#include "gtest/gtest.h"
+#include "machine.h"
+
+namespace Azuki {
+
+namespace {
+
+OnePassPtr CreateOnePassFromString(const string &e) {
+  return CreateOnePass(CompileRegexp(ExpandRegexp(ParseRegexp(e))));
+}
+
+// Run OnePass and the interpreter anchored at index 0 and compare results.
+void ExpectSameRun(const string &e, const string &s, bool match_end) {
+  OnePassPtr op = CreateOnePassFromString(e);
+  ASSERT_NE(op, nullptr) << e;
+  Machine m(CompileRegexp(ParseRegexp(e)));
+  m.SetMatchBegin(true);
+  m.SetMatchEnd(match_end);
+  MatchResult expected = m.Run(s), actual = op->Run(s, match_end);
+  EXPECT_EQ(actual.success, expected.success) << e << " " << s;
+  if (!expected.success) return;
+  EXPECT_EQ(actual.begin, expected.begin) << e << " " << s;
+  EXPECT_EQ(actual.end, expected.end) << e << " " << s;
+  EXPECT_EQ(actual.capture, expected.capture) << e << " " << s;
+  EXPECT_EQ(actual.spans, expected.spans) << e << " " << s;
+}
+
+};  // namespace
+
+TEST(OnePassTest, Analysis) {
+  EXPECT_NE(CreateOnePassFromString("\\d{3}-\\d{4}"), nullptr);
+  EXPECT_NE(CreateOnePassFromString("[a-z]+@[a-z]+"), nullptr);
+  EXPECT_NE(CreateOnePassFromString("(\\w+)\\s(\\d+)"), nullptr);
+  EXPECT_NE(CreateOnePassFromString("a(b|c)*d"), nullptr);
+  // Both "a*" and "a" can consume "a".
+  EXPECT_EQ(CreateOnePassFromString("a*a"), nullptr);
+  // Both branches can consume "a".
+  EXPECT_EQ(CreateOnePassFromString("(a|ab)"), nullptr);
+  // Counters are not supported.
+  EXPECT_EQ(CreateOnePass(CompileRegexp(ParseRegexp("a{2,3}"))), nullptr);
+}
+
+TEST(OnePassTest, Run) {
+  OnePassPtr op = CreateOnePassFromString("(\\d+)-(\\d+)");
+  MatchResult ms = op->Run("123-4567x", false);
+  EXPECT_TRUE(ms.success);
+  EXPECT_EQ(ms.begin, 0);
+  EXPECT_EQ(ms.end, 8);
+  EXPECT_EQ(ms.capture, vector<string>({"123", "4567"}));
+  EXPECT_FALSE(op->Run("123-4567x", true).success);
+  EXPECT_FALSE(op->Run("x123-4567", false).success);
+  EXPECT_TRUE(op->Run("1-2", true, LEFTMOST_LONGEST, false).capture.empty());
+}
+
+TEST(OnePassTest, SameAsInterpreter) {
+  for (bool match_end : {false, true}) {
+    ExpectSameRun("\\d{3}-\\d{4}", "555-1234", match_end);
+    ExpectSameRun("\\d{3}-\\d{4}", "555-123", match_end);
+    ExpectSameRun("([a-z]+)@([a-z]+)", "alice@example", match_end);
+    ExpectSameRun("([a-z]+)@([a-z]+)", "alice@example.com", match_end);
+    ExpectSameRun("a(b|c)*d", "abcbcd", match_end);
+    ExpectSameRun("(ab)+c(ef)", "ababcef", match_end);
+    ExpectSameRun("x(y)?z", "xz", match_end);
+    ExpectSameRun("x(y)?z", "xyz", match_end);
+    ExpectSameRun("(\\w+)\\s(\\d+)", "abc 123 def", match_end);
+  }
+}
+
+TEST(OnePassTest, Machine) {
+  // Anchored machines use OnePass, others fall back to two-phase matching.
+  Machine m(ParseRegexp("(\\d+)-(\\d+)"));
+  m.SetMatchBegin(true);
+  MatchResult ms = m.Run("12-345 6-7");
+  EXPECT_TRUE(ms.success);
+  EXPECT_EQ(ms.end, 6);
+  EXPECT_EQ(ms.capture, vector<string>({"12", "345"}));
+  m.SetMatchBegin(false);
+  ms = m.Run("x12-345");
+  EXPECT_TRUE(ms.success);
+  EXPECT_EQ(ms.begin, 1);
+
+  // Repeated capture groups are numbered again when expanded.
+  Machine curly(ParseRegexp("(ab){2}c"));
+  curly.SetMatchBegin(true);
+  ms = curly.Run("ababc");
+  EXPECT_TRUE(ms.success);
+  EXPECT_EQ(ms.capture, vector<string>({"ab"}));
+}
+
+};  // namespace Azuki
@@ -76,6 +76,17 @@ TEST(RegexTest, SimpleParen) {
 #endif
 }
 
+TEST(RegexTest, NonCapturing) {
+  RegexpPtr r1 = ParseRegexp("(?:ab)+(c)");
+  RegexpPtr r2 = CreateCatRegexp(
+      CreatePlusRegexp(CreateCatRegexp(CreateLitRegexp('a'),
+                                       CreateLitRegexp('b'))),
+      CreateParenRegexp(CreateLitRegexp('c')));
+  EXPECT_TRUE(r1 == r2);
+  EXPECT_TRUE(ParseRegexp("(a)((b))", NO_CAPTURE) == ParseRegexp("ab"));
+  EXPECT_THROW(ParseRegexp("(?a)"), std::runtime_error);
+}
+
 TEST(RegexTest, SimpleEscape1) {
   RegexpPtr r1 = ParseRegexp("\\w+");
   RegexpPtr r2 = CreatePlusRegexp(CreateClassRegexp('w'));
@@ -130,4 +141,112 @@ TEST(RegexTest, SimpleCurly3) {
 #endif
 }
 
+TEST(RegexTest, Lazy) {
+  RegexpPtr a = CreateLitRegexp('a');
+  EXPECT_TRUE(ParseRegexp("a*?") == CreateLazyRegexp(CreateStarRegexp(a)));
+  EXPECT_TRUE(ParseRegexp("a+?") == CreateLazyRegexp(CreatePlusRegexp(a)));
+  EXPECT_TRUE(ParseRegexp("a??") == CreateLazyRegexp(CreateQuestRegexp(a)));
+  EXPECT_TRUE(ParseRegexp("a{2,3}?") ==
+              CreateLazyRegexp(CreateCurlyRegexp(a, 2, 3)));
+  EXPECT_FALSE(ParseRegexp("a*?") == ParseRegexp("a*"));
+
+  // Expanded copies are lazy too.
+  RegexpPtr r1 = ExpandRegexp(ParseRegexp("a{1,2}?"));
+  RegexpPtr r2 = CreateCatRegexp(a, CreateLazyRegexp(CreateQuestRegexp(a)));
+  EXPECT_TRUE(r1 == r2);
+}
+
+TEST(RegexTest, Expand) {
+  RegexpPtr r1 = ExpandRegexp(ParseRegexp("a{2,3}"));
+  RegexpPtr a = CreateLitRegexp('a');
+  RegexpPtr r2 = CreateCatRegexp(a, CreateCatRegexp(a, CreateQuestRegexp(a)));
+  EXPECT_TRUE(r1 == r2);
+
+  RegexpPtr r3 = ExpandRegexp(ParseRegexp("a{1,}"));
+  RegexpPtr r4 = CreateCatRegexp(a, CreateStarRegexp(a));
+  EXPECT_TRUE(r3 == r4);
+
+  // Too many copies.
+  RegexpPtr r5 = ParseRegexp("a{1,100}");
+  EXPECT_TRUE(ExpandRegexp(r5) == r5);
+}
+
+TEST(RegexTest, Reverse) {
+  RegexpPtr r1 = ReverseRegexp(ParseRegexp("ab+"));
+  RegexpPtr r2 = CreateCatRegexp(CreatePlusRegexp(CreateLitRegexp('b')),
+                                 CreateLitRegexp('a'));
+  EXPECT_TRUE(r1 == r2);
+#ifdef DEBUG
+  PrintRegexp(r1);
+#endif
+}
+
+TEST(RegexTest, Utf8Range) {
+  // U+03B1 to U+03C9 share the first byte in two parts.
+  RegexpPtr r1 = ParseRegexp("[α-ω]", UTF8);
+  RegexpPtr r2 = CreateAltRegexp(
+      CreateCatRegexp(CreateLitRegexp('\xCE'),
+                      CreateSquareRegexp('\xB1', '\xBF')),
+      CreateCatRegexp(CreateLitRegexp('\xCF'),
+                      CreateSquareRegexp('\x80', '\x89')));
+  EXPECT_TRUE(r1 == r2);
+
+  // Ranges are split by the number of bytes.
+  RegexpPtr r3 = CreateUtf8RangeRegexp('a', 0x7FF);
+  RegexpPtr r4 = CreateAltRegexp(
+      CreateSquareRegexp('a', '\x7F'),
+      CreateCatRegexp(CreateSquareRegexp('\xC2', '\xDF'),
+                      CreateSquareRegexp('\x80', '\xBF')));
+  EXPECT_TRUE(r3 == r4);
+  EXPECT_TRUE(ParseRegexp("[a-z]", UTF8) == CreateSquareRegexp('a', 'z'));
+
+  EXPECT_THROW(CreateUtf8RangeRegexp(0x100, 0xFF), std::runtime_error);
+  EXPECT_THROW(CreateUtf8RangeRegexp(0, 0x110000), std::runtime_error);
+#ifdef DEBUG
+  PrintRegexp(r1);
+#endif
+}
+
+TEST(RegexTest, Utf8Literal) {
+  RegexpPtr r1 = ParseRegexp("é+", UTF8);
+  RegexpPtr r2 = CreatePlusRegexp(
+      CreateCatRegexp(CreateLitRegexp('\xC3'), CreateLitRegexp('\xA9')));
+  EXPECT_TRUE(r1 == r2);
+
+  // Overlong encoding.
+  EXPECT_THROW(ParseRegexp("\xC0\xAF", UTF8), std::runtime_error);
+}
+
+TEST(RegexTest, FoldCase) {
+  RegexpPtr r1 = ParseRegexp("a1[x-z]", CASE_INSENSITIVE);
+  EXPECT_TRUE(r1 == FoldCaseRegexp(ParseRegexp("a1[x-z]")));
+  EXPECT_FALSE(r1 == ParseRegexp("a1[x-z]"));
+  EXPECT_TRUE(r1->left->fold);
+  EXPECT_FALSE(r1->right->left->fold);
+  EXPECT_TRUE(r1->right->right->fold);
+  EXPECT_EQ(FormatRegexp(r1), "(?:a|A)1(?:[x-z]|[X-Z])");
+
+  // Only letters in the range are folded.
+  RegexpPtr r2 = FoldCaseRegexp(ParseRegexp("[0-C]"));
+  EXPECT_EQ(FormatRegexp(r2), "(?:[0-C]|[a-c])");
+  EXPECT_FALSE(FoldCaseRegexp(ParseRegexp("[0-9]"))->fold);
+  EXPECT_EQ(SwapCase('z'), 'Z');
+  EXPECT_EQ(SwapCase('@'), '@');
+#ifdef DEBUG
+  PrintRegexp(r1);
+#endif
+}
+
+TEST(RegexTest, Format) {
+  EXPECT_EQ(FormatRegexp(ParseRegexp("(a|b)+c?")), "(a|b)+c?");
+  EXPECT_EQ(FormatRegexp(ParseRegexp("a.\\d*?[x-z]{2,}")), "a.\\d*?[x-z]{2,}");
+  EXPECT_EQ(FormatRegexp(ParseRegexp("\\.\\(a{3}|b{1,2}?")),
+            "\\.\\(a{3}|b{1,2}?");
+  // Groups are added where the tree needs them.
+  EXPECT_EQ(FormatRegexp(ParseRegexp("(?:ab)*(?:c|d)")), "(?:ab)*(?:c|d)");
+  EXPECT_EQ(FormatRegexp(ParseRegexp("(?:a)*")), "a*");
+  RegexpPtr rp = ParseRegexp("(ab|c)+d|e?");
+  EXPECT_TRUE(ParseRegexp(FormatRegexp(rp)) == rp);
+}
+
 };  // namespace Azuki
@@ -0,0 +1,201 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include "azuki.h"
+#include "gtest/gtest.h"
+#include "serialize.h"
+
+namespace Azuki {
+
+namespace {
+
+void ExpectSameProgram(const Program &actual, const Program &expected) {
+  ASSERT_EQ(actual.size(), expected.size());
+  for (unsigned int idx = 0; idx < actual.size(); ++idx)
+    EXPECT_EQ(actual[idx]->str(), expected[idx]->str());
+}
+
+void ExpectSameSearch(const Machine &actual, const Machine &expected,
+                      const string &s) {
+  MatchResult ms1, ms2;
+  while (true) {
+    bool found = RegexSearch(expected, s, ms1);
+    EXPECT_EQ(RegexSearch(actual, s, ms2), found) << s;
+    if (!found) break;
+    EXPECT_EQ(ms2.begin, ms1.begin) << s;
+    EXPECT_EQ(ms2.end, ms1.end) << s;
+    EXPECT_EQ(ms2.capture, ms1.capture) << s;
+  }
+}
+
+void ExpectSameEngines(const CompiledEngines &actual,
+                       const CompiledEngines &expected) {
+  EXPECT_EQ(actual.prefix, expected.prefix);
+  EXPECT_EQ(actual.first_bytes.Bytes(), expected.first_bytes.Bytes());
+  ASSERT_EQ(actual.onepass != nullptr, expected.onepass != nullptr);
+  if (actual.onepass) {
+    auto &nodes = actual.onepass->Nodes();
+    auto &expected_nodes = expected.onepass->Nodes();
+    EXPECT_EQ(actual.onepass->NumSlots(), expected.onepass->NumSlots());
+    ASSERT_EQ(nodes.size(), expected_nodes.size());
+    for (unsigned int i = 0; i < nodes.size(); ++i) {
+      EXPECT_EQ(nodes[i].next, expected_nodes[i].next);
+      EXPECT_EQ(nodes[i].edges.size(), expected_nodes[i].edges.size());
+      EXPECT_EQ(nodes[i].has_match, expected_nodes[i].has_match);
+      EXPECT_EQ(nodes[i].match_saves, expected_nodes[i].match_saves);
+      EXPECT_EQ(nodes[i].match_rank, expected_nodes[i].match_rank);
+    }
+  }
+  ASSERT_EQ(actual.bitparallel != nullptr, expected.bitparallel != nullptr);
+  if (actual.bitparallel) {
+    auto &automaton = actual.bitparallel->GetAutomaton();
+    auto &expected_automaton = expected.bitparallel->GetAutomaton();
+    EXPECT_EQ(automaton.accept, expected_automaton.accept);
+    EXPECT_EQ(automaton.start, expected_automaton.start);
+    EXPECT_EQ(automaton.shifted, expected_automaton.shifted);
+    EXPECT_EQ(automaton.finals, expected_automaton.finals);
+    EXPECT_EQ(automaton.nullable, expected_automaton.nullable);
+    EXPECT_EQ(automaton.tables, expected_automaton.tables);
+  }
+}
+
+const vector<string> kPatterns = {"a+b", "^(ab)+c(ef)$", "(\\w+)@(\\w+)",
+                                  "a{2,3}$", "(((a{64}){64}){64}){64}b",
+                                  ".*ab.*", "<.*?>"};
+
+vector<CompiledRegexp> CompilePatterns() {
+  vector<CompiledRegexp> v;
+  for (auto &e : kPatterns) v.push_back(CreateCompiledRegexp(e));
+  return v;
+}
+
+};  // namespace
+
+TEST(SerializeTest, SaveLoad) {
+  vector<CompiledRegexp> v = CompilePatterns();
+  std::stringstream ss;
+  SavePrograms(v, ss);
+  vector<CompiledRegexp> loaded = LoadPrograms(ss);
+  ASSERT_EQ(loaded.size(), v.size());
+  for (unsigned int i = 0; i < v.size(); ++i) {
+    ExpectSameProgram(loaded[i].program, v[i].program);
+    ExpectSameProgram(loaded[i].expanded, v[i].expanded);
+    ExpectSameProgram(loaded[i].reversed, v[i].reversed);
+    EXPECT_EQ(loaded[i].match_begin, v[i].match_begin);
+    EXPECT_EQ(loaded[i].match_end, v[i].match_end);
+    EXPECT_EQ(loaded[i].dot_star_begin, v[i].dot_star_begin);
+    EXPECT_EQ(loaded[i].dot_star_end, v[i].dot_star_end);
+    EXPECT_EQ(loaded[i].kind, v[i].kind);
+    // Engines are loaded, not created again.
+    ASSERT_TRUE(loaded[i].engines);
+    ExpectSameEngines(*loaded[i].engines, *v[i].engines);
+    EXPECT_EQ(Machine(loaded[i]).GetPlan().str(),
+              Machine(v[i]).GetPlan().str());
+  }
+  // Expanded programs are too large for the fifth pattern.
+  EXPECT_TRUE(loaded[4].expanded.empty());
+  EXPECT_TRUE(loaded[5].dot_star_end);
+  // Lazy repetitions are kept leftmost first.
+  EXPECT_EQ(loaded.back().kind, LEFTMOST_FIRST);
+
+  // Folded instructions still match both cases.
+  RegexOptions options;
+  options.flags = CASE_INSENSITIVE;
+  std::stringstream folded;
+  SavePrograms({CreateCompiledRegexp("host:[a-c]", options)}, folded);
+  Machine m(LoadPrograms(folded)[0]);
+  EXPECT_TRUE(RegexSearch(m, "HOST:B"));
+  EXPECT_FALSE(RegexSearch(m, "HOST:D"));
+}
+
+TEST(SerializeTest, InvalidData) {
+  std::stringstream empty;
+  EXPECT_THROW(LoadPrograms(empty), std::runtime_error);
+
+  std::stringstream ss;
+  SavePrograms(CompilePatterns(), ss);
+  string data = ss.str();
+  // Bad version.
+  string version = data;
+  version[12] = kProgramFileVersion + 1;
+  std::stringstream bad_version(version);
+  EXPECT_THROW(LoadPrograms(bad_version), std::runtime_error);
+  // Truncated entries.
+  std::stringstream truncated(data.substr(0, data.size() - 1));
+  EXPECT_THROW(LoadPrograms(truncated), std::runtime_error);
+  // A counter used by CHECK and INCR before any SET.
+  CompiledRegexp cr = CreateCompiledRegexp("a{2,3}");
+  for (auto &instr : cr.program)
+    if (instr->opcode == SET) instr->rpctr_idx = 1;
+  std::stringstream unset;
+  SavePrograms({cr}, unset);
+  EXPECT_THROW(LoadPrograms(unset), std::runtime_error);
+
+  // Engines with OnePass and BitParallel, after the file header, an offset,
+  // the entry header and instructions.
+  cr = CreateCompiledRegexp("(a)b");
+  ASSERT_TRUE(cr.engines->onepass && cr.engines->bitparallel);
+  std::stringstream engines_ss;
+  SavePrograms({cr}, engines_ss);
+  string engines = engines_ss.str();
+  size_t header = 24 + 8 + 16 +
+                  32 * (cr.program.size() + cr.expanded.size() +
+                        cr.reversed.size());
+  auto expect_invalid = [&](size_t field, uint32_t value) {
+    string data = engines;
+    memcpy(&data[header + field], &value, sizeof(value));
+    std::stringstream ss(data);
+    EXPECT_THROW(LoadPrograms(ss), std::runtime_error) << field;
+  };
+  expect_invalid(0, 8);           // unknown flag
+  expect_invalid(4, 1000);        // prefix past the end
+  expect_invalid(40, 1000);       // nodes past the end
+  expect_invalid(44, 4);          // SAVE slots not in the program
+  expect_invalid(48, 9);          // tables for more than 64 positions
+  expect_invalid(56 + 2 + 4, 9);  // more runs than the file has
+}
+
+TEST(SerializeTest, OlderVersion) {
+  // Entries of version 4 end before the engines, which are then ignored.
+  vector<CompiledRegexp> v = CompilePatterns();
+  std::stringstream ss;
+  SavePrograms(v, ss);
+  string data = ss.str();
+  data[12] = 4;
+  std::stringstream older(data);
+  vector<CompiledRegexp> loaded = LoadPrograms(older);
+  ASSERT_EQ(loaded.size(), v.size());
+  for (unsigned int i = 0; i < v.size(); ++i) {
+    EXPECT_FALSE(loaded[i].engines);
+    ExpectSameProgram(loaded[i].program, v[i].program);
+    // Machines create the engines.
+    EXPECT_EQ(Machine(loaded[i]).GetPlan().str(),
+              Machine(v[i]).GetPlan().str());
+  }
+}
+
+TEST(SerializeTest, ProgramFile) {
+  string path = testing::TempDir() + "azuki_programs.bin";
+  {
+    std::ofstream os(path, std::ios::binary);
+    SavePrograms(CompilePatterns(), os);
+  }
+  {
+    ProgramFile file(path);
+    ASSERT_EQ(file.size(), kPatterns.size());
+    EXPECT_THROW(file.Get(kPatterns.size()), std::runtime_error);
+
+    const vector<string> input = {"caabdab", "ababcef", "mail alice@example",
+                                  "aaaa", "aab", "<a><b>"};
+    for (unsigned int i = 0; i < kPatterns.size(); ++i) {
+      Machine m(file.Get(i));
+      Machine expected = CreateMachine(kPatterns[i]);
+      for (auto &s : input) ExpectSameSearch(m, expected, s);
+    }
+  }
+  std::remove(path.c_str());
+  EXPECT_THROW(ProgramFile file(path), std::runtime_error);
+}
+
+};  // namespace Azuki
@@ -0,0 +1,137 @@
+#include "azuki.h"
+#include "gtest/gtest.h"
+#include "static_regex.h"
+
+namespace Azuki {
+
+namespace {
+
+// Iterate RegexSearch through input with StaticRegex and Machine and compare
+// the results.
+template <FixedString Pattern>
+void ExpectSameSearch(const string &s) {
+  StaticRegex<Pattern> sm;
+  Machine m = CreateMachine(Pattern.data);
+  MatchResult expected, actual;
+  while (true) {
+    bool found = RegexSearch(m, s, expected);
+    EXPECT_EQ(RegexSearch(sm, s, actual), found) << Pattern.data << " " << s;
+    if (!found) break;
+    EXPECT_EQ(actual.begin, expected.begin) << Pattern.data << " " << s;
+    EXPECT_EQ(actual.end, expected.end) << Pattern.data << " " << s;
+    EXPECT_EQ(actual.capture, expected.capture) << Pattern.data << " " << s;
+    EXPECT_EQ(actual.spans, expected.spans) << Pattern.data << " " << s;
+    // After an empty match, search again from the next character.
+    if (expected.begin == expected.end) actual.end = ++expected.end;
+  }
+  EXPECT_EQ(RegexSearch(sm, s), RegexSearch(m, s));
+}
+
+};  // namespace
+
+TEST(StaticRegexTest, Program) {
+  // Same program as CompileRegexp for "a+b".
+  EXPECT_EQ(StaticRegex<"a+b">::ProgramSize(), 5);
+  // Counters are unrolled: "aaa" then two optional "a".
+  EXPECT_EQ(StaticRegex<"a{3,5}">::ProgramSize(), 8);
+  EXPECT_TRUE(StaticRegex<"^a+b$">::match_begin);
+  EXPECT_TRUE(StaticRegex<"^a+b$">::match_end);
+  EXPECT_FALSE(StaticRegex<"a+b">::match_end);
+}
+
+TEST(StaticRegexTest, SimpleNoAnchor) {
+  StaticRegex<"a+b"> m;
+  MatchResult result1, result2;
+  EXPECT_TRUE(RegexSearch(m, "cabd", result1));
+  EXPECT_EQ(result1.begin, 1);
+  EXPECT_EQ(result1.end, 3);
+  EXPECT_TRUE(RegexSearch(m, "aabcab", result2));
+  EXPECT_EQ(result2.begin, 0);
+  EXPECT_EQ(result2.end, 3);
+  EXPECT_FALSE(RegexSearch(m, "b"));
+  EXPECT_FALSE(RegexSearch(m, "cbaa"));
+}
+
+TEST(StaticRegexTest, Anchor) {
+  StaticRegex<"^a+b"> begin;
+  EXPECT_TRUE(RegexSearch(begin, "aaabcc"));
+  EXPECT_FALSE(RegexSearch(begin, "cab"));
+  StaticRegex<"a+b$"> end;
+  EXPECT_TRUE(RegexSearch(end, "caab"));
+  EXPECT_FALSE(RegexSearch(end, "abc"));
+}
+
+TEST(StaticRegexTest, Capture) {
+  StaticRegex<"^(ab)+c(ef)$"> m;
+  MatchResult result;
+  EXPECT_TRUE(RegexSearch(m, "ababcef", result));
+  ASSERT_EQ(result.capture.size(), 2);
+  EXPECT_EQ(result.capture[0], "ab");
+  EXPECT_EQ(result.capture[1], "ef");
+}
+
+TEST(StaticRegexTest, Replace) {
+  StaticRegex<"(a+)b"> m;
+  string s = "caabdabe";
+  EXPECT_EQ(RegexReplace(m, s, "$0ff"), "caaffdabe");
+  EXPECT_EQ(RegexReplace(m, s, "$0ff", true), "caaffdaffe");
+  EXPECT_EQ(RegexReplace(m, "alice", "ef"), "alice");
+}
+
+TEST(StaticRegexTest, ReplaceEmptyMatch) {
+  StaticRegex<"a*"> m;
+  Machine expected = CreateMachine("a*");
+  EXPECT_EQ(RegexReplace(m, "baa", "x", true), "xbxx");
+  EXPECT_EQ(RegexReplace(m, "baa", "x", true),
+            RegexReplace(expected, "baa", "x", true));
+  EXPECT_EQ(RegexReplace(m, "", "x", true), "x");
+  EXPECT_EQ(RegexReplace(StaticRegex<"^a*">{}, "aab", "x", true), "xb");
+}
+
+TEST(StaticRegexTest, CurlyLowZero) {
+  for (const string s : {"b", "ab", "aab", "aaab", "cb"}) {
+    ExpectSameSearch<"a{0,2}b">(s);
+    ExpectSameSearch<"a{0,1}b">(s);
+    ExpectSameSearch<"a{0,}b">(s);
+    ExpectSameSearch<"(a){0,2}b">(s);
+  }
+}
+
+TEST(StaticRegexTest, SameAsMachine) {
+  ExpectSameSearch<"a+b">("caabdabe");
+  ExpectSameSearch<"(ab)+">("dabcccababd");
+  ExpectSameSearch<"a+b$">("abab");
+  ExpectSameSearch<"(ab+)">("abbb");
+  ExpectSameSearch<"(233+)">("6662333QAQ");
+  ExpectSameSearch<"www\\.(\\w+)\\.com">(
+      "https://www.google.com/search?q=Hello");
+  ExpectSameSearch<"[0-9]+|[a-f]+">("zz12ab3f");
+  ExpectSameSearch<"a.c|\\d\\s">("abcx1 a\tc");
+  ExpectSameSearch<"a{2,3}">("aaaaa");
+  ExpectSameSearch<"(?:ab)+(c)">("xababcd");
+  ExpectSameSearch<"\\w+\\s\\d">("caf\xC3\xA9 1\xA0\xE9 2");
+  ExpectSameSearch<"^(\\+\\d{1,2}\\s)?\\(?\\d{3}\\)?(\\s|-|.)\\d{3}(\\s|-|.)\\d{4}$">(
+      "123-456-7890");
+}
+
+TEST(StaticRegexTest, SameCapturesAsMachine) {
+  // Ambiguous patterns: Machine picks the first thread in its queue among
+  // matches ending together.
+  ExpectSameSearch<"(a*)(a*)">("aa");
+  ExpectSameSearch<"(a|ab)(b*)">("ab");
+  ExpectSameSearch<"((.{1,2})+)">("cb");
+  ExpectSameSearch<"((.{1,2})+).*">("cb");
+  ExpectSameSearch<"(a+)(a*)">("aaa");
+  ExpectSameSearch<"(a?)(a?)">("a");
+  for (const string s : {"", "a", "ab", "aab", "abab", "xaabba"}) {
+    ExpectSameSearch<"(a*)(a*)">(s);
+    ExpectSameSearch<"(a|ab)(b*)">(s);
+    ExpectSameSearch<"(a|b)*(b)">(s);
+    ExpectSameSearch<"((a)|(ab))+">(s);
+    ExpectSameSearch<"(a*)(ab)?(b*)">(s);
+    ExpectSameSearch<"(.*)(b)(.*)">(s);
+    ExpectSameSearch<"(a{0,2})(a?b?)">(s);
+  }
+}
+
+};  // namespace Azuki